@@ -0,0 +1,135 @@
+#ifndef __alarm_h
+#define __alarm_h
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "alarm_wheel.h"
+#include "alarm_queue.h"
+#include "alarm_rwlock.h"
+
+/*
+ * The "alarm" structure now contains the absolute deadline of its
+ * next firing, in nanoseconds on CLOCK_MONOTONIC. Storing only the
+ * requested period would not be enough: each firing is scheduled
+ * from the one before, so the Nth firing lands at start + N*period
+ * however long the printing takes, and wall-clock jumps do not move
+ * it.
+ *
+ * The fields a list walk or a firing reads come first and fill one
+ * cache line (the pool hands out alarms on line boundaries); the
+ * message text lives out of line, interned (see alarm_intern.h), so
+ * a walk along the list touches a single line per alarm.
+ */
+typedef struct alarm_tag {
+        _Atomic(struct alarm_tag *) link;
+        // Integer used to hold the message number
+        int               messageNum;
+        /* Integer that keeps track of the alarm request type, either adding a
+        *  new alarm (1) or cancelling an alarm from the alarm list (0)*/
+        int               alarmRequestType;
+        /* Integer that holds a value determining if the alarm exists in the
+        *  alarm list (1 if it exists, 0 if not) */
+        atomic_int        alarmExistsFlag;
+        /* Sequence count over "seconds" and "message": odd while a change
+        *  is being written, twice the number of changes otherwise */
+        atomic_uint       version;
+        _Atomic double    seconds;                      /* period, may be fractional */
+        uint64_t          deadline;                     /* ns, CLOCK_MONOTONIC */
+        // Interned text, intern_empty for a cancel request
+        _Atomic(const char *) message;
+        // Who gets the output about the alarm, LOG_CONSOLE for the prompt
+        int               client;
+        /* Number of changes the alarm had when it was last displayed, so
+        *  the dispatcher knows when to report "MESSAGE CHANGED" */
+        unsigned          shownVersion;
+        // Number of times the alarm has been displayed
+        int               displays;
+        // Where the alarm is in the scheduler, guarded by its mutex
+        int               schedState;
+        /* Displays after which the alarm retires itself, 0 for no limit,
+        *  and the time on the engine's clock past which it does, 0 for
+        *  none; both are set when it is added and kept by a change */
+        int               limit;
+        uint64_t          expires;
+
+        // Previous alarm on the list, so an alarm can be unlinked in place
+        struct alarm_tag  *prev;
+        // Links on the skip list levels above the list itself, or NULL
+        struct alarm_tower_tag *tower;
+        // Position of the alarm on the scheduler's timing wheel
+        wheel_timer_t     timer;
+        // Link on the alarm thread's request queue
+        queue_node_t      queueNode;
+} alarm_t;
+
+// Whether the alarm retires itself rather than repeating until cancelled
+#define alarm_limited(alarm) ((alarm)->limit != 0 || (alarm)->expires != 0)
+
+// Longest message kept; the rest of a longer one is dropped
+#define ALARM_MESSAGE_MAX       4000
+
+/*
+ * What a change can rewrite, read as one consistent version by
+ * alarm_read without taking any lock. The message stays valid until
+ * the reader's epoch section ends.
+ */
+typedef struct alarm_snapshot_tag {
+        double            seconds;
+        const char        *message;
+        unsigned          version;                      /* changes so far */
+} alarm_snapshot_t;
+
+// Recovers the alarm from its request queue link
+#define queue_alarm(node) \
+        ((alarm_t*)((char*)(node) - offsetof(alarm_t, queueNode)))
+
+/*
+ * The alarm store, split by message number into ALARM_SHARDS lists,
+ * each kept sorted by message number and each with a lock of its
+ * own, so requests for unrelated message numbers do not wait on one
+ * another. Each list is the bottom level of a skip list, so a place
+ * in it is found in logarithmic time. Callers must hold the writer
+ * side of the lock for the message number (alarm_shard_lock) around
+ * every call below that takes an alarm. Readers do not lock: they
+ * may follow "link" along a list inside epoch_enter/epoch_exit, and
+ * nodes taken off a list are only freed through epoch_retire once no
+ * reader can reach them.
+ */
+#ifndef ALARM_SHARDS
+# define ALARM_SHARDS           16
+#endif
+
+/*
+ * What alarm_insert did with a request. The errors are the ones it
+ * reports to the request's client, and ALARM_REFUSED one the engine
+ * reports before the request gets that far.
+ */
+#define ALARM_ADDED             0
+#define ALARM_CHANGED           1                       /* existing alarm */
+#define ALARM_CANCELLED         2                       /* cancel is linked */
+#define ALARM_MISSING           -1                      /* "Does NOT Exist" */
+#define ALARM_MULTIPLE          -2                      /* already cancelled */
+#define ALARM_REFUSED           -3                      /* over the alarm limit */
+
+typedef void (*alarm_visit_t) (alarm_t *alarm, void *arg);
+
+void alarm_list_init (void);
+void alarm_list_destroy (void);
+int alarm_shard_of (int messageNum);
+alarm_rwlock_t *alarm_shard_lock (int messageNum);
+void alarm_list_walk (alarm_visit_t visit, void *arg);
+void alarm_list_range (int first, int last, alarm_visit_t visit, void *arg);
+int findTypeA (alarm_t *alarm);
+int findTypeB (alarm_t *alarm);
+void changeAlarm (alarm_t *alarm);
+void alarm_read (alarm_t *alarm, alarm_snapshot_t *snapshot);
+int alarm_insert (alarm_t *alarm);
+void alarm_merge (alarm_t **batch, int count, int *results);
+void alarm_append (alarm_t **batch, int count);
+alarm_t *alarm_find (int messageNum);
+alarm_t *alarm_remove (alarm_t *cancel);
+int alarm_expire (alarm_t *alarm);
+
+#endif
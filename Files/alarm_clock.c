@@ -0,0 +1,76 @@
+/*
+ * alarm_clock.c
+ *
+ * The real and the virtual clock behind the scheduler.
+ */
+#include <time.h>
+#include <stdatomic.h>
+#include "errors.h"
+#include "alarm_clock.h"
+
+static int clock_virtual;
+static atomic_uint_fast64_t clock_virtual_now;
+
+/*
+ * Switches to the virtual clock, reading "start" until it is moved.
+ * Must be called before anything reads the clock.
+ */
+void clock_set_virtual (uint64_t start)
+{
+        clock_virtual = 1;
+        atomic_store(&clock_virtual_now, start);
+}
+
+int clock_is_virtual (void)
+{
+        return clock_virtual;
+}
+
+uint64_t clock_now (void)
+{
+        struct timespec now;
+
+        if (clock_virtual)
+                return atomic_load_explicit(&clock_virtual_now,
+                  memory_order_relaxed);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Moves the virtual clock on to "now"; it never goes back
+void clock_advance (uint64_t now)
+{
+        if (now > atomic_load(&clock_virtual_now))
+                atomic_store(&clock_virtual_now, now);
+}
+
+/*
+ * Sleeps on "cond" until it is signalled or the clock reaches
+ * "deadline" (UINT64_MAX for no deadline), like
+ * pthread_cond_timedwait. The virtual clock has no timer behind it,
+ * so there a waiter sleeps until it is signalled; whoever moves the
+ * clock wakes whoever needs it. The condition variable must come
+ * from clock_cond_init.
+ */
+int clock_wait (pthread_cond_t *cond, pthread_mutex_t *mutex,
+  uint64_t deadline)
+{
+        struct timespec when;
+
+        if (clock_virtual || deadline == UINT64_MAX)
+                return pthread_cond_wait(cond, mutex);
+        when.tv_sec = deadline / 1000000000;
+        when.tv_nsec = deadline % 1000000000;
+        return pthread_cond_timedwait(cond, mutex, &when);
+}
+
+// A condition variable whose timed waits are on the real clock
+void clock_cond_init (pthread_cond_t *cond)
+{
+        pthread_condattr_t attr;
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(cond, &attr);
+        pthread_condattr_destroy(&attr);
+}
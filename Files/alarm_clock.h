@@ -0,0 +1,23 @@
+#ifndef __alarm_clock_h
+#define __alarm_clock_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * The clock the alarms run on, in nanoseconds. Normally it is
+ * CLOCK_MONOTONIC and a thread waits for a time by sleeping on a
+ * condition variable until then. In virtual mode (see alarm_sim.h)
+ * it only moves when clock_advance moves it, so a workload that
+ * would take a day runs as fast as the alarms can be fired, and the
+ * same input gives the same output every time.
+ */
+void clock_set_virtual (uint64_t start);
+int clock_is_virtual (void);
+uint64_t clock_now (void);
+void clock_advance (uint64_t now);
+int clock_wait (pthread_cond_t *cond, pthread_mutex_t *mutex,
+  uint64_t deadline);
+void clock_cond_init (pthread_cond_t *cond);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * alarm_cpp.cpp
+ *
+ * A reduced example of embedding the header-only AlarmScheduler: an
+ * Alarm> prompt whose firings come back to a handler here. It is not
+ * a front end for New_Alarm_Cond and takes only a subset of its
+ * commands:
+ *
+ *      <seconds> Message(n) text       add or change an alarm
+ *      Cancel: Message(n)              cancel one alarm
+ *      List                            list every alarm
+ *
+ * For those it writes New_Alarm_Cond's lines, to the same streams.
+ * The rest of New_Alarm_Cond's commands (Once, Times(n), Expires(s),
+ * Stats, List and Cancel of a range) are refused as unsupported. The
+ * timing differs: the CANCEL line comes as the command is taken, and
+ * a change is reported by the next firing, as MESSAGE CHANGED, where
+ * New_Alarm_Cond shows one plain display first.
+ *
+ * Usage: alarm_cpp [-t dispatchers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "alarm_scheduler.hpp"
+
+using namespace alarm_scheduler;
+
+typedef AlarmScheduler<std::string, SteadyClock, MutexLock, OrderedIndex>
+  scheduler_t;
+
+// Lines from the dispatchers and the prompt are not interleaved
+static std::mutex output_mutex;
+
+static void on_firing (const Firing<std::string> &firing)
+{
+        std::lock_guard<std::mutex> guard(output_mutex);
+
+        switch (firing.kind)
+        {
+        case DISPLAY:
+                printf("Message(%d) %s\n", firing.id,
+                  firing.payload->c_str());
+                break;
+        case MESSAGE_CHANGED:
+                printf("MESSAGE CHANGED: Message(%d) %s\n", firing.id,
+                  firing.payload->c_str());
+                break;
+        case GONE:
+                printf("DISPLAY THREAD EXITING: Message(%d)\n", firing.id);
+                break;
+        }
+        fflush(stdout);
+}
+
+/*
+ * Whether the line is one of New_Alarm_Cond's commands that this
+ * example does not take, rather than bad input.
+ */
+static bool unsupported (const char *line)
+{
+        double seconds;
+        int first, last, offset = 0;
+
+        if (strncmp(line, "Stats", 5) == 0
+          || sscanf(line, "Cancel: Message(%d-%d)", &first, &last) == 2
+          || (strncmp(line, "List", 4) == 0
+          && strstr(line, "Message(") != NULL))
+                return true;
+        if (sscanf(line, "%lf %n", &seconds, &offset) != 1 || offset == 0)
+                return false;
+        return strncmp(line + offset, "Once", 4) == 0
+          || strncmp(line + offset, "Times(", 6) == 0
+          || strncmp(line + offset, "Expires(", 8) == 0;
+}
+
+int main (int argc, char *argv[])
+{
+        scheduler_t scheduler(on_firing);
+        int threads = 1, option, messageNum, offset, result;
+        double seconds;
+        char line[4096], message[4096];
+
+        while ((option = getopt(argc, argv, "t:")) != -1)
+        {
+                if (option != 't' || (threads = atoi(optarg)) <= 0)
+                {
+                        fprintf(stderr, "Usage: %s [-t dispatchers]\n",
+                          argv[0]);
+                        exit(1);
+                }
+        }
+        scheduler.start(threads);
+
+        while (1)
+        {
+                {
+                        std::lock_guard<std::mutex> guard(output_mutex);
+
+                        printf("Alarm> ");
+                        fflush(stdout);
+                }
+                if (fgets(line, sizeof(line), stdin) == NULL)
+                        break;
+                if (strlen(line) <= 1)
+                        continue;
+                std::lock_guard<std::mutex> guard(output_mutex);
+
+                if (sscanf(line, "%lf Message(%d) %4095[^\n]", &seconds,
+                  &messageNum, message) == 3)
+                {
+                        //The handler's first firing waits for this line;
+                        //a change is announced by the firing itself
+                        result = scheduler.add(messageNum, seconds, message);
+                        if (result == ADDED)
+                                printf("DISPLAY THREAD CREATED FOR: "
+                                  "Message(%d) %s\n", messageNum, message);
+                        else if (result == BAD_PERIOD)
+                                fprintf(stderr, "ERROR!!! Bad Input\n");
+                }
+                else if (offset = 0, sscanf(line, "Cancel: Message(%d)%n",
+                  &messageNum, &offset) == 1 && offset > 0)
+                {
+                        //The C engine prints the cancel request's text,
+                        //which is always empty
+                        if (scheduler.cancel(messageNum) == CANCELLED)
+                                printf("CANCEL: Message(%d) \n", messageNum);
+                        else
+                                printf("ERROR!!! Alarm With Message Number "
+                                  "(%d) Does NOT Exist\n", messageNum);
+                }
+                else if (offset = 0, sscanf(line, "List %n", &offset),
+                  offset > 0 && line[offset] == '\0')
+                {
+                        scheduler.for_each([] (int id, double period,
+                          const std::string &text) {
+                                printf("LIST: %g Message(%d) %s\n", period,
+                                  id, text.c_str());
+                        });
+                        printf("LIST: %zu alarms\n", scheduler.size());
+                }
+                else if (unsupported(line))
+                        fprintf(stderr, "ERROR!!! Not Supported By "
+                          "alarm_cpp\n");
+                else
+                        fprintf(stderr, "ERROR!!! Bad Input\n");
+                fflush(stdout);
+        }
+        scheduler.stop();
+        return 0;
+}
@@ -0,0 +1,1116 @@
+/*
+ * alarm_engine.c
+ *
+ * The alarm engine behind the Alarm> prompt: command handling, the
+ * alarm thread, and what a dispatcher does when an alarm comes due.
+ */
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_rwlock.h"
+#include "alarm_epoch.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+#include "alarm_log.h"
+#include "alarm_sched.h"
+#include "alarm_queue.h"
+#include "alarm_stats.h"
+#include "alarm_parse.h"
+#include "alarm_wal.h"
+#include "alarm_snapshot.h"
+#include "alarm_clock.h"
+#include "alarm_intake.h"
+#include "alarm_engine.h"
+
+// Fires the alarms from a fixed pool of dispatcher threads
+alarm_sched_t alarm_sched;
+// Alarms and cancel requests waiting for the alarm thread
+alarm_queue_t alarm_queue;
+// Called after every display when the engine is being measured
+static engine_fire_hook_t fire_hook;
+// Told what happens to the alarms of clients that take no text
+static engine_event_hook_t event_hook;
+// When the engine started, on its clock
+static uint64_t engine_started;
+// Every command, with when it came (config->trace_path)
+static FILE *trace_file;
+// Every display, with when it was due (config->firing_path)
+static FILE *firing_file;
+// Most alarms on the list at once, 0 for no limit
+static long max_alarms;
+// Alarms on the list, counting those let in and not yet linked
+static atomic_long engine_alarms;
+// Requests wait for their log record to be synced (WAL_SYNC_FULL)
+static int engine_sync_full;
+
+/*
+ * Takes the writer side of the lock on the message number's shard,
+ * recording the wait. Returns the time it was acquired, for
+ * list_unlock to record the hold.
+ */
+static uint64_t list_lock (int messageNum)
+{
+        uint64_t start = stats_clock(), acquired;
+
+        rwlock_write_lock(alarm_shard_lock(messageNum));
+        acquired = stats_clock();
+        stats_record(STAT_LIST_WAIT, acquired - start);
+        return acquired;
+}
+
+static void list_unlock (int messageNum, uint64_t acquired)
+{
+        stats_record(STAT_LIST_HOLD, stats_clock() - acquired);
+        rwlock_write_unlock(alarm_shard_lock(messageNum));
+}
+
+// Frees a request along with its reference on the message
+static void engine_free (void *node)
+{
+        alarm_t *alarm = (alarm_t*)node;
+
+        intern_release(alarm->message);
+        alarm_free(alarm);
+}
+
+// Gets a request ready to go on the list, before the shard is locked
+static void engine_reset (alarm_t *alarm)
+{
+        //Alarm flag and tracking is updated
+        alarm->version = 0;
+        alarm->alarmExistsFlag = 0;
+        alarm->shownVersion = 0;
+        alarm->displays = 0;
+        alarm->schedState = SCHED_IDLE;
+        //The parser leaves the time to live, which counts from now
+        if (alarm->expires != 0)
+                alarm->expires += clock_now();
+}
+
+/*
+ * Whether an add or change is logged. Alarms that retire themselves
+ * are for short-lived timers, which a restart would find long gone,
+ * so they are neither logged nor kept in snapshots, and nor are the
+ * changes to them. "previous" is an add for the same message number
+ * that is going on the list ahead of this one, or NULL.
+ */
+static int engine_logged (alarm_t *alarm, alarm_t *previous)
+{
+        alarm_t *existing = alarm_find(alarm->messageNum);
+
+        if (existing == NULL && previous != NULL
+          && previous->messageNum == alarm->messageNum)
+                existing = previous;
+        return !alarm_limited(existing != NULL ? existing : alarm);
+}
+
+// Tells a client that takes events what has happened to its alarm
+static void engine_event (alarm_t *alarm, int event, const char *message)
+{
+        if (alarm->client < LOG_CONSOLE && event_hook != NULL)
+                event_hook(alarm, event, message);
+}
+
+/*
+ * Writes a display to the firing log, stamped with when it was due
+ * rather than when it ran, so runs on either clock can be compared.
+ */
+static void engine_fired (alarm_t *alarm, const char *what,
+  const char *message)
+{
+        if (firing_file == NULL)
+                return;
+        fprintf(firing_file, "%.3f %sMessage(%d)%s%s\n",
+          (double)(alarm->deadline - engine_started) / 1e9, what,
+          alarm->messageNum, message != NULL ? " " : "",
+          message != NULL ? message : "");
+}
+
+/*
+ * Takes an alarm that has run its course off the list, unless a cancel
+ * got there first and will take it off itself. Called by the alarm's
+ * dispatcher. Returns 1 if it was taken off.
+ */
+static int engine_retire (alarm_t *alarm)
+{
+        uint64_t acquired;
+        int retired;
+
+        acquired = list_lock(alarm->messageNum);
+        retired = alarm_expire(alarm);
+        if (retired)
+                atomic_fetch_sub(&engine_alarms, 1);
+        list_unlock(alarm->messageNum, acquired);
+        if (retired)
+                stats_count(STAT_EXPIRED, 1);
+        return retired;
+}
+
+// Reports that the alarm's dispatcher is letting go of it
+static void engine_exiting (alarm_t *alarm)
+{
+        log_client_printf(alarm->client, STDOUT_FILENO,
+          "DISPLAY THREAD EXITING: Message(%d)\n", alarm->messageNum);
+        engine_fired(alarm, "DISPLAY THREAD EXITING: ", NULL);
+        engine_event(alarm, ENGINE_EVENT_GONE, NULL);
+}
+
+//The periodic_display routine is responsible for periodically looking up an
+//alarm request with a specific Message Number in the alarm list, then printing,
+//every Time (seconds). It is called by a dispatcher thread each time the alarm
+//comes due and returns the number of nanoseconds until the next time, or -1
+//once the alarm has been cancelled
+static int64_t periodic_display (alarm_t *alarm)
+{
+        //variable holding the amount of time in nanoseconds until
+        //the alarm is displayed again
+        int64_t sleepLength;
+        double lateness;
+        alarm_snapshot_t snapshot;
+
+        //An alarm that has outlived its time to live goes without
+        //showing again
+        if (alarm->expires != 0 && alarm->deadline > alarm->expires
+          && alarm->alarmExistsFlag)
+                engine_retire(alarm);
+
+        //Reads the alarm without locking the list
+        epoch_enter();
+
+        //Takes the period and message as of one version, so a change
+        //made meanwhile is seen whole or not at all
+        alarm_read(alarm, &snapshot);
+        //gets the sleep length time from the alarm field seconds
+        sleepLength = (int64_t)(snapshot.seconds * 1e9 + 0.5);
+
+        //If the alarm no longer exists
+        if(alarm->alarmExistsFlag == 0)
+        {
+                //inform the user the alarm no longer exisits
+                engine_exiting(alarm);
+                //Tells the scheduler to drop the alarm
+                sleepLength = -1;
+        }
+        //Until the alarm has been changed, and for the first display after
+        //its first change, the message is printed as it is
+        else if (snapshot.version == 0 || alarm->shownVersion == 0)
+        {
+                //prints the alarm message number as well as the message
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "Message(%d) %s\n", alarm->messageNum, snapshot.message);
+                engine_fired(alarm, "", snapshot.message);
+                engine_event(alarm, ENGINE_EVENT_DISPLAY, snapshot.message);
+        }
+
+        //From then on every display reports the change
+        else
+        {
+                //if the message has been changed prints the following
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "MESSAGE CHANGED: Message(%d) %s\n", alarm->messageNum,
+                  snapshot.message);
+                engine_fired(alarm, "MESSAGE CHANGED: ", snapshot.message);
+                engine_event(alarm, ENGINE_EVENT_CHANGED, snapshot.message);
+        }
+        alarm->shownVersion = snapshot.version;
+
+        epoch_exit();
+
+        //The first display of a repeating alarm is straight after it is
+        //added, so only the periodic ones have a due time to measure
+        //against; every display of one that retires itself has
+        if (sleepLength >= 0)
+        {
+                stats_count(STAT_FIRINGS, 1);
+                if (++alarm->displays > 1 || alarm_limited(alarm))
+                {
+                        lateness = engine_now() - alarm->deadline / 1e9;
+                        stats_record(STAT_LATENESS, lateness > 0
+                          ? (uint64_t)(lateness * 1e9) : 0);
+                        if (fire_hook != NULL)
+                                fire_hook(alarm, lateness);
+                }
+        }
+
+        //After its last display an alarm that retires itself goes at
+        //once, with no cancel
+        if (sleepLength >= 0 && ((alarm->limit != 0
+          && alarm->displays >= alarm->limit) || (alarm->expires != 0
+          && alarm->deadline + sleepLength > alarm->expires))
+          && engine_retire(alarm))
+        {
+                engine_exiting(alarm);
+                sleepLength = -1;
+        }
+
+        //The scheduler lets go of the alarm when it is dropped, so it can be
+        //freed once no reader walking the list can still be on it
+        if (sleepLength < 0)
+                epoch_retire(alarm, engine_free);
+
+        return sleepLength;
+}
+
+/*
+ * Carries out one request that has gone on the list: hands an alarm
+ * to the scheduler, or takes a cancelled alarm off. Called by the
+ * alarm thread, or straight from the submitting thread on the
+ * virtual clock.
+ */
+static void engine_handle (alarm_t *alarm)
+{
+        alarm_t *cancelled;
+        alarm_snapshot_t snapshot;
+        uint64_t acquired, lsn;
+
+        //Checks if the is of type A
+        if (alarm->alarmRequestType == 1)
+        {
+                //Hands the alarm to the dispatcher pool, which
+                //displays it now and then every alarm->seconds, or
+                //first one period on if it retires itself. It is on
+                //the list already, so it may be changing
+                epoch_enter();
+                alarm_read(alarm, &snapshot);
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "DISPLAY THREAD CREATED FOR: Message(%d) %s\n",
+                  alarm->messageNum, snapshot.message);
+                engine_event(alarm, ENGINE_EVENT_CREATED, snapshot.message);
+                epoch_exit();
+                sched_add(&alarm_sched, alarm, alarm_limited(alarm)
+                  ? (int64_t)(snapshot.seconds * 1e9 + 0.5) : 0);
+        }
+
+        //Checks if the is of type B
+        //Alarm needs to be removed from the alarm list
+        if (alarm->alarmRequestType == 0)
+        {
+                //aquire
+                acquired = list_lock(alarm->messageNum);
+                //Keeps the cancelled alarm from being freed until
+                //its dispatcher has been woken
+                epoch_enter();
+
+                //Takes the cancel request and the alarm it cancels
+                //off the list, flagging both as removed
+                cancelled = alarm_remove(alarm);
+                //The cancel is logged as it takes effect, in order
+                //with the other requests for the alarm
+                lsn = 0;
+                if (cancelled != NULL)
+                {
+                        lsn = wal_append(0, alarm->messageNum, 0,
+                          intern_empty);
+                        atomic_fetch_sub(&engine_alarms, 1);
+                }
+                //Cancel message printed once the cancel request is
+                //recieved and handled
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "CANCEL: Message(%d) %s\n",
+                  alarm->messageNum, alarm->message);
+                engine_event(alarm, ENGINE_EVENT_CANCELLED, NULL);
+
+                //aquire
+                list_unlock(alarm->messageNum, acquired);
+                wal_wait(lsn);
+
+                //Fires the alarm now so its dispatcher sees the
+                //cancel, rather than at the end of its period
+                if (cancelled != NULL)
+                        sched_wake(&alarm_sched, cancelled);
+                epoch_exit();
+
+                //Nothing else holds the cancel request, so it can
+                //go as soon as readers are done with it
+                epoch_retire(alarm, engine_free);
+
+        }
+}
+
+/*
+ * The alarm thread's start routine.
+ */
+static void *alarm_thread (void *arg)
+{
+        /*
+         * Loop forever, processing commands. The alarm thread will
+         * be disintegrated when the process exits. It sleeps on the
+         * request queue until the main thread pushes an alarm or a
+         * cancel request that it has put on the list, and handles
+         * them in the order they were entered.
+         */
+
+        while (1)
+                engine_handle(queue_alarm(queue_pop(&alarm_queue)));
+        return NULL;
+}
+
+/*
+ * Applies one logged request while the table is being restored, with
+ * nothing scheduled yet: an add or change as it was first applied, a
+ * cancel by taking the alarm off at once. A request the snapshot
+ * already took in finds the alarm as it left it and is skipped, so
+ * the alarm is not shown as changed for it.
+ */
+static void engine_replay (wal_record_t *record, void *arg)
+{
+        alarm_t *alarm, *existing, *cancelled;
+        uint64_t acquired;
+        int result;
+
+        alarm = alarm_alloc();
+        alarm->messageNum = record->messageNum;
+        alarm->alarmRequestType = record->type;
+        alarm->seconds = record->seconds;
+        alarm->limit = 0;
+        alarm->expires = 0;
+        alarm->client = LOG_CONSOLE;
+        alarm->message = record->type == 1
+          ? intern_get(record->message, record->length) : intern_empty;
+        engine_reset(alarm);
+
+        acquired = list_lock(alarm->messageNum);
+        existing = alarm_find(alarm->messageNum);
+        //Interned, the same text is the same pointer
+        if (existing == NULL ? record->type != 1 : (record->type == 1
+          && existing->seconds == alarm->seconds
+          && existing->message == alarm->message))
+                engine_free(alarm);
+        else if ((result = alarm_insert(alarm)) == ALARM_CHANGED)
+                engine_free(alarm);
+        else if (result == ALARM_ADDED)
+                atomic_fetch_add(&engine_alarms, 1);
+        else if (result == ALARM_CANCELLED)
+        {
+                cancelled = alarm_remove(alarm);
+                atomic_fetch_sub(&engine_alarms, 1);
+                epoch_retire(cancelled, engine_free);
+                epoch_retire(alarm, engine_free);
+        }
+        list_unlock(alarm->messageNum, acquired);
+}
+
+// Restored alarms waiting to be scheduled
+typedef struct engine_restored_tag {
+        alarm_t           **alarms;
+        int               count, size;
+        uint64_t          now;
+} engine_restored_t;
+
+// Collects a restored alarm, due one period from the end of the restore
+static void engine_schedule (alarm_t *alarm, void *arg)
+{
+        engine_restored_t *restored = (engine_restored_t*)arg;
+
+        if (alarm->alarmRequestType != 1 || alarm->alarmExistsFlag == 0)
+                return;
+        if (restored->count == restored->size)
+        {
+                restored->size *= 2;
+                restored->alarms = (alarm_t**)realloc(restored->alarms,
+                  restored->size * sizeof(alarm_t*));
+                if (restored->alarms == NULL)
+                        errno_abort ("Allocate restore");
+        }
+        alarm->deadline = restored->now
+          + (uint64_t)(alarm->seconds * 1e9 + 0.5);
+        restored->alarms[restored->count++] = alarm;
+}
+
+/*
+ * Loads the alarms in a snapshot. The records are in message number
+ * order, so each shard's share is appended to it as it stands, with
+ * no searching.
+ */
+static void engine_load (snapshot_t *snapshot)
+{
+        const snapshot_record_t *record;
+        alarm_t *alarm, **alarms;
+        size_t first[ALARM_SHARDS + 1] = { 0 }, next[ALARM_SHARDS], i;
+        uint64_t acquired;
+        int shard;
+
+        alarms = (alarm_t**)malloc((snapshot->count + 1) * sizeof(alarm_t*));
+        if (alarms == NULL)
+                errno_abort ("Allocate restore");
+        for (i = 0; i < snapshot->count; i++)
+                first[alarm_shard_of(snapshot->records[i].messageNum) + 1]++;
+        for (shard = 0; shard < ALARM_SHARDS; shard++)
+        {
+                first[shard + 1] += first[shard];
+                next[shard] = first[shard];
+        }
+        for (i = 0; i < snapshot->count; i++)
+        {
+                record = &snapshot->records[i];
+                alarm = alarm_alloc();
+                alarm->messageNum = record->messageNum;
+                alarm->alarmRequestType = 1;
+                alarm->seconds = record->seconds;
+                alarm->limit = 0;
+                alarm->expires = 0;
+                alarm->message = intern_get(snapshot->text + record->offset,
+                  record->length);
+                alarm->client = LOG_CONSOLE;
+                engine_reset(alarm);
+                //Carries on reporting "MESSAGE CHANGED" if it was
+                alarm->version = record->changes * 2;
+                alarm->shownVersion = record->changes;
+                alarms[next[alarm_shard_of(alarm->messageNum)]++] = alarm;
+        }
+        //Message number "shard" is on shard "shard"
+        for (shard = 0; shard < ALARM_SHARDS; shard++)
+        {
+                acquired = list_lock(shard);
+                alarm_append(alarms + first[shard],
+                  first[shard + 1] - first[shard]);
+                list_unlock(shard, acquired);
+        }
+        atomic_fetch_add(&engine_alarms, snapshot->count);
+        free(alarms);
+}
+
+/*
+ * Rebuilds the table from the snapshot and log in config->dir, then
+ * schedules every alarm and opens the log for new requests.
+ */
+static void engine_restore (wal_config_t *config)
+{
+        engine_restored_t restored;
+        snapshot_t snapshot;
+        wal_stats_t stats;
+        unsigned long generation = 0;
+        size_t count = 0;
+        double start = engine_now();
+
+        if (snapshot_open(config->dir, &snapshot) == 0)
+        {
+                generation = snapshot.generation;
+                count = snapshot.count;
+                engine_load(&snapshot);
+                snapshot_close(&snapshot);
+        }
+        wal_open(config, generation, engine_replay, NULL);
+
+        restored.size = 4096;
+        restored.count = 0;
+        restored.alarms = (alarm_t**)malloc(restored.size * sizeof(alarm_t*));
+        if (restored.alarms == NULL)
+                errno_abort ("Allocate restore");
+        restored.now = sched_now();
+        alarm_list_walk(engine_schedule, &restored);
+        sched_add_batch(&alarm_sched, restored.alarms, restored.count);
+        free(restored.alarms);
+        wal_get_stats(&stats);
+        log_printf(STDERR_FILENO, "RESTORED: %zu alarms from the snapshot, "
+          "%lu log records replayed, in %.3f s\n", count, stats.replayed,
+          engine_now() - start);
+}
+
+/*
+ * Writes a snapshot and drops the log it replaces. Every request in
+ * the segments before the new one was logged under its shard's lock
+ * and applied in the same hold, so taking each lock once makes sure
+ * the walk finds them all applied.
+ */
+static void engine_checkpoint (wal_config_t *config)
+{
+        unsigned long generation;
+        size_t count;
+        int i;
+
+        generation = wal_rotate();
+        for (i = 0; i < ALARM_SHARDS; i++)
+        {
+                rwlock_read_lock(alarm_shard_lock(i));
+                rwlock_read_unlock(alarm_shard_lock(i));
+        }
+        if (snapshot_save(config->dir, generation, &count) != 0)
+        {
+                log_printf(STDERR_FILENO, "SNAPSHOT: not written: %s\n",
+                  strerror(errno));
+                return;
+        }
+        wal_drop(generation);
+}
+
+// Takes a snapshot every config->snapshot_seconds that anything is logged
+static void *checkpoint_thread (void *arg)
+{
+        wal_config_t *config = (wal_config_t*)arg;
+        wal_stats_t stats;
+        unsigned long logged = 0;
+
+        while (1)
+        {
+                sleep(config->snapshot_seconds);
+                wal_get_stats(&stats);
+                if (stats.records == logged)
+                        continue;
+                logged = stats.records;
+                engine_checkpoint(config);
+        }
+        return NULL;
+}
+
+// Seconds, with the fraction, on the scheduler's clock
+double engine_now (void)
+{
+        return sched_now() / 1e9;
+}
+
+// Seconds since the engine started, on the scheduler's clock
+double engine_elapsed (void)
+{
+        return (double)(sched_now() - engine_started) / 1e9;
+}
+
+/*
+ * Fires every alarm due up to "seconds" after the engine started, on
+ * the virtual clock, and moves the clock on to then.
+ */
+void engine_advance (double seconds)
+{
+        sched_run(&alarm_sched, engine_started
+          + (uint64_t)(seconds * 1e9 + 0.5));
+}
+
+// Applies a batch taken out of the intake ring
+static void engine_intake_apply (alarm_t **batch, int count)
+{
+        engine_submit_batch(batch, count, NULL);
+}
+
+// Opens a file the engine writes as it goes, a line at a time
+static FILE *engine_open_log (const char *path)
+{
+        FILE *file;
+
+        if (path == NULL)
+                return NULL;
+        file = fopen(path, "w");
+        if (file == NULL)
+                errno_abort ("Open log file");
+        setvbuf(file, NULL, _IOLBF, 0);
+        return file;
+}
+
+/*
+ * Starts the logger, the dispatcher pool and the alarm thread, and
+ * restores the alarms from config->wal.dir if it is set. Must be
+ * called once, before the first command. On the virtual clock there
+ * is neither pool nor alarm thread: requests are carried out as they
+ * are submitted and alarms fire when engine_advance is called.
+ */
+void engine_start (engine_config_t *config)
+{
+        pthread_t thread;
+        int status;
+
+        if (config->virtual_clock)
+                clock_set_virtual(0);
+        max_alarms = config->max_alarms;
+        engine_sync_full = config->wal.dir != NULL
+          && config->wal.sync == WAL_SYNC_FULL;
+        engine_started = sched_now();
+        trace_file = engine_open_log(config->trace_path);
+        firing_file = engine_open_log(config->firing_path);
+        alarm_list_init();
+        fire_hook = config->fire_hook;
+        event_hook = config->event_hook;
+        stats_init(config->dispatchers);
+        log_start(&config->log);
+        if (config->stats_path != NULL)
+                stats_dump_start(config->stats_path, config->stats_interval);
+        sched_start(&alarm_sched, config->virtual_clock ? 0
+          : config->dispatchers, config->pin_dispatchers, periodic_display);
+        queue_init(&alarm_queue);
+
+        //Creates the thread, and the ring commands wait in for it
+        if (!config->virtual_clock)
+        {
+                status = pthread_create (&thread, NULL, alarm_thread, NULL);
+                if (status != 0)
+                        err_abort (status, "Create alarm thread");
+                intake_start(&config->intake, engine_intake_apply);
+        }
+
+        //Brings back the alarms from before a restart, then logs from here
+        if (config->wal.dir != NULL)
+        {
+                engine_restore(&config->wal);
+                status = pthread_create (&thread, NULL, checkpoint_thread,
+                  &config->wal);
+                if (status != 0)
+                        err_abort (status, "Create snapshot thread");
+        }
+}
+
+void engine_config_default (engine_config_t *config)
+{
+        config->dispatchers = SCHED_DEFAULT_THREADS;
+        config->pin_dispatchers = 0;
+        config->log.flush_ms = LOG_DEFAULT_FLUSH_MS;
+        config->log.overflow = LOG_BLOCK;
+        config->log.ring_lines = LOG_DEFAULT_RING_LINES;
+        config->fire_hook = NULL;
+        config->event_hook = NULL;
+        config->stats_path = NULL;
+        config->stats_interval = ENGINE_STATS_INTERVAL;
+        config->wal.dir = NULL;
+        config->wal.sync = WAL_SYNC_GROUP;
+        config->wal.commit_ms = WAL_DEFAULT_COMMIT_MS;
+        config->wal.snapshot_seconds = WAL_DEFAULT_SNAPSHOT_SECONDS;
+        config->virtual_clock = 0;
+        config->trace_path = NULL;
+        config->firing_path = NULL;
+        config->intake.capacity = INTAKE_DEFAULT_CAPACITY;
+        config->intake.overload = INTAKE_BLOCK;
+        config->max_alarms = 0;
+}
+
+/*
+ * Writes a command to the trace, stamped with the seconds since the
+ * engine started. The stamp is taken with the file locked, so the
+ * trace is in time order however many threads are writing to it.
+ */
+static void engine_trace (const char *line, const char *end)
+{
+        while (end > line && (end[-1] == '\n' || end[-1] == '\r'))
+                end--;
+        flockfile(trace_file);
+        fprintf(trace_file, "%.6f %.*s\n", engine_elapsed(),
+          (int)(end - line), line);
+        funlockfile(trace_file);
+}
+
+/*
+ * Parses the command in "line", up to "end", into the alarm, on
+ * behalf of "client". Counts it, and answers it if it was Stats or
+ * bad input. Returns the PARSE_ kind; only PARSE_ALARM and
+ * PARSE_CANCEL leave a request to submit, and PARSE_LIST and
+ * PARSE_CANCEL_RANGE a range for engine_range.
+ */
+int engine_parse (const char *line, const char *end, alarm_t *alarm,
+  parse_range_t *range, int client)
+{
+        int kind;
+
+        stats_count (STAT_COMMANDS, 1);
+        if (trace_file != NULL)
+                engine_trace (line, end);
+        kind = parse_command (line, end, alarm, range);
+        //"Stats" prints what the engine has been doing
+        if (kind == PARSE_STATS)
+                stats_report (client, STDOUT_FILENO);
+        else if (kind == PARSE_BAD)
+        {
+                //Prints an error message if the input was
+                //in the wrong format
+                stats_count (STAT_BAD, 1);
+                log_client_printf (client, STDERR_FILENO,
+                  "ERROR!!! Bad Input\n");
+        }
+        else
+                alarm->client = client;
+        return kind;
+}
+
+/*
+ * Decides, with the alarm's shard locked, whether a request may go
+ * on the list: anything but a new alarm may, and a new alarm only
+ * while there are fewer than max_alarms. "changing" says an earlier
+ * request in the same batch has already let in an alarm with this
+ * number. A refused request is reported to its client.
+ */
+static int engine_admit (alarm_t *alarm, int changing)
+{
+        if (alarm->alarmRequestType != 1 || changing
+          || alarm_find(alarm->messageNum) != NULL)
+                return 1;
+        //Counted as soon as it is let in, so that requests on the other
+        //shards cannot be let into the same room meanwhile
+        if (atomic_fetch_add(&engine_alarms, 1) < max_alarms
+          || max_alarms == 0)
+                return 1;
+        atomic_fetch_sub(&engine_alarms, 1);
+        stats_count(STAT_REFUSED, 1);
+        log_client_printf(alarm->client, STDERR_FILENO,
+          "ERROR!!! Too Many Alarms\n");
+        return 0;
+}
+
+/*
+ * Counts a request that alarm_insert has dealt with, and passes it on
+ * to the alarm thread if it went on the list.
+ */
+static void engine_applied (alarm_t *alarm, int result)
+{
+        switch (result)
+        {
+        case ALARM_ADDED:
+                stats_count(STAT_ADDS, 1);
+                break;
+        case ALARM_CHANGED:
+                stats_count(STAT_CHANGES, 1);
+                break;
+        case ALARM_CANCELLED:
+                stats_count(STAT_CANCELS, 1);
+                break;
+        }
+
+        //Wakes the alarm thread if the request went on the
+        //list; a change is applied in place by alarm_insert
+        if ((result == ALARM_ADDED || result == ALARM_CANCELLED)
+          && clock_is_virtual())
+                engine_handle(alarm);
+        else if (result == ALARM_ADDED || result == ALARM_CANCELLED)
+                queue_push(&alarm_queue, &alarm->queueNode);
+        //Otherwise no other thread has seen the request
+        else
+                engine_free(alarm);
+}
+
+/*
+ * Puts a parsed request on the alarm list and hands it to the alarm
+ * thread. The engine owns the alarm from here on. Returns 0, or -1 if
+ * it was a cancel for an alarm that is not there.
+ */
+int engine_submit (alarm_t *alarm)
+{
+        uint64_t acquired, lsn = 0;
+        int result;
+
+        engine_reset(alarm);
+
+        //aquire
+        acquired = list_lock(alarm->messageNum);
+
+        if (!engine_admit(alarm, 0))
+        {
+                list_unlock(alarm->messageNum, acquired);
+                engine_applied(alarm, ALARM_REFUSED);
+                return -1;
+        }
+
+        //An add or change is logged in the order it is applied; a cancel
+        //only once the alarm thread carries it out
+        if (alarm->alarmRequestType == 1 && engine_logged(alarm, NULL))
+                lsn = wal_append(1, alarm->messageNum, alarm->seconds,
+                  alarm->message);
+
+        /*
+         * Insert the new alarm into the alarm list,
+         * sorted by alarm number.
+         */
+
+         //release
+        result = alarm_insert (alarm);
+        //A changed alarm is shown at once, with its new period from then
+        if (result == ALARM_CHANGED)
+                sched_wake(&alarm_sched, alarm_find(alarm->messageNum));
+        list_unlock(alarm->messageNum, acquired);
+        wal_wait(lsn);
+
+        engine_applied(alarm, result);
+        return result < 0 ? -1 : 0;
+}
+
+// A request in a batch, with where it came in the batch
+typedef struct engine_op_tag {
+        alarm_t           *alarm;
+        int               shard;
+        int               position;
+} engine_op_t;
+
+// Orders a batch by shard, then message number, then arrival
+static int engine_op_compare (const void *a, const void *b)
+{
+        const engine_op_t *x = (const engine_op_t*)a;
+        const engine_op_t *y = (const engine_op_t*)b;
+
+        if (x->shard != y->shard)
+                return x->shard < y->shard ? -1 : 1;
+        if (x->alarm->messageNum != y->alarm->messageNum)
+                return x->alarm->messageNum < y->alarm->messageNum ? -1 : 1;
+        return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/*
+ * Submits "count" parsed requests at once. They are sorted by shard
+ * and message number, and each shard's share is merged into its list
+ * in one walk under one hold of its lock, instead of one lock and one
+ * walk per request. Requests for the same message number take effect
+ * in batch order, as if submitted one by one. The ALARM_ result of
+ * each request is stored in "results", if it is not NULL. The engine
+ * owns the alarms from here on. Returns the number of requests that
+ * failed.
+ */
+int engine_submit_batch (alarm_t **batch, int count, int *results)
+{
+        engine_op_t *ops;
+        alarm_t **sorted, **admitted;
+        int *merged, *applied, *slot, *result, i, j, n, first, failed = 0;
+        int added, added_num = 0;
+        alarm_t *previous = NULL;
+        uint64_t acquired, lsn = 0;
+
+        if (count <= 0)
+                return 0;
+        ops = (engine_op_t*)malloc(count * sizeof(engine_op_t));
+        sorted = (alarm_t**)malloc(count * sizeof(alarm_t*));
+        admitted = (alarm_t**)malloc(count * sizeof(alarm_t*));
+        merged = (int*)malloc(count * sizeof(int));
+        slot = (int*)malloc(count * sizeof(int));
+        result = (int*)malloc(count * sizeof(int));
+        applied = results != NULL ? results
+          : (int*)malloc(count * sizeof(int));
+        if (ops == NULL || sorted == NULL || admitted == NULL || merged == NULL
+          || slot == NULL || result == NULL || applied == NULL)
+                errno_abort ("Allocate batch");
+        for (i = 0; i < count; i++)
+        {
+                engine_reset(batch[i]);
+                ops[i].alarm = batch[i];
+                ops[i].shard = alarm_shard_of(batch[i]->messageNum);
+                ops[i].position = i;
+        }
+        qsort(ops, count, sizeof(engine_op_t), engine_op_compare);
+        for (i = 0; i < count; i++)
+                sorted[i] = ops[i].alarm;
+
+        for (first = 0; first < count; first = i)
+        {
+                for (i = first; i < count && ops[i].shard == ops[first].shard;
+                  i++)
+                        ;
+                acquired = list_lock(sorted[first]->messageNum);
+                //Leaves out the new alarms there is no room for
+                added = 0;
+                for (j = first, n = 0; j < i; j++)
+                {
+                        if (!engine_admit(sorted[j], added
+                          && added_num == sorted[j]->messageNum))
+                        {
+                                merged[j] = ALARM_REFUSED;
+                                continue;
+                        }
+                        if (sorted[j]->alarmRequestType == 1)
+                        {
+                                if (engine_logged(sorted[j], added
+                                  ? previous : NULL))
+                                        lsn = wal_append(1,
+                                          sorted[j]->messageNum,
+                                          sorted[j]->seconds,
+                                          sorted[j]->message);
+                                added = 1;
+                                added_num = sorted[j]->messageNum;
+                                previous = sorted[j];
+                        }
+                        admitted[n] = sorted[j];
+                        slot[n++] = j;
+                }
+                alarm_merge(admitted, n, result);
+                for (j = 0; j < n; j++)
+                        merged[slot[j]] = result[j];
+                for (j = first; j < i; j++)
+                        if (merged[j] == ALARM_CHANGED)
+                                sched_wake(&alarm_sched,
+                                  alarm_find(sorted[j]->messageNum));
+                list_unlock(sorted[first]->messageNum, acquired);
+        }
+
+        wal_wait(lsn);
+
+        //Hands the requests on in the order they came, so the alarm
+        //thread sees them as it would have one by one
+        for (i = 0; i < count; i++)
+                applied[ops[i].position] = merged[i];
+        for (i = 0; i < count; i++)
+        {
+                failed += applied[i] < 0;
+                engine_applied(batch[i], applied[i]);
+        }
+        if (applied != results)
+                free(applied);
+        free(ops);
+        free(sorted);
+        free(admitted);
+        free(merged);
+        free(slot);
+        free(result);
+        return failed;
+}
+
+/*
+ * Hands a parsed request to the engine through the intake ring, or
+ * straight to engine_submit if there is none. The engine owns the
+ * alarm from here on. Returns 0, or -1 if it was turned away; a
+ * request that fails once it is applied from the ring is reported
+ * to its client, but not here. With WAL_SYNC_FULL it returns only
+ * once the request has been applied and its record synced, as
+ * engine_submit does, so nothing is acknowledged before then.
+ */
+int engine_enqueue (alarm_t *alarm)
+{
+        int status;
+
+        if (!intake_running())
+                return engine_submit(alarm);
+        status = intake_submit(alarm);
+        if (status == 0 && engine_sync_full)
+                intake_drain();
+        return status;
+}
+
+/*
+ * engine_enqueue for "count" requests, in order. Returns the number
+ * that were turned away or failed.
+ */
+int engine_enqueue_batch (alarm_t **batch, int count)
+{
+        int failed = 0, i;
+
+        if (!intake_running())
+                return engine_submit_batch(batch, count, NULL);
+        for (i = 0; i < count; i++)
+                failed += intake_submit(batch[i]) != 0;
+        if (engine_sync_full)
+                intake_drain();
+        return failed;
+}
+
+// Waits until every request enqueued so far has been applied
+void engine_drain (void)
+{
+        intake_drain();
+}
+
+// Cancels a range command submits at a time
+#define RANGE_BATCH             4096
+
+// Where a range command is, between calls from alarm_list_range
+typedef struct engine_range_tag {
+        int               kind;                         /* PARSE_ */
+        int               client;
+        int               cancelled;                    /* last number with one */
+        int               pending;                      /* "cancelled" is set */
+        long              alarms;                       /* listed or cancelled */
+        long              failed;
+        int               count;
+        alarm_t           *batch[RANGE_BATCH];
+} engine_range_t;
+
+static void range_flush (engine_range_t *walk)
+{
+        walk->failed += engine_submit_batch(walk->batch, walk->count, NULL);
+        walk->count = 0;
+}
+
+/*
+ * Visits each alarm and cancel request in a range, in message number
+ * order. A cancel request comes just before its alarm, so an alarm
+ * whose cancel is still on its way is known when it is reached and
+ * is left out.
+ */
+static void range_visit (alarm_t *alarm, void *arg)
+{
+        engine_range_t *walk = (engine_range_t*)arg;
+        alarm_snapshot_t snapshot;
+        alarm_t *cancel;
+
+        if (alarm->alarmRequestType == 0)
+        {
+                walk->cancelled = alarm->messageNum;
+                walk->pending = 1;
+                return;
+        }
+        if (alarm->alarmExistsFlag == 0 || (walk->pending
+          && walk->cancelled == alarm->messageNum))
+                return;
+        walk->alarms++;
+        if (walk->kind == PARSE_LIST)
+        {
+                alarm_read(alarm, &snapshot);
+                log_client_printf(walk->client, STDOUT_FILENO,
+                  "LIST: %g Message(%d) %s\n", snapshot.seconds,
+                  alarm->messageNum, snapshot.message);
+                return;
+        }
+
+        //The cancels go in batches as the walk goes, so they are not
+        //all held until it ends
+        cancel = alarm_alloc();
+        cancel->messageNum = alarm->messageNum;
+        cancel->alarmRequestType = PARSE_CANCEL;
+        cancel->seconds = 0;
+        cancel->limit = 0;
+        cancel->expires = 0;
+        cancel->message = intern_empty;
+        cancel->client = walk->client;
+        walk->batch[walk->count++] = cancel;
+        if (walk->count == RANGE_BATCH)
+                range_flush(walk);
+}
+
+/*
+ * Runs a List or range Cancel command for "client" over the message
+ * numbers in "range". The store is walked without locking it, so
+ * requests keep going on the list meanwhile; one that lands in the
+ * range during the walk may or may not be seen. Returns 0, or -1 if
+ * some cancel found its alarm already gone.
+ */
+int engine_range (int kind, parse_range_t *range, int client)
+{
+        engine_range_t *walk;
+        int status;
+
+        //Sees every request that came before it
+        intake_drain();
+        walk = (engine_range_t*)malloc(sizeof(engine_range_t));
+        if (walk == NULL)
+                errno_abort ("Allocate range walk");
+        walk->kind = kind;
+        walk->client = client;
+        walk->pending = 0;
+        walk->alarms = walk->failed = 0;
+        walk->count = 0;
+        alarm_list_range(range->first, range->last, range_visit, walk);
+        range_flush(walk);
+
+        if (kind == PARSE_LIST)
+                log_client_printf(client, STDOUT_FILENO,
+                  "LIST: %ld alarms\n", walk->alarms);
+        else
+                log_client_printf(client, STDOUT_FILENO,
+                  "CANCEL: %ld alarms from Message(%d) to Message(%d)\n",
+                  walk->alarms - walk->failed, range->first, range->last);
+        status = walk->failed > 0 ? -1 : 0;
+        free(walk);
+        return status;
+}
+
+/*
+ * Handles one line typed at the Alarm> prompt or sent by a client,
+ * with the output about it going to "client" (LOG_CONSOLE for the
+ * prompt). Returns 0, or -1 after reporting an error.
+ */
+int engine_command (const char *line, int client)
+{
+        parse_range_t range;
+        alarm_t *alarm;
+        int kind;
+
+        alarm = alarm_alloc ();
+        kind = engine_parse (line, line + strlen (line), alarm, &range,
+          client);
+        if (kind != PARSE_ALARM && kind != PARSE_CANCEL)
+        {
+                alarm_free (alarm);
+                if (kind == PARSE_LIST || kind == PARSE_CANCEL_RANGE)
+                        return engine_range (kind, &range, client);
+                return kind == PARSE_STATS ? 0 : -1;
+        }
+        return engine_enqueue (alarm);
+}
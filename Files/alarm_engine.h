@@ -0,0 +1,63 @@
+#ifndef __alarm_engine_h
+#define __alarm_engine_h
+
+#include "alarm.h"
+#include "alarm_log.h"
+#include "alarm_parse.h"
+#include "alarm_wal.h"
+#include "alarm_intake.h"
+
+/*
+ * Called by a dispatcher each time an alarm is displayed, with how
+ * many seconds after its deadline that happened.
+ */
+typedef void (*engine_fire_hook_t) (alarm_t *alarm, double lateness);
+
+/*
+ * Called, in place of writing a line, for each thing that happens to
+ * an alarm whose client takes events rather than text (a negative
+ * client number), with the message as it was shown.
+ */
+typedef void (*engine_event_hook_t) (alarm_t *alarm, int event,
+  const char *message);
+
+#define ENGINE_EVENT_CREATED    0
+#define ENGINE_EVENT_DISPLAY    1
+#define ENGINE_EVENT_CHANGED    2
+#define ENGINE_EVENT_CANCELLED  3
+#define ENGINE_EVENT_GONE       4
+
+typedef struct engine_config_tag {
+        int                 dispatchers;
+        int                 pin_dispatchers;            /* a CPU each */
+        log_config_t        log;
+        engine_fire_hook_t  fire_hook;                  /* NULL normally */
+        engine_event_hook_t event_hook;                 /* NULL normally */
+        const char          *stats_path;                /* periodic dump, or NULL */
+        int                 stats_interval;             /* seconds between dumps */
+        wal_config_t        wal;                        /* persistence */
+        int                 virtual_clock;              /* see alarm_sim.h */
+        const char          *trace_path;                /* commands, or NULL */
+        const char          *firing_path;               /* displays, or NULL */
+        intake_config_t     intake;                     /* command ring */
+        long                max_alarms;                 /* 0 for no limit */
+} engine_config_t;
+
+#define ENGINE_STATS_INTERVAL   10
+
+void engine_config_default (engine_config_t *config);
+void engine_start (engine_config_t *config);
+int engine_parse (const char *line, const char *end, alarm_t *alarm,
+  parse_range_t *range, int client);
+int engine_submit (alarm_t *alarm);
+int engine_submit_batch (alarm_t **batch, int count, int *results);
+int engine_enqueue (alarm_t *alarm);
+int engine_enqueue_batch (alarm_t **batch, int count);
+void engine_drain (void);
+int engine_range (int kind, parse_range_t *range, int client);
+int engine_command (const char *line, int client);
+double engine_now (void);
+double engine_elapsed (void);
+void engine_advance (double seconds);
+
+#endif
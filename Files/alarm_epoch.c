@@ -0,0 +1,183 @@
+/*
+ * alarm_epoch.c
+ *
+ * Epoch-based reclamation. Each thread that touches the list gets a
+ * record on a global registry the first time it does; records are
+ * never removed, since the threads of this program live as long as
+ * the process.
+ */
+#include <stdatomic.h>
+#include <sched.h>
+#include "errors.h"
+#include "alarm_epoch.h"
+
+// Nodes a thread retired during one epoch, freed two epochs later
+typedef struct limbo_tag {
+        unsigned          epoch;
+        size_t            count;
+        size_t            size;
+        void              **nodes;
+        epoch_free_t      *release;
+} limbo_t;
+
+typedef struct epoch_record_tag {
+        /* Epoch the thread entered in, shifted left one, with the low
+         * bit set while the thread is inside a read-side section */
+        atomic_uint               state;
+        int                       nesting;
+        unsigned                  retired;
+        limbo_t                   limbo[3];
+        struct epoch_record_tag   *next;
+} epoch_record_t;
+
+// Retires between attempts to move the global epoch on
+#define EPOCH_ADVANCE_EVERY     64
+
+static atomic_uint global_epoch = 1;
+static _Atomic(epoch_record_t *) records;
+static _Thread_local epoch_record_t *self;
+
+static epoch_record_t *epoch_self (void)
+{
+        epoch_record_t *record;
+
+        if (self != NULL)
+                return self;
+        record = (epoch_record_t*)calloc(1, sizeof(epoch_record_t));
+        if (record == NULL)
+                errno_abort ("Allocate epoch record");
+        //Pushes the record on the registry for epoch_advance to see
+        record->next = atomic_load(&records);
+        while (!atomic_compare_exchange_weak(&records, &record->next, record))
+                ;
+        self = record;
+        return record;
+}
+
+void epoch_enter (void)
+{
+        epoch_record_t *record = epoch_self();
+
+        if (record->nesting++ > 0)
+                return;
+        atomic_store(&record->state, atomic_load(&global_epoch) << 1 | 1);
+        //Orders the announcement before any load from the list
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit (void)
+{
+        epoch_record_t *record = self;
+
+        if (--record->nesting > 0)
+                return;
+        atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+/*
+ * Moves the global epoch on by one if every thread inside a section
+ * has already seen the current one.
+ */
+static void epoch_advance (void)
+{
+        unsigned epoch = atomic_load(&global_epoch);
+        unsigned state;
+        epoch_record_t *record;
+
+        for (record = atomic_load(&records); record != NULL;
+          record = record->next)
+        {
+                state = atomic_load(&record->state);
+                if ((state & 1) && (state >> 1) != epoch)
+                        return;
+        }
+        atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+}
+
+/*
+ * Releases everything on the list. The list is taken off the record
+ * first, since a release function may itself retire nodes.
+ */
+static void limbo_free (limbo_t *limbo)
+{
+        void **nodes = limbo->nodes;
+        epoch_free_t *release = limbo->release;
+        size_t i, count = limbo->count, size = limbo->size;
+
+        limbo->nodes = NULL;
+        limbo->release = NULL;
+        limbo->count = limbo->size = 0;
+        for (i = 0; i < count; i++)
+                release[i](nodes[i]);
+        //Hands the arrays back unless a release started new ones
+        if (limbo->size == 0)
+        {
+                limbo->nodes = nodes;
+                limbo->release = release;
+                limbo->size = size;
+        }
+        else
+        {
+                free(nodes);
+                free(release);
+        }
+}
+
+void epoch_retire (void *node, epoch_free_t release)
+{
+        epoch_record_t *record = epoch_self();
+        unsigned epoch = atomic_load(&global_epoch);
+        limbo_t *limbo;
+        int i;
+
+        //Frees whatever this thread retired two or more epochs ago
+        for (i = 0; i < 3; i++)
+                if (record->limbo[i].count > 0
+                  && epoch - record->limbo[i].epoch >= 2)
+                        limbo_free(&record->limbo[i]);
+
+        limbo = &record->limbo[epoch % 3];
+        limbo->epoch = epoch;
+        if (limbo->count == limbo->size)
+        {
+                limbo->size = limbo->size ? limbo->size * 2 : 64;
+                limbo->nodes = (void**)realloc(limbo->nodes,
+                  limbo->size * sizeof(void*));
+                limbo->release = (epoch_free_t*)realloc(limbo->release,
+                  limbo->size * sizeof(epoch_free_t));
+                if (limbo->nodes == NULL || limbo->release == NULL)
+                        errno_abort ("Grow epoch limbo list");
+        }
+        limbo->nodes[limbo->count] = node;
+        limbo->release[limbo->count] = release;
+        limbo->count++;
+
+        if (++record->retired % EPOCH_ADVANCE_EVERY == 0)
+                epoch_advance();
+}
+
+/*
+ * Waits until every read-side section that was under way when it was
+ * called has ended. Anything a reader could have picked up before the
+ * call is out of its hands afterwards. Must not be called from inside
+ * a section.
+ */
+void epoch_barrier (void)
+{
+        epoch_record_t *record;
+        unsigned state;
+
+        atomic_thread_fence(memory_order_seq_cst);
+        for (record = atomic_load(&records); record != NULL;
+          record = record->next)
+        {
+                //Any change of state means the section seen here is over;
+                //moving the epoch on makes sure a new one looks different
+                state = atomic_load(&record->state);
+                while ((state & 1) && atomic_load(&record->state) == state)
+                {
+                        epoch_advance();
+                        sched_yield();
+                }
+        }
+}
@@ -0,0 +1,20 @@
+#ifndef __alarm_epoch_h
+#define __alarm_epoch_h
+
+/*
+ * Epoch-based reclamation for nodes taken off the alarm list.
+ *
+ * Readers bracket every lock-free look at the list with epoch_enter
+ * and epoch_exit. A writer that unlinks a node hands it to
+ * epoch_retire instead of freeing it; the node is freed once the
+ * global epoch has moved on twice, which can only happen after every
+ * reader that might still hold a pointer to it has left its section.
+ */
+typedef void (*epoch_free_t) (void *node);
+
+void epoch_enter (void);
+void epoch_exit (void);
+void epoch_retire (void *node, epoch_free_t release);
+void epoch_barrier (void);
+
+#endif
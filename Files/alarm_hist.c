@@ -0,0 +1,107 @@
+/*
+ * alarm_hist.c
+ *
+ * Log-linear histogram for latencies and other non-negative values.
+ */
+#include "alarm_hist.h"
+
+static int hist_bucket (uint64_t value)
+{
+        int exponent;
+
+        if (value < HIST_SUB)
+                return (int)value;
+        exponent = 63 - __builtin_clzll(value);
+        return (exponent - HIST_SUB_BITS + 1) * HIST_SUB
+          + (int)((value >> (exponent - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// Smallest value that falls in the bucket
+static uint64_t hist_value (int bucket)
+{
+        int exponent;
+
+        if (bucket < HIST_SUB)
+                return bucket;
+        exponent = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+        return (uint64_t)(HIST_SUB + bucket % HIST_SUB)
+          << (exponent - HIST_SUB_BITS);
+}
+
+void hist_reset (alarm_hist_t *hist)
+{
+        int i;
+
+        for (i = 0; i < HIST_BUCKETS; i++)
+                atomic_store(&hist->counts[i], 0);
+        atomic_store(&hist->total, 0);
+        atomic_store(&hist->sum, 0);
+        atomic_store(&hist->max, 0);
+}
+
+void hist_record (alarm_hist_t *hist, uint64_t value)
+{
+        unsigned long long max;
+
+        atomic_fetch_add_explicit(&hist->counts[hist_bucket(value)], 1,
+          memory_order_relaxed);
+        atomic_fetch_add_explicit(&hist->total, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+        max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+        while (value > max && !atomic_compare_exchange_weak(&hist->max, &max,
+          value))
+                ;
+}
+
+// Adds every value recorded in "from" to "into"
+void hist_merge (alarm_hist_t *into, alarm_hist_t *from)
+{
+        unsigned long long max, from_max;
+        unsigned long count;
+        int i;
+
+        for (i = 0; i < HIST_BUCKETS; i++)
+                if ((count = atomic_load_explicit(&from->counts[i],
+                  memory_order_relaxed)) != 0)
+                        atomic_fetch_add_explicit(&into->counts[i], count,
+                          memory_order_relaxed);
+        atomic_fetch_add(&into->total, atomic_load(&from->total));
+        atomic_fetch_add(&into->sum, atomic_load(&from->sum));
+        from_max = atomic_load(&from->max);
+        max = atomic_load(&into->max);
+        while (from_max > max && !atomic_compare_exchange_weak(&into->max,
+          &max, from_max))
+                ;
+}
+
+/*
+ * Returns the value below which "percent" of the recorded values
+ * fall, to bucket precision. The 100th percentile is the exact max.
+ */
+uint64_t hist_percentile (alarm_hist_t *hist, double percent)
+{
+        unsigned long total = atomic_load(&hist->total);
+        unsigned long seen = 0, rank;
+        int i;
+
+        if (total == 0)
+                return 0;
+        if (percent >= 100.0)
+                return atomic_load(&hist->max);
+        rank = (unsigned long)(total * percent / 100.0);
+        for (i = 0; i < HIST_BUCKETS; i++)
+        {
+                seen += atomic_load_explicit(&hist->counts[i],
+                  memory_order_relaxed);
+                if (seen > rank)
+                        return hist_value(i);
+        }
+        return atomic_load(&hist->max);
+}
+
+double hist_mean (alarm_hist_t *hist)
+{
+        unsigned long total = atomic_load(&hist->total);
+
+        return total ? (double)atomic_load(&hist->sum) / total : 0.0;
+}
@@ -0,0 +1,30 @@
+#ifndef __alarm_hist_h
+#define __alarm_hist_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Log-linear latency histogram: values below 16 get a bucket each,
+ * and every power of two above that is split into 16 buckets, so any
+ * recorded value is known to within 1/16th. Recording is one relaxed
+ * atomic add, safe from any number of threads.
+ */
+#define HIST_SUB_BITS           4
+#define HIST_SUB                (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS            (64 * HIST_SUB)
+
+typedef struct alarm_hist_tag {
+        atomic_ulong      counts[HIST_BUCKETS];
+        atomic_ulong      total;
+        atomic_ullong     sum;
+        atomic_ullong     max;
+} alarm_hist_t;
+
+void hist_reset (alarm_hist_t *hist);
+void hist_record (alarm_hist_t *hist, uint64_t value);
+void hist_merge (alarm_hist_t *into, alarm_hist_t *from);
+uint64_t hist_percentile (alarm_hist_t *hist, double percent);
+double hist_mean (alarm_hist_t *hist);
+
+#endif
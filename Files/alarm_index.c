@@ -0,0 +1,148 @@
+/*
+ * alarm_index.c
+ *
+ * Message number -> alarm hash index used by the alarm list.
+ */
+#include <stdint.h>
+#include "errors.h"
+#include "alarm_index.h"
+
+/*
+ * Fibonacci hashing: message numbers are usually small and
+ * consecutive, so spread them over the table with a multiply
+ * and keep the high bits.
+ */
+static size_t index_home (alarm_index_t *index, int messageNum)
+{
+        uint64_t hash = (uint64_t)(uint32_t)messageNum * 0x9E3779B97F4A7C15ull;
+        return (size_t)(hash >> (64 - index->bits));
+}
+
+void index_init (alarm_index_t *index, size_t capacity)
+{
+        int bits = 3;
+
+        //Rounds the capacity up to a power of two, 8 at the least
+        while (((size_t)1 << bits) < capacity)
+                bits++;
+        index->bits = bits;
+        index->capacity = (size_t)1 << bits;
+        index->count = 0;
+        index->slots = calloc (index->capacity, sizeof (index_entry_t));
+        if (index->slots == NULL)
+                errno_abort ("Allocate alarm index");
+}
+
+void index_destroy (alarm_index_t *index)
+{
+        free (index->slots);
+        index->slots = NULL;
+        index->capacity = index->count = 0;
+}
+
+/*
+ * Double the table and re-place every entry. Any entry pointer
+ * handed out before this call is invalid afterwards.
+ */
+static void index_grow (alarm_index_t *index)
+{
+        index_entry_t *old = index->slots;
+        size_t old_capacity = index->capacity;
+        size_t i, slot;
+
+        index->bits++;
+        index->capacity = old_capacity * 2;
+        index->slots = calloc (index->capacity, sizeof (index_entry_t));
+        if (index->slots == NULL)
+                errno_abort ("Grow alarm index");
+
+        for (i = 0; i < old_capacity; i++)
+        {
+                if (!old[i].used)
+                        continue;
+                slot = index_home (index, old[i].messageNum);
+                while (index->slots[slot].used)
+                        slot = (slot + 1) & (index->capacity - 1);
+                index->slots[slot] = old[i];
+        }
+        free (old);
+}
+
+/*
+ * Returns the entry for the message number, or NULL if neither an
+ * alarm nor a cancel request with that number is on the list.
+ */
+index_entry_t *index_find (alarm_index_t *index, int messageNum)
+{
+        size_t slot = index_home (index, messageNum);
+
+        index->probes = 1;
+        while (index->slots[slot].used)
+        {
+                if (index->slots[slot].messageNum == messageNum)
+                        return &index->slots[slot];
+                slot = (slot + 1) & (index->capacity - 1);
+                index->probes++;
+        }
+        return NULL;
+}
+
+/*
+ * Returns the entry for the message number, creating an empty one
+ * if there is none yet.
+ */
+index_entry_t *index_get (alarm_index_t *index, int messageNum)
+{
+        index_entry_t *entry;
+        size_t slot;
+
+        entry = index_find (index, messageNum);
+        if (entry != NULL)
+                return entry;
+
+        //Keeps the load factor under 3/4 so probe runs stay short
+        if ((index->count + 1) * 4 > index->capacity * 3)
+                index_grow (index);
+
+        slot = index_home (index, messageNum);
+        while (index->slots[slot].used)
+                slot = (slot + 1) & (index->capacity - 1);
+        entry = &index->slots[slot];
+        entry->used = 1;
+        entry->messageNum = messageNum;
+        entry->alarm = NULL;
+        entry->cancel = NULL;
+        index->count++;
+        return entry;
+}
+
+/*
+ * Drops the entry once it no longer refers to either an alarm or a
+ * cancel request. The entries after it in the probe run are shifted
+ * back into the hole so that lookups never stop early.
+ */
+void index_release (alarm_index_t *index, index_entry_t *entry)
+{
+        size_t mask = index->capacity - 1;
+        size_t hole, next, home;
+
+        if (entry->alarm != NULL || entry->cancel != NULL)
+                return;
+
+        hole = (size_t)(entry - index->slots);
+        next = (hole + 1) & mask;
+        while (index->slots[next].used)
+        {
+                home = index_home (index, index->slots[next].messageNum);
+                //Moves the entry only if its home slot is not between the
+                //hole and where it sits now (cyclically)
+                if (((next - home) & mask) >= ((next - hole) & mask))
+                {
+                        index->slots[hole] = index->slots[next];
+                        hole = next;
+                }
+                next = (next + 1) & mask;
+        }
+        index->slots[hole].used = 0;
+        index->count--;
+}
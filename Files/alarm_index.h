@@ -0,0 +1,37 @@
+#ifndef __alarm_index_h
+#define __alarm_index_h
+
+#include <stddef.h>
+#include "alarm.h"
+
+/*
+ * Hash index over the alarm list, keyed by message number. Each
+ * entry holds the type A alarm for its message number and the
+ * pending type B (cancel) request, if there is one, so that the
+ * checks alarm_insert makes no longer walk the list from head to
+ * tail. Open addressing with linear probing; entries are removed
+ * by shifting the rest of the probe run back, so there are no
+ * tombstones to clean up.
+ */
+typedef struct index_entry_tag {
+        int               used;
+        int               messageNum;
+        alarm_t           *alarm;                       /* type A */
+        alarm_t           *cancel;                      /* type B */
+} index_entry_t;
+
+typedef struct alarm_index_tag {
+        index_entry_t     *slots;
+        size_t            capacity;                     /* power of two */
+        size_t            count;
+        int               bits;
+        size_t            probes;                       /* by the last find */
+} alarm_index_t;
+
+void index_init (alarm_index_t *index, size_t capacity);
+void index_destroy (alarm_index_t *index);
+index_entry_t *index_find (alarm_index_t *index, int messageNum);
+index_entry_t *index_get (alarm_index_t *index, int messageNum);
+void index_release (alarm_index_t *index, index_entry_t *entry);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * alarm_ingest.c
+ *
+ * Reads command files and pipes in bulk and feeds them to the engine.
+ */
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_pool.h"
+#include "alarm_log.h"
+#include "alarm_parse.h"
+#include "alarm_engine.h"
+#include "alarm_ingest.h"
+
+typedef struct ingest_tag {
+        int               client;
+        int               count;                        /* parsed, waiting */
+        alarm_t           *batch[INGEST_BATCH];
+        ingest_stats_t    *stats;
+} ingest_t;
+
+static double ingest_clock (void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void ingest_flush (ingest_t *ingest)
+{
+        engine_enqueue_batch(ingest->batch, ingest->count);
+        ingest->count = 0;
+}
+
+/*
+ * Parses every complete line in the buffer, submitting a batch each
+ * time one fills up. Returns the number of bytes used; a partial
+ * last line is left for the caller unless "last" is set.
+ */
+static size_t ingest_buffer (ingest_t *ingest, const char *data,
+  size_t length, int last)
+{
+        const char *p = data, *end = data + length, *newline;
+        double start = ingest_clock();
+        parse_range_t range;
+        alarm_t *alarm = NULL;
+        int kind;
+
+        while (p < end)
+        {
+                newline = memchr(p, '\n', end - p);
+                if (newline == NULL && !last)
+                        break;
+                if (newline == NULL)
+                        newline = end;
+                //Blank lines are skipped, as at the prompt
+                if (newline > p && !(newline - p == 1 && *p == '\r'))
+                {
+                        if (alarm == NULL)
+                                alarm = alarm_alloc();
+                        ingest->stats->lines++;
+                        kind = engine_parse(p, newline, alarm, &range,
+                          ingest->client);
+                        if (kind == PARSE_BAD)
+                                ingest->stats->bad++;
+                        //A range command sees the lines before it applied
+                        else if (kind == PARSE_LIST
+                          || kind == PARSE_CANCEL_RANGE)
+                        {
+                                ingest->stats->parse_seconds +=
+                                  ingest_clock() - start;
+                                ingest_flush(ingest);
+                                engine_range(kind, &range, ingest->client);
+                                start = ingest_clock();
+                        }
+                        else if (kind != PARSE_STATS)
+                        {
+                                ingest->batch[ingest->count++] = alarm;
+                                alarm = NULL;
+                        }
+                }
+                p = newline < end ? newline + 1 : end;
+                if (ingest->count == INGEST_BATCH)
+                {
+                        ingest->stats->parse_seconds += ingest_clock() - start;
+                        ingest_flush(ingest);
+                        start = ingest_clock();
+                }
+        }
+        if (alarm != NULL)
+                alarm_free(alarm);
+        ingest->stats->parse_seconds += ingest_clock() - start;
+        return p - data;
+}
+
+// Reads a pipe or terminal a chunk at a time
+static int ingest_stream (ingest_t *ingest, int fd)
+{
+        char *buffer;
+        size_t used = 0, consumed;
+        ssize_t count;
+
+        buffer = (char*)malloc(INGEST_CHUNK);
+        if (buffer == NULL)
+                errno_abort ("Allocate ingest buffer");
+        while (1)
+        {
+                count = read(fd, buffer + used, INGEST_CHUNK - used);
+                if (count < 0 && errno == EINTR)
+                        continue;
+                if (count <= 0)
+                        break;
+                used += count;
+                consumed = ingest_buffer(ingest, buffer, used, 0);
+                //A line longer than the whole chunk is taken as it is
+                if (consumed == 0 && used == INGEST_CHUNK)
+                        consumed = ingest_buffer(ingest, buffer, used, 1);
+                used -= consumed;
+                memmove(buffer, buffer + consumed, used);
+        }
+        ingest_buffer(ingest, buffer, used, 1);
+        free(buffer);
+        return count < 0 ? -1 : 0;
+}
+
+/*
+ * Runs every command in the file at "path" ("-" for standard input),
+ * with the output going to "client". Adds to "stats" and returns 0,
+ * or -1 if the file could not be read.
+ */
+int ingest_path (const char *path, int client, ingest_stats_t *stats)
+{
+        static ingest_t ingest;
+        struct stat info;
+        double start = ingest_clock();
+        void *data;
+        int fd, status = 0;
+
+        fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &info) != 0)
+        {
+                if (fd != STDIN_FILENO)
+                        close(fd);
+                return -1;
+        }
+        ingest.client = client;
+        ingest.count = 0;
+        ingest.stats = stats;
+
+        if (S_ISREG(info.st_mode) && info.st_size > 0
+          && (data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+          != MAP_FAILED)
+        {
+                madvise(data, info.st_size, MADV_SEQUENTIAL);
+                ingest_buffer(&ingest, (const char*)data, info.st_size, 1);
+                munmap(data, info.st_size);
+        }
+        else
+                status = ingest_stream(&ingest, fd);
+        ingest_flush(&ingest);
+        //The time in all counts the requests still in the intake ring
+        engine_drain();
+
+        if (fd != STDIN_FILENO)
+                close(fd);
+        stats->total_seconds += ingest_clock() - start;
+        return status;
+}
+
+void ingest_report (int fd, ingest_stats_t *stats)
+{
+        log_printf(fd, "INGEST: %lu lines, %lu bad, parsed in %.3f s "
+          "(%.0f lines/s), %.3f s in all (%.0f lines/s)\n", stats->lines,
+          stats->bad, stats->parse_seconds, stats->parse_seconds > 0
+          ? stats->lines / stats->parse_seconds : 0.0, stats->total_seconds,
+          stats->total_seconds > 0 ? stats->lines / stats->total_seconds : 0.0);
+}
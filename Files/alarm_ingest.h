@@ -0,0 +1,26 @@
+#ifndef __alarm_ingest_h
+#define __alarm_ingest_h
+
+#include <stddef.h>
+
+/*
+ * Bulk command ingestion. A regular file is mapped and parsed in
+ * place; a pipe or terminal is read INGEST_CHUNK bytes at a time.
+ * Lines are parsed INGEST_BATCH at a time and each batch is then
+ * handed to the engine, so parsing and applying run in long
+ * stretches of their own instead of alternating line by line.
+ */
+#define INGEST_CHUNK            (1 << 20)
+#define INGEST_BATCH            65536
+
+typedef struct ingest_stats_tag {
+        unsigned long     lines;
+        unsigned long     bad;
+        double            parse_seconds;                /* parsing only */
+        double            total_seconds;                /* with applying */
+} ingest_stats_t;
+
+int ingest_path (const char *path, int client, ingest_stats_t *stats);
+void ingest_report (int fd, ingest_stats_t *stats);
+
+#endif
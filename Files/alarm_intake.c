@@ -0,0 +1,292 @@
+/*
+ * alarm_intake.c
+ *
+ * The bounded request ring in front of the engine. It is the usual
+ * array of cells each with a sequence number: a producer claims a
+ * cell by moving "tail" on with a compare and swap once the cell's
+ * sequence says it is free, fills it, and publishes it by moving the
+ * sequence on; the one consumer takes cells at "head" in order and
+ * hands each back for the next lap.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include "errors.h"
+#include "alarm_log.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+#include "alarm_intake.h"
+
+typedef struct intake_cell_tag {
+        atomic_size_t     sequence;
+        alarm_t           *alarm;
+} intake_cell_t;
+
+static intake_config_t intake_config;
+static intake_apply_t intake_apply;
+static int intake_on;
+static intake_cell_t *intake_cells;
+static size_t intake_mask;
+static _Alignas(64) atomic_size_t intake_tail;          /* producers claim */
+static _Alignas(64) atomic_size_t intake_head;          /* consumer takes */
+static atomic_size_t intake_applied;                    /* all before done */
+static atomic_size_t intake_high_water;
+static atomic_ulong intake_rejected, intake_shed, intake_blocked;
+
+// The ring's thread sleeps on this while the ring is empty
+static pthread_mutex_t intake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t intake_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int intake_sleeping;
+// Producers waiting for room, and intake_drain, sleep on this
+static pthread_mutex_t intake_room_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t intake_room = PTHREAD_COND_INITIALIZER;
+static atomic_int intake_waiting;
+
+/*
+ * Puts the request in the ring, or returns -1 if the ring is full.
+ */
+static int intake_push (alarm_t *alarm)
+{
+        intake_cell_t *cell;
+        size_t tail, sequence;
+
+        tail = atomic_load_explicit(&intake_tail, memory_order_relaxed);
+        while (1)
+        {
+                cell = &intake_cells[tail & intake_mask];
+                sequence = atomic_load_explicit(&cell->sequence,
+                  memory_order_acquire);
+                //The cell still holds a request from the lap before
+                if (sequence < tail)
+                        return -1;
+                if (sequence == tail && atomic_compare_exchange_weak_explicit(
+                  &intake_tail, &tail, tail + 1, memory_order_relaxed,
+                  memory_order_relaxed))
+                        break;
+                //Another producer took the cell: try the next one
+                if (sequence > tail)
+                        tail = atomic_load_explicit(&intake_tail,
+                          memory_order_relaxed);
+        }
+        cell->alarm = alarm;
+        atomic_store_explicit(&cell->sequence, tail + 1, memory_order_release);
+
+        //Pairs with the fence in intake_thread: either it sees the
+        //request or this thread sees that it went to sleep
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&intake_sleeping, memory_order_relaxed))
+        {
+                pthread_mutex_lock(&intake_mutex);
+                pthread_cond_signal(&intake_cond);
+                pthread_mutex_unlock(&intake_mutex);
+        }
+        return 0;
+}
+
+/*
+ * Takes up to "room" published requests off the front of the ring.
+ * Only the ring's thread calls this.
+ */
+static int intake_pop (alarm_t **batch, int room)
+{
+        intake_cell_t *cell;
+        size_t head = atomic_load_explicit(&intake_head, memory_order_relaxed);
+        int count = 0;
+
+        while (count < room)
+        {
+                cell = &intake_cells[head & intake_mask];
+                if (atomic_load_explicit(&cell->sequence, memory_order_acquire)
+                  != head + 1)
+                        break;
+                batch[count++] = cell->alarm;
+                //Hands the cell back for the producers' next lap
+                atomic_store_explicit(&cell->sequence, head + intake_mask + 1,
+                  memory_order_release);
+                head++;
+        }
+        atomic_store_explicit(&intake_head, head, memory_order_release);
+        return count;
+}
+
+static size_t intake_depth (void)
+{
+        size_t head = atomic_load(&intake_head);
+        size_t tail = atomic_load(&intake_tail);
+
+        return tail > head ? tail - head : 0;
+}
+
+// Wakes the producers waiting for room and the threads draining
+static void intake_wake_waiters (void)
+{
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&intake_waiting, memory_order_relaxed))
+        {
+                pthread_mutex_lock(&intake_room_mutex);
+                pthread_cond_broadcast(&intake_room);
+                pthread_mutex_unlock(&intake_room_mutex);
+        }
+}
+
+/*
+ * The ring's thread. It takes out whatever has built up, up to
+ * INTAKE_BATCH requests, applies them, and sleeps when there is
+ * nothing left.
+ */
+static void *intake_thread (void *arg)
+{
+        alarm_t **batch;
+        size_t depth;
+        int count;
+
+        batch = (alarm_t**)malloc(INTAKE_BATCH * sizeof(alarm_t*));
+        if (batch == NULL)
+                errno_abort ("Allocate intake batch");
+        while (1)
+        {
+                depth = intake_depth();
+                if (depth > atomic_load_explicit(&intake_high_water,
+                  memory_order_relaxed))
+                        atomic_store(&intake_high_water, depth);
+                count = intake_pop(batch, INTAKE_BATCH);
+                if (count > 0)
+                {
+                        intake_apply(batch, count);
+                        atomic_store(&intake_applied,
+                          atomic_load(&intake_head));
+                        intake_wake_waiters();
+                        continue;
+                }
+
+                //A producer may have claimed a cell and not filled it yet
+                if (intake_depth() > 0)
+                {
+                        sched_yield();
+                        continue;
+                }
+                pthread_mutex_lock(&intake_mutex);
+                atomic_store(&intake_sleeping, 1);
+                atomic_thread_fence(memory_order_seq_cst);
+                if (intake_depth() == 0)
+                        pthread_cond_wait(&intake_cond, &intake_mutex);
+                atomic_store(&intake_sleeping, 0);
+                pthread_mutex_unlock(&intake_mutex);
+        }
+        return NULL;
+}
+
+/*
+ * Starts the ring's thread, which hands each batch it takes out to
+ * "apply". Does nothing if config->capacity is 0; commands then go
+ * straight to the engine.
+ */
+void intake_start (intake_config_t *config, intake_apply_t apply)
+{
+        pthread_t thread;
+        size_t i;
+        int status;
+
+        intake_config = *config;
+        if (config->capacity == 0)
+                return;
+        intake_apply = apply;
+        intake_mask = config->capacity - 1;
+        intake_cells = (intake_cell_t*)malloc(config->capacity
+          * sizeof(intake_cell_t));
+        if (intake_cells == NULL)
+                errno_abort ("Allocate intake ring");
+        for (i = 0; i < config->capacity; i++)
+                atomic_store(&intake_cells[i].sequence, i);
+        intake_on = 1;
+        status = pthread_create(&thread, NULL, intake_thread, NULL);
+        if (status != 0)
+                err_abort (status, "Create intake thread");
+}
+
+int intake_running (void)
+{
+        return intake_on;
+}
+
+// Turns a request away, telling its client why
+static int intake_refuse (alarm_t *alarm, atomic_ulong *counter)
+{
+        atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+        log_client_printf(alarm->client, STDERR_FILENO, "ERROR!!! Busy\n");
+        intern_release(alarm->message);
+        alarm_free(alarm);
+        return -1;
+}
+
+/*
+ * Puts a parsed request in the ring for the engine. The ring owns it
+ * from here on. Returns 0, or -1 if the overload policy turned it
+ * away, in which case its client has been told.
+ */
+int intake_submit (alarm_t *alarm)
+{
+        int overload = intake_config.overload;
+
+        if (overload == INTAKE_SHED && alarm->alarmRequestType == 1
+          && intake_depth() >= intake_config.capacity
+          - intake_config.capacity / 4)
+                return intake_refuse(alarm, &intake_shed);
+        if (intake_push(alarm) == 0)
+                return 0;
+        if (overload == INTAKE_REJECT
+          || (overload == INTAKE_SHED && alarm->alarmRequestType == 1))
+                return intake_refuse(alarm, &intake_rejected);
+
+        //Waits for the ring's thread to make room
+        atomic_fetch_add_explicit(&intake_blocked, 1, memory_order_relaxed);
+        pthread_mutex_lock(&intake_room_mutex);
+        atomic_fetch_add(&intake_waiting, 1);
+        while (intake_push(alarm) != 0)
+                pthread_cond_wait(&intake_room, &intake_room_mutex);
+        atomic_fetch_sub(&intake_waiting, 1);
+        pthread_mutex_unlock(&intake_room_mutex);
+        return 0;
+}
+
+/*
+ * Waits until every request put in the ring before the call has been
+ * applied, so that what comes next sees them all.
+ */
+void intake_drain (void)
+{
+        size_t target;
+
+        if (!intake_on)
+                return;
+        target = atomic_load(&intake_tail);
+        if (atomic_load(&intake_applied) >= target)
+                return;
+        pthread_mutex_lock(&intake_room_mutex);
+        atomic_fetch_add(&intake_waiting, 1);
+        while (atomic_load(&intake_applied) < target)
+                pthread_cond_wait(&intake_room, &intake_room_mutex);
+        atomic_fetch_sub(&intake_waiting, 1);
+        pthread_mutex_unlock(&intake_room_mutex);
+}
+
+void intake_get_stats (intake_stats_t *stats)
+{
+        stats->capacity = intake_config.capacity;
+        stats->depth = intake_depth();
+        stats->high_water = atomic_load(&intake_high_water);
+        stats->queued = atomic_load(&intake_tail);
+        stats->rejected = atomic_load(&intake_rejected);
+        stats->shed = atomic_load(&intake_shed);
+        stats->blocked = atomic_load(&intake_blocked);
+}
+
+int intake_overload_policy (const char *name)
+{
+        if (strcmp(name, "block") == 0)
+                return INTAKE_BLOCK;
+        if (strcmp(name, "reject") == 0)
+                return INTAKE_REJECT;
+        if (strcmp(name, "shed") == 0)
+                return INTAKE_SHED;
+        return -1;
+}
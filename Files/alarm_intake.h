@@ -0,0 +1,58 @@
+#ifndef __alarm_intake_h
+#define __alarm_intake_h
+
+#include <stddef.h>
+#include "alarm.h"
+
+/*
+ * Bounded ring of parsed requests between the threads that take
+ * commands (the prompt, the socket server, batch files) and the
+ * engine. Any thread can put a request in without a lock; one thread
+ * of the ring's own takes them out in order, as many as have built
+ * up, and applies them as a batch. The ring holds at most "capacity"
+ * requests, so a burst costs a fixed amount of memory, and what
+ * happens when it is full is up to the overload policy:
+ *
+ *      block   the command waits for room, holding up its sender
+ *      reject  the command is turned away with "ERROR!!! Busy"
+ *      shed    new alarms and changes are turned away once the ring
+ *              is three quarters full; cancels, which lighten the
+ *              load, wait for room
+ */
+#define INTAKE_BLOCK            0
+#define INTAKE_REJECT           1
+#define INTAKE_SHED             2
+
+#define INTAKE_DEFAULT_CAPACITY 65536
+// Requests the ring's thread takes out for one batch at most
+#define INTAKE_BATCH            65536
+
+typedef struct intake_config_tag {
+        size_t            capacity;                     /* power of 2, 0 for none */
+        int               overload;                     /* INTAKE_BLOCK, ... */
+} intake_config_t;
+
+/*
+ * Applies "count" requests taken out of the ring, in the order they
+ * were put in. The callee owns them from then on.
+ */
+typedef void (*intake_apply_t) (alarm_t **batch, int count);
+
+typedef struct intake_stats_tag {
+        size_t            capacity;
+        size_t            depth;                        /* waiting now */
+        size_t            high_water;
+        unsigned long     queued;                       /* since start */
+        unsigned long     rejected;                     /* ring full */
+        unsigned long     shed;
+        unsigned long     blocked;                      /* waits for room */
+} intake_stats_t;
+
+void intake_start (intake_config_t *config, intake_apply_t apply);
+int intake_running (void);
+int intake_submit (alarm_t *alarm);
+void intake_drain (void);
+void intake_get_stats (intake_stats_t *stats);
+int intake_overload_policy (const char *name);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * alarm_intern.c
+ *
+ * Shared, reference-counted message text.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include "errors.h"
+#include "alarm_epoch.h"
+#include "alarm_intern.h"
+
+#define INTERN_STRIPE_BITS      6                       /* log2 INTERN_STRIPES */
+#define INTERN_BUCKETS          64                      /* per stripe at first */
+
+typedef struct intern_entry_tag {
+        struct intern_entry_tag   *next;
+        size_t            length;
+        uint32_t          hash;
+        unsigned          refs;                         /* under the stripe lock */
+        char              text[];
+} intern_entry_t;
+
+typedef struct intern_stripe_tag {
+        _Alignas(64) pthread_mutex_t mutex;
+        intern_entry_t    **buckets;
+        size_t            mask;                         /* buckets - 1 */
+        size_t            count;
+        size_t            bytes;
+        size_t            references;
+} intern_stripe_t;
+
+const char intern_empty[] = "";
+
+static intern_stripe_t stripes[INTERN_STRIPES];
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+static void intern_init (void)
+{
+        int i;
+
+        for (i = 0; i < INTERN_STRIPES; i++)
+        {
+                pthread_mutex_init(&stripes[i].mutex, NULL);
+                stripes[i].buckets = (intern_entry_t**)calloc(INTERN_BUCKETS,
+                  sizeof(intern_entry_t*));
+                if (stripes[i].buckets == NULL)
+                        errno_abort ("Allocate intern table");
+                stripes[i].mask = INTERN_BUCKETS - 1;
+        }
+}
+
+// FNV-1a; the low bits pick the stripe and the rest the bucket
+static uint32_t intern_hash (const char *text, size_t length)
+{
+        uint32_t hash = 2166136261u;
+        size_t i;
+
+        for (i = 0; i < length; i++)
+                hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+        return hash;
+}
+
+static size_t intern_bucket (intern_stripe_t *stripe, uint32_t hash)
+{
+        return (hash >> INTERN_STRIPE_BITS) & stripe->mask;
+}
+
+// Doubles the stripe's buckets once it holds as many strings as buckets
+static void intern_grow (intern_stripe_t *stripe)
+{
+        intern_entry_t **old = stripe->buckets, *entry, *next;
+        size_t size = stripe->mask + 1, i, bucket;
+
+        stripe->buckets = (intern_entry_t**)calloc(size * 2,
+          sizeof(intern_entry_t*));
+        if (stripe->buckets == NULL)
+                errno_abort ("Grow intern table");
+        stripe->mask = size * 2 - 1;
+        for (i = 0; i < size; i++)
+                for (entry = old[i]; entry != NULL; entry = next)
+                {
+                        next = entry->next;
+                        bucket = intern_bucket(stripe, entry->hash);
+                        entry->next = stripe->buckets[bucket];
+                        stripe->buckets[bucket] = entry;
+                }
+        free(old);
+}
+
+/*
+ * Returns the shared copy of the "length" bytes at "text", NUL
+ * terminated, with a reference taken on it for the caller.
+ */
+const char *intern_get (const char *text, size_t length)
+{
+        intern_stripe_t *stripe;
+        intern_entry_t *entry;
+        uint32_t hash;
+        size_t bucket;
+
+        if (length == 0)
+                return intern_empty;
+        pthread_once(&intern_once, intern_init);
+        hash = intern_hash(text, length);
+        stripe = &stripes[hash & (INTERN_STRIPES - 1)];
+
+        pthread_mutex_lock(&stripe->mutex);
+        bucket = intern_bucket(stripe, hash);
+        for (entry = stripe->buckets[bucket]; entry != NULL;
+          entry = entry->next)
+                if (entry->hash == hash && entry->length == length
+                  && memcmp(entry->text, text, length) == 0)
+                        break;
+        if (entry == NULL)
+        {
+                entry = (intern_entry_t*)malloc(sizeof(intern_entry_t)
+                  + length + 1);
+                if (entry == NULL)
+                        errno_abort ("Allocate message");
+                entry->length = length;
+                entry->hash = hash;
+                entry->refs = 0;
+                memcpy(entry->text, text, length);
+                entry->text[length] = '\0';
+                entry->next = stripe->buckets[bucket];
+                stripe->buckets[bucket] = entry;
+                stripe->bytes += length;
+                if (++stripe->count > stripe->mask + 1)
+                        intern_grow(stripe);
+        }
+        entry->refs++;
+        stripe->references++;
+        pthread_mutex_unlock(&stripe->mutex);
+        return entry->text;
+}
+
+/*
+ * Drops a reference taken by intern_get. NULL and intern_empty are
+ * ignored.
+ */
+void intern_release (const char *message)
+{
+        intern_stripe_t *stripe;
+        intern_entry_t *entry, **link;
+
+        if (message == NULL || message == intern_empty)
+                return;
+        entry = (intern_entry_t*)(message - offsetof(intern_entry_t, text));
+        stripe = &stripes[entry->hash & (INTERN_STRIPES - 1)];
+
+        pthread_mutex_lock(&stripe->mutex);
+        stripe->references--;
+        if (--entry->refs > 0)
+        {
+                pthread_mutex_unlock(&stripe->mutex);
+                return;
+        }
+        link = &stripe->buckets[intern_bucket(stripe, entry->hash)];
+        while (*link != entry)
+                link = &(*link)->next;
+        *link = entry->next;
+        stripe->count--;
+        stripe->bytes -= entry->length;
+        pthread_mutex_unlock(&stripe->mutex);
+
+        //Readers may still be printing it
+        epoch_retire(entry, free);
+}
+
+void intern_get_stats (intern_stats_t *stats)
+{
+        int i;
+
+        pthread_once(&intern_once, intern_init);
+        stats->strings = stats->bytes = stats->references = 0;
+        for (i = 0; i < INTERN_STRIPES; i++)
+        {
+                pthread_mutex_lock(&stripes[i].mutex);
+                stats->strings += stripes[i].count;
+                stats->bytes += stripes[i].bytes;
+                stats->references += stripes[i].references;
+                pthread_mutex_unlock(&stripes[i].mutex);
+        }
+}
@@ -0,0 +1,33 @@
+#ifndef __alarm_intern_h
+#define __alarm_intern_h
+
+#include <stddef.h>
+
+/*
+ * Interned message text. An alarm holds its message as a pointer to
+ * a shared, reference-counted copy, so a message is stored once
+ * however many alarms carry it and the alarm itself stays small
+ * whatever the length of its text. The table is split into
+ * INTERN_STRIPES parts by hash, each with a lock of its own.
+ *
+ * A message whose last reference goes is taken out of the table at
+ * once, but its memory is only reclaimed through epoch_retire, so a
+ * reader that loaded the pointer inside an epoch section may still
+ * print it.
+ */
+#define INTERN_STRIPES          64
+
+typedef struct intern_stats_tag {
+        size_t            strings;                      /* distinct, live */
+        size_t            bytes;                        /* their text */
+        size_t            references;
+} intern_stats_t;
+
+// The empty message; it is not counted and may be released any number of times
+extern const char intern_empty[];
+
+const char *intern_get (const char *text, size_t length);
+void intern_release (const char *message);
+void intern_get_stats (intern_stats_t *stats);
+
+#endif
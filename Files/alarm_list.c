@@ -0,0 +1,613 @@
+/*
+ * alarm_list.c
+ *
+ * The shared alarm store: ALARM_SHARDS lists, each sorted by message
+ * number and each with its own lock, the skip list levels that find a
+ * place on it in logarithmic time, and the message number index that
+ * makes lookups on it constant time.
+ */
+#include <limits.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_index.h"
+#include "alarm_intern.h"
+#include "alarm_pool.h"
+#include "alarm_epoch.h"
+#include "alarm_log.h"
+#include "alarm_stats.h"
+
+/*
+ * One partition of the store. A message number always maps to the
+ * same shard, so the alarm and the cancel request for it are on the
+ * same list. Shards sit on cache lines of their own, so writers on
+ * different shards do not share any.
+ */
+typedef struct alarm_shard_tag {
+        _Alignas(64) alarm_rwlock_t lock;
+        // Maintains the head and tail of the list
+        alarm_t           *head, *tail;
+        // Finds the alarm and cancel request for a message number without
+        // a walk
+        alarm_index_t     index;
+        // Picks the height of each new alarm's tower, under the lock
+        uint32_t          seed;
+} alarm_shard_t;
+
+/*
+ * Skip list levels over each list. Level 0 is the list itself; an
+ * alarm also on levels 1 to height - 1 has a tower with its link on
+ * each. Each level is a quarter the length of the one below. Only
+ * alarms get towers: a cancel request sits on level 0 just before
+ * its alarm. The head sentinel has a tower of every level, and the
+ * upper levels end in NULL rather than at the tail.
+ *
+ * Writers change the levels under the shard lock. Readers search
+ * them without locking, as they walk level 0: a node is filled in
+ * before it is published on any level, and a node taken off keeps
+ * its links, and its tower is only freed through epoch_retire.
+ */
+#define SKIP_LEVELS             16
+
+typedef struct alarm_tower_tag {
+        int               height;                       /* levels, with 0 */
+        _Atomic(alarm_t *) next[];                      /* level i + 1 */
+} alarm_tower_t;
+
+// Nodes a range walk visits before letting reclamation catch up
+#define WALK_CHUNK              1024
+
+static alarm_shard_t shards[ALARM_SHARDS];
+
+// The shard a message number lives on, 0 to ALARM_SHARDS - 1
+int alarm_shard_of (int messageNum)
+{
+        return (unsigned)messageNum % ALARM_SHARDS;
+}
+
+static alarm_shard_t *alarm_shard (int messageNum)
+{
+        return &shards[alarm_shard_of(messageNum)];
+}
+
+void alarm_list_init (void)
+{
+        alarm_shard_t *shard;
+        int i;
+
+        for (i = 0; i < ALARM_SHARDS; i++)
+        {
+                shard = &shards[i];
+                rwlock_init(&shard->lock);
+                shard->tail = (alarm_t*)malloc(sizeof(alarm_t));
+                shard->head = (alarm_t*)malloc(sizeof(alarm_t));
+                if (shard->head == NULL || shard->tail == NULL)
+                        errno_abort ("Allocate alarm list");
+                shard->head->link = shard->tail;
+                shard->head->prev = NULL;
+                shard->tail->link = NULL;
+                shard->tail->prev = shard->head;
+                shard->head->tower = (alarm_tower_t*)calloc(1,
+                  sizeof(alarm_tower_t) + (SKIP_LEVELS - 1)
+                  * sizeof(alarm_t*));
+                if (shard->head->tower == NULL)
+                        errno_abort ("Allocate skip list");
+                shard->head->tower->height = SKIP_LEVELS;
+                shard->seed = 2463534242u + i;
+                index_init(&shard->index, 64);
+        }
+}
+
+/*
+ * Returns every alarm still on the lists to the pool, and frees the
+ * sentinels and the indexes. Nothing may be using the store any more.
+ */
+void alarm_list_destroy (void)
+{
+        alarm_shard_t *shard;
+        alarm_t *next, *link;
+        int i;
+
+        for (i = 0; i < ALARM_SHARDS; i++)
+        {
+                shard = &shards[i];
+                next = shard->head->link;
+                while (next != shard->tail)
+                {
+                        link = next->link;
+                        intern_release(next->message);
+                        free(next->tower);
+                        alarm_free(next);
+                        next = link;
+                }
+                free(shard->head->tower);
+                free(shard->head);
+                free(shard->tail);
+                shard->head = shard->tail = NULL;
+                index_destroy(&shard->index);
+        }
+}
+
+// The lock a writer must hold to change anything about this message number
+alarm_rwlock_t *alarm_shard_lock (int messageNum)
+{
+        return &alarm_shard(messageNum)->lock;
+}
+
+/*
+ * Finds the last node before "messageNum" on each level, from the
+ * top down: the head, or the alarm with the next smaller number.
+ * Stores them in "before", if it is not NULL, and returns the one on
+ * level 0, whose link is the first node at or after "messageNum".
+ * Writers call it under the shard lock, readers in an epoch section.
+ */
+static alarm_t *skip_seek (alarm_shard_t *shard, int messageNum,
+  alarm_t **before, uint64_t *steps)
+{
+        alarm_t *node = shard->head, *next;
+        int level;
+
+        for (level = SKIP_LEVELS - 1; level > 0; level--)
+        {
+                while ((next = atomic_load_explicit(
+                  &node->tower->next[level - 1], memory_order_acquire))
+                  != NULL && next->messageNum < messageNum)
+                {
+                        node = next;
+                        (*steps)++;
+                }
+                if (before != NULL)
+                        before[level] = node;
+        }
+        while ((next = atomic_load_explicit(&node->link,
+          memory_order_acquire)) != shard->tail
+          && next->messageNum < messageNum)
+        {
+                node = next;
+                (*steps)++;
+        }
+        if (before != NULL)
+                before[0] = node;
+        return node;
+}
+
+/*
+ * Calls "visit" on every alarm and cancel request with a message
+ * number from "first" to "last", in order, merging the shards as it
+ * goes. Each shard is entered through its skip list, so the cost is
+ * one search per shard plus the nodes visited. Takes no locks: like
+ * any reader it may see a change that is under way, but never a node
+ * that has been freed. Every WALK_CHUNK nodes it leaves its epoch
+ * section and searches again from where it was, so that a walk over
+ * millions of alarms does not hold back reclamation meanwhile.
+ */
+void alarm_list_range (int first, int last, alarm_visit_t visit, void *arg)
+{
+        alarm_t *cursor[ALARM_SHARDS], *next;
+        uint64_t steps = 0;
+        int i, lowest, key, visited, done = 0;
+
+        while (!done)
+        {
+                epoch_enter();
+                for (i = 0; i < ALARM_SHARDS; i++)
+                        cursor[i] = atomic_load_explicit(&skip_seek(
+                          &shards[i], first, NULL, &steps)->link,
+                          memory_order_acquire);
+                for (visited = 0; ; visited++)
+                {
+                        //Each shard is sorted, so the next alarm overall is
+                        //at the front of one of them
+                        //The smallest number is kept to hand, so each shard
+                        //is compared without going back to the best so far
+                        lowest = -1;
+                        key = 0;
+                        for (i = 0; i < ALARM_SHARDS; i++)
+                        {
+                                if (cursor[i] == shards[i].tail)
+                                        continue;
+                                if (lowest < 0 || cursor[i]->messageNum < key)
+                                {
+                                        lowest = i;
+                                        key = cursor[i]->messageNum;
+                                }
+                        }
+                        if (lowest < 0 || key > last)
+                        {
+                                done = 1;
+                                break;
+                        }
+                        //Stops between message numbers, so an alarm and its
+                        //cancel request are seen together
+                        if (visited >= WALK_CHUNK && key > first)
+                        {
+                                first = key;
+                                break;
+                        }
+                        first = key;
+                        next = cursor[lowest];
+                        cursor[lowest] = atomic_load_explicit(&next->link,
+                          memory_order_acquire);
+                        visit(next, arg);
+                }
+                epoch_exit();
+        }
+}
+
+// Calls "visit" on every alarm and cancel request in the store in order
+void alarm_list_walk (alarm_visit_t visit, void *arg)
+{
+        alarm_list_range(INT_MIN, INT_MAX, visit, arg);
+}
+
+// Links the alarm into the list just before "next"
+static void link_before (alarm_t *alarm, alarm_t *next)
+{
+        atomic_store_explicit(&alarm->link, next, memory_order_relaxed);
+        alarm->prev = next->prev;
+        //Updates the flag
+        alarm->alarmExistsFlag = 1;
+        //Publishes the alarm, fully set up, to readers walking the list
+        atomic_store_explicit(&next->prev->link, alarm, memory_order_release);
+        next->prev = alarm;
+}
+
+/*
+ * Takes the alarm off the list and marks it as no longer existing.
+ * Its own link is left alone, so a reader standing on it can still
+ * carry on down the list; it must not be freed until those readers
+ * are gone (see epoch_retire).
+ */
+static void unlink_alarm (alarm_t *alarm)
+{
+        alarm_t *next = atomic_load_explicit(&alarm->link,
+          memory_order_relaxed);
+
+        atomic_store_explicit(&alarm->prev->link, next, memory_order_release);
+        next->prev = alarm->prev;
+        alarm->alarmExistsFlag = 0;
+}
+
+// A tower height for a new alarm: 1, then each level above a quarter as often
+static int skip_height (alarm_shard_t *shard)
+{
+        uint32_t bits;
+        int height = 1;
+
+        //xorshift32
+        bits = shard->seed;
+        bits ^= bits << 13;
+        bits ^= bits >> 17;
+        bits ^= bits << 5;
+        shard->seed = bits;
+        while (height < SKIP_LEVELS && (bits & 3) == 0)
+        {
+                height++;
+                bits >>= 2;
+        }
+        return height;
+}
+
+/*
+ * Puts a new alarm on its shard's skip list, on level 0 just after
+ * "before[0]" and as high as its tower reaches. The tower is filled
+ * in before the alarm is published on any level, and the levels are
+ * published from the bottom up, so a reader finds it complete.
+ */
+static void skip_insert (alarm_shard_t *shard, alarm_t *alarm,
+  alarm_t **before)
+{
+        int height = skip_height(shard), level;
+
+        alarm->tower = NULL;
+        if (height > 1)
+        {
+                alarm->tower = (alarm_tower_t*)malloc(sizeof(alarm_tower_t)
+                  + (height - 1) * sizeof(alarm_t*));
+                if (alarm->tower == NULL)
+                        errno_abort ("Allocate skip list tower");
+                alarm->tower->height = height;
+                for (level = 1; level < height; level++)
+                        atomic_store_explicit(&alarm->tower->next[level - 1],
+                          atomic_load_explicit(
+                          &before[level]->tower->next[level - 1],
+                          memory_order_relaxed), memory_order_relaxed);
+        }
+        link_before(alarm, atomic_load_explicit(&before[0]->link,
+          memory_order_relaxed));
+        for (level = 1; level < height; level++)
+                atomic_store_explicit(&before[level]->tower->next[level - 1],
+                  alarm, memory_order_release);
+}
+
+/*
+ * Takes an alarm off the skip list levels above level 0, which the
+ * caller unlinks itself. Its tower keeps its links for readers still
+ * on it and is freed once they are gone.
+ */
+static void skip_remove (alarm_shard_t *shard, alarm_t *alarm)
+{
+        alarm_t *before[SKIP_LEVELS];
+        uint64_t steps = 0;
+        int level;
+
+        if (alarm->tower == NULL)
+                return;
+        skip_seek(shard, alarm->messageNum, before, &steps);
+        for (level = 1; level < alarm->tower->height; level++)
+                if (atomic_load_explicit(&before[level]->tower->next[level - 1],
+                  memory_order_relaxed) == alarm)
+                        atomic_store_explicit(
+                          &before[level]->tower->next[level - 1],
+                          atomic_load_explicit(&alarm->tower->next[level - 1],
+                          memory_order_relaxed), memory_order_release);
+        epoch_retire(alarm->tower, free);
+}
+
+// Checks if the alarm exists in the alarm list, used only for adding new alarm
+int findTypeA(alarm_t *alarm)
+{
+        alarm_shard_t *shard = alarm_shard(alarm->messageNum);
+        index_entry_t *entry;
+
+        //returns 1 if a matching alarm is found and 0 if not
+        entry = index_find(&shard->index, alarm->messageNum);
+        stats_record(STAT_PROBES, shard->index.probes);
+        return entry != NULL && entry->alarm != NULL;
+}
+
+// Checks if the alarm exists in the alarm list, used only for cancelling a
+// alarm
+int findTypeB(alarm_t *alarm)
+{
+        alarm_shard_t *shard = alarm_shard(alarm->messageNum);
+        index_entry_t *entry;
+
+        //returns 1 if a matching cancel request is found and 0 if not
+        entry = index_find(&shard->index, alarm->messageNum);
+        stats_record(STAT_PROBES, shard->index.probes);
+        return entry != NULL && entry->cancel != NULL;
+}
+
+//Method that finds a message with the matching message number and replaces it
+//with the new time and new message
+void changeAlarm(alarm_t *alarm)
+{
+        alarm_shard_t *shard = alarm_shard(alarm->messageNum);
+        index_entry_t *entry;
+        alarm_t *next;
+        const char *old;
+        unsigned version;
+
+        entry = index_find(&shard->index, alarm->messageNum);
+        if (entry == NULL || entry->alarm == NULL)
+                return;
+        next = entry->alarm;
+
+        //Makes the count odd while the new time and message go in, so a
+        //reader that overlaps the writes tries again; writers are kept
+        //apart by the shard lock
+        version = atomic_load_explicit(&next->version, memory_order_relaxed);
+        atomic_store_explicit(&next->version, version + 1,
+          memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        //Copies the new message time into the old message time
+        atomic_store_explicit(&next->seconds, alarm->seconds,
+          memory_order_relaxed);
+        //Hands the new message over to the old alarm; the one it had goes
+        //once no reader can be printing it
+        old = atomic_load_explicit(&next->message, memory_order_relaxed);
+        atomic_store_explicit(&next->message, alarm->message,
+          memory_order_relaxed);
+        //Publishes the change as the next version
+        atomic_store_explicit(&next->version, version + 2,
+          memory_order_release);
+        alarm->message = intern_empty;
+        intern_release(old);
+}
+
+/*
+ * Reads the alarm's period and message as they were after some one
+ * change, never half of one and half of another. Must be called in
+ * an epoch section for the message to stay valid.
+ */
+void alarm_read (alarm_t *alarm, alarm_snapshot_t *snapshot)
+{
+        unsigned version;
+
+        do
+        {
+                version = atomic_load_explicit(&alarm->version,
+                  memory_order_acquire);
+                snapshot->seconds = atomic_load_explicit(&alarm->seconds,
+                  memory_order_relaxed);
+                snapshot->message = atomic_load_explicit(&alarm->message,
+                  memory_order_relaxed);
+                //Keeps the reads above from moving past the recheck
+                atomic_thread_fence(memory_order_acquire);
+        } while ((version & 1) || version != atomic_load_explicit(
+          &alarm->version, memory_order_relaxed));
+        snapshot->version = version / 2;
+}
+
+/*
+ * Applies one request to its shard. Returns one of the ALARM_
+ * results.
+ */
+static int alarm_apply (alarm_shard_t *shard, alarm_t *alarm)
+{
+        alarm_t *before[SKIP_LEVELS];
+        index_entry_t *entry;
+        uint64_t steps = 0;
+
+        //Checks if the alarm request is adding to the list
+        if(alarm->alarmRequestType == 1)
+        {
+                //If the alarm is found in the list
+                if(findTypeA(alarm))
+                {
+                        //change the alarm to the new alarm with the new
+                        //message and time
+                        changeAlarm(alarm);
+                        return ALARM_CHANGED;
+                }
+
+                //Finds the sorted position on every level, so the list
+                //stays in order of message numbers
+                skip_seek(shard, alarm->messageNum, before, &steps);
+                skip_insert(shard, alarm, before);
+                entry = index_get(&shard->index, alarm->messageNum);
+                entry->alarm = alarm;
+                stats_record(STAT_WALK, steps);
+                stats_count(STAT_LINKED, 1);
+                return ALARM_ADDED;
+        }
+
+        //Checks if the alarm is found in the list
+        entry = index_find(&shard->index, alarm->messageNum);
+        stats_record(STAT_PROBES, shard->index.probes);
+        //If the alarm is not found
+        if(entry == NULL || entry->alarm == NULL)
+        {
+                //Prints error message
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "ERROR!!! Alarm With Message Number (%d) Does NOT "
+                  "Exist\n", alarm->messageNum);
+                return ALARM_MISSING;
+        }
+        //If alarm is found on the list again
+        if(entry->cancel != NULL)
+        {
+                //prints an error message
+                log_client_printf(alarm->client, STDOUT_FILENO,
+                  "ERROR!!! Multiple(%d)!\n", alarm->messageNum);
+                return ALARM_MULTIPLE;
+        }
+        //Otherwise the cancel request goes on the list right in
+        //front of the alarm it cancels, keeping the order correct
+        alarm->tower = NULL;
+        link_before(alarm, entry->alarm);
+        entry->cancel = alarm;
+        return ALARM_CANCELLED;
+}
+
+/*
+ * Insert alarm entry on list, in order of message numbers. Returns
+ * one of the ALARM_ results.
+ */
+int alarm_insert (alarm_t *alarm)
+{
+        return alarm_apply(alarm_shard(alarm->messageNum), alarm);
+}
+
+/*
+ * Applies "count" requests, all for message numbers on one shard and
+ * sorted by message number, under a single hold of the shard's lock.
+ * Requests for the same message number take effect in the order they
+ * come in the batch. The result of each is stored in "results". The
+ * caller holds the writer side of the shard's lock throughout.
+ */
+void alarm_merge (alarm_t **batch, int count, int *results)
+{
+        alarm_shard_t *shard;
+        int i;
+
+        if (count == 0)
+                return;
+        shard = alarm_shard(batch[0]->messageNum);
+        for (i = 0; i < count; i++)
+                results[i] = alarm_apply(shard, batch[i]);
+}
+
+/*
+ * Appends "count" new alarms, all for message numbers on one shard,
+ * in increasing order and each above every alarm already there. With
+ * nothing to search for, each goes on in constant time. Used to load
+ * a snapshot. The caller holds the writer side of the shard's lock.
+ */
+void alarm_append (alarm_t **batch, int count)
+{
+        alarm_t *before[SKIP_LEVELS];
+        alarm_shard_t *shard;
+        index_entry_t *entry;
+        uint64_t steps = 0;
+        int i, level;
+
+        if (count == 0)
+                return;
+        shard = alarm_shard(batch[0]->messageNum);
+        skip_seek(shard, INT_MAX, before, &steps);
+        for (i = 0; i < count; i++)
+        {
+                skip_insert(shard, batch[i], before);
+                //It is now the last node on every level it reaches
+                before[0] = batch[i];
+                for (level = 1; batch[i]->tower != NULL
+                  && level < batch[i]->tower->height; level++)
+                        before[level] = batch[i];
+                entry = index_get(&shard->index, batch[i]->messageNum);
+                entry->alarm = batch[i];
+        }
+        stats_count(STAT_LINKED, count);
+}
+
+// The alarm on the list for a message number, or NULL
+alarm_t *alarm_find (int messageNum)
+{
+        alarm_shard_t *shard = alarm_shard(messageNum);
+        index_entry_t *entry;
+
+        entry = index_find(&shard->index, messageNum);
+        return entry != NULL ? entry->alarm : NULL;
+}
+
+/*
+ * Removes a cancel request that is on the list, together with the
+ * alarm it cancels. Both are flagged as no longer existing so the
+ * dispatcher firing the alarm drops it. Returns the cancelled alarm,
+ * or NULL if there was none.
+ */
+alarm_t *alarm_remove (alarm_t *cancel)
+{
+        alarm_shard_t *shard = alarm_shard(cancel->messageNum);
+        index_entry_t *entry;
+        alarm_t *alarm;
+
+        entry = index_find(&shard->index, cancel->messageNum);
+        if (entry == NULL || entry->cancel != cancel)
+                return NULL;
+        unlink_alarm(cancel);
+        alarm = entry->alarm;
+        if (alarm != NULL)
+        {
+                skip_remove(shard, alarm);
+                unlink_alarm(alarm);
+                stats_count(STAT_UNLINKED, 1);
+        }
+        entry->alarm = NULL;
+        entry->cancel = NULL;
+        index_release(&shard->index, entry);
+        return alarm;
+}
+
+/*
+ * Takes an alarm that retires itself off the list, flagging it as no
+ * longer existing. An alarm with a cancel request waiting in front
+ * of it is left for the cancel to take off with it. Returns 1 if the
+ * alarm was taken off. The caller holds the writer side of the
+ * shard's lock.
+ */
+int alarm_expire (alarm_t *alarm)
+{
+        alarm_shard_t *shard = alarm_shard(alarm->messageNum);
+        index_entry_t *entry;
+
+        entry = index_find(&shard->index, alarm->messageNum);
+        if (entry == NULL || entry->alarm != alarm || entry->cancel != NULL)
+                return 0;
+        skip_remove(shard, alarm);
+        unlink_alarm(alarm);
+        stats_count(STAT_UNLINKED, 1);
+        entry->alarm = NULL;
+        index_release(&shard->index, entry);
+        return 1;
+}
@@ -0,0 +1,741 @@
+/*
+ * alarm_log.c
+ *
+ * Per-thread output rings and the logger thread that drains them.
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "errors.h"
+#include "alarm_epoch.h"
+#include "alarm_log.h"
+
+#define LOG_MAX_RINGS           128
+// Output held for a client that is not keeping up, before lines are dropped
+#define LOG_CLIENT_BACKLOG      (64 * 1024)
+// How often the logger tries again to send what it holds for clients
+#define LOG_RETRY_MS            10
+// Lines gathered into one writev; IOV_MAX where the system says
+#ifdef IOV_MAX
+# define LOG_BATCH              IOV_MAX
+#else
+# define LOG_BATCH              1024
+#endif
+
+typedef struct log_record_tag {
+        uint64_t          seq;
+        int               fd;
+        int               client;                       /* slot, or -1 */
+        int               length;
+        char              *spill;                       /* longer line, or NULL */
+        char              text[LOG_TEXT_MAX];
+} log_record_t;
+
+/*
+ * Single-producer, single-consumer ring. The owning thread moves
+ * "tail" and the logger moves "head"; they sit on separate cache
+ * lines so the two sides do not fight over them.
+ */
+typedef struct log_ring_tag {
+        _Alignas(64) atomic_size_t head;
+        _Alignas(64) atomic_size_t tail;
+        size_t            mask;
+        log_record_t      *records;
+} log_ring_t;
+
+static log_config_t log_config;
+static atomic_int log_running;
+static atomic_int log_stopping;
+static pthread_t log_thread;
+static log_ring_t *log_rings[LOG_MAX_RINGS];
+static atomic_int log_nrings;
+static _Thread_local log_ring_t *log_self;
+/*
+ * Once all but the last of the LOG_MAX_RINGS slots are taken, later
+ * threads share the ring in the last one, taking turns to write it
+ * under log_shared_mutex.
+ */
+static log_ring_t *log_shared;
+static _Thread_local int log_self_shared;
+static pthread_mutex_t log_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint_fast64_t log_seq;                    /* next line's stamp */
+static atomic_uint_fast64_t log_flushed;                /* all before written */
+static atomic_ulong log_written, log_dropped, log_writes;
+static atomic_ulong log_client_dropped;
+
+// The logger sleeps on this when every ring is empty
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int log_sleeping;
+// Threads waiting for room in a full ring sleep on this
+static pthread_cond_t log_space = PTHREAD_COND_INITIALIZER;
+static atomic_int log_blocked;
+
+/*
+ * Connected clients. A slot's id is 0 while free, -1 while being set
+ * up or torn down, and the client number while lines for the client
+ * go to its descriptor.
+ *
+ * Client sockets never block. Whatever the socket will not take yet
+ * is held in the slot's backlog, which only the logger touches, and
+ * sent when the socket has room; whole lines that would take the
+ * backlog past LOG_CLIENT_BACKLOG are dropped and counted, so a
+ * client that stops reading loses lines but never gets half of one.
+ * "owner" is the client the backlog was held for: once the slot no
+ * longer has that id, the logger throws the backlog away.
+ */
+typedef struct log_client_tag {
+        atomic_int        id;
+        int               fd;
+        int               owner;
+        char              *backlog;
+        atomic_size_t     backlog_used;
+        size_t            backlog_size;
+} log_client_t;
+
+static log_client_t log_clients[LOG_MAX_CLIENTS];
+static atomic_int log_next_client = LOG_CONSOLE + 1;
+static int log_backlogged;                              /* slots; logger only */
+
+static void log_wake (void)
+{
+        //Pairs with the fence in logger_thread: either the logger sees
+        //the new line or this thread sees that it went to sleep
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&log_sleeping, memory_order_relaxed))
+        {
+                pthread_mutex_lock(&log_mutex);
+                pthread_cond_signal(&log_cond);
+                pthread_mutex_unlock(&log_mutex);
+        }
+}
+
+// Absolute CLOCK_REALTIME time "ms" milliseconds from now
+static struct timespec *log_deadline (int ms)
+{
+        static _Thread_local struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        return &deadline;
+}
+
+static log_ring_t *log_ring_alloc (void)
+{
+        log_ring_t *ring;
+
+        ring = (log_ring_t*)calloc(1, sizeof(log_ring_t));
+        if (ring == NULL)
+                errno_abort ("Allocate log ring");
+        ring->mask = log_config.ring_lines - 1;
+        ring->records = (log_record_t*)malloc(log_config.ring_lines
+          * sizeof(log_record_t));
+        if (ring->records == NULL)
+                errno_abort ("Allocate log ring");
+        return ring;
+}
+
+/*
+ * The calling thread's ring, set up on its first line: a ring of its
+ * own while there are slots to spare, otherwise the shared one.
+ */
+static log_ring_t *log_ring (void)
+{
+        log_ring_t *ring;
+        int slot;
+
+        if (log_self != NULL)
+                return log_self;
+        //The ring has to be in place before the logger can count it
+        pthread_mutex_lock(&log_mutex);
+        slot = atomic_load(&log_nrings);
+        if (slot < LOG_MAX_RINGS - 1)
+        {
+                ring = log_ring_alloc();
+                log_rings[slot] = ring;
+                atomic_store(&log_nrings, slot + 1);
+        }
+        else
+        {
+                if (log_shared == NULL)
+                {
+                        log_shared = log_ring_alloc();
+                        log_rings[slot] = log_shared;
+                        atomic_store(&log_nrings, slot + 1);
+                }
+                ring = log_shared;
+                log_self_shared = 1;
+        }
+        pthread_mutex_unlock(&log_mutex);
+        log_self = ring;
+        return ring;
+}
+
+/*
+ * Puts a line in the calling thread's ring, for the logger to write
+ * to "fd". "client" is the slot of the client the descriptor belongs
+ * to, or -1 for a file of the program's own.
+ */
+static void log_vprintf (int fd, int client, const char *format,
+  va_list ap)
+{
+        log_ring_t *ring;
+        log_record_t *record;
+        size_t tail;
+        va_list copy;
+        int length;
+
+        if (!atomic_load_explicit(&log_running, memory_order_acquire))
+        {
+                vdprintf(fd, format, ap);
+                return;
+        }
+
+        ring = log_ring();
+        if (log_self_shared)
+                pthread_mutex_lock(&log_shared_mutex);
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        while (tail - atomic_load_explicit(&ring->head, memory_order_acquire)
+          > ring->mask)
+        {
+                if (log_config.overflow != LOG_BLOCK)
+                {
+                        atomic_fetch_add(&log_dropped, 1);
+                        if (log_self_shared)
+                                pthread_mutex_unlock(&log_shared_mutex);
+                        return;
+                }
+                //Waits for the logger to make room, rechecking now and then
+                //in case the wake-up raced with this thread going to sleep
+                pthread_mutex_lock(&log_mutex);
+                atomic_fetch_add(&log_blocked, 1);
+                pthread_cond_signal(&log_cond);
+                if (tail - atomic_load(&ring->head) > ring->mask)
+                        pthread_cond_timedwait(&log_space, &log_mutex,
+                          log_deadline(1));
+                atomic_fetch_sub(&log_blocked, 1);
+                pthread_mutex_unlock(&log_mutex);
+        }
+
+        //The stamp is taken only once there is room, so there are never
+        //gaps in the sequence for the logger to wait on
+        record = &ring->records[tail & ring->mask];
+        record->seq = atomic_fetch_add(&log_seq, 1);
+        record->fd = fd;
+        record->client = client;
+        va_copy(copy, ap);
+        length = vsnprintf(record->text, LOG_TEXT_MAX, format, ap);
+        record->spill = NULL;
+        //A line too long for the record is formatted again on the heap,
+        //for the logger to free once it is written
+        if (length >= LOG_TEXT_MAX
+          && (record->spill = (char*)malloc(length + 1)) != NULL)
+                vsnprintf(record->spill, length + 1, format, copy);
+        va_end(copy);
+        if (length >= LOG_TEXT_MAX && record->spill == NULL)
+        {
+                //Keeps the end of line on a truncated line
+                length = LOG_TEXT_MAX - 1;
+                record->text[length - 1] = '\n';
+        }
+        record->length = length < 0 ? 0 : length;
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+        if (log_self_shared)
+                pthread_mutex_unlock(&log_shared_mutex);
+        //Once the ring is half full the logger should not wait out the
+        //rest of its interval
+        if (tail + 1 - atomic_load_explicit(&ring->head, memory_order_relaxed)
+          == (ring->mask + 1) / 2)
+        {
+                pthread_mutex_lock(&log_mutex);
+                pthread_cond_signal(&log_cond);
+                pthread_mutex_unlock(&log_mutex);
+        }
+        else
+                log_wake();
+}
+
+void log_printf (int fd, const char *format, ...)
+{
+        va_list ap;
+
+        va_start(ap, format);
+        log_vprintf(fd, -1, format, ap);
+        va_end(ap);
+}
+
+/*
+ * Gives the socket "fd" a client number for log_client_printf, or
+ * returns -1 if LOG_MAX_CLIENTS are connected already.
+ */
+int log_client_open (int fd)
+{
+        log_client_t *slot;
+        int id, free_id, tries;
+
+        for (tries = 0; tries < LOG_MAX_CLIENTS; tries++)
+        {
+                //Numbers are not reused, so a line for a client that has
+                //gone cannot reach whoever gets its slot next
+                id = atomic_fetch_add(&log_next_client, 1);
+                if (id <= LOG_CONSOLE)
+                        continue;
+                slot = &log_clients[id % LOG_MAX_CLIENTS];
+                free_id = 0;
+                if (!atomic_compare_exchange_strong(&slot->id, &free_id, -1))
+                        continue;
+                slot->fd = fd;
+                atomic_store_explicit(&slot->id, id, memory_order_release);
+                return id;
+        }
+        return -1;
+}
+
+/*
+ * Disconnects the client. Once this returns every line that was
+ * headed for its socket has been written, and no more will be, so
+ * the caller can close the socket.
+ */
+void log_client_close (int client)
+{
+        log_client_t *slot = &log_clients[client % LOG_MAX_CLIENTS];
+
+        atomic_store(&slot->id, -1);
+        //Waits out the threads that looked the client up before that...
+        epoch_barrier();
+        //...and the logger writing out what they sent it...
+        log_sync();
+        //...and throwing away whatever the socket would not take
+        pthread_mutex_lock(&log_mutex);
+        atomic_fetch_add(&log_blocked, 1);
+        while (atomic_load(&slot->backlog_used) > 0
+          && atomic_load(&log_running))
+        {
+                pthread_cond_signal(&log_cond);
+                pthread_cond_timedwait(&log_space, &log_mutex,
+                  log_deadline(1));
+        }
+        atomic_fetch_sub(&log_blocked, 1);
+        pthread_mutex_unlock(&log_mutex);
+        atomic_store(&slot->id, 0);
+}
+
+/*
+ * Like log_printf, for lines meant for a client: they go to the
+ * client's socket if it is connected, and to "fd" if not.
+ */
+void log_client_printf (int client, int fd, const char *format, ...)
+{
+        log_client_t *slot;
+        va_list ap;
+        int index = -1;
+
+        //Clients below the console take events, not text
+        if (client < LOG_CONSOLE)
+                return;
+        //The section keeps log_client_close waiting until the line is in
+        //a ring, so the socket is not closed under it
+        epoch_enter();
+        if (client > LOG_CONSOLE)
+        {
+                slot = &log_clients[client % LOG_MAX_CLIENTS];
+                if (atomic_load_explicit(&slot->id, memory_order_acquire)
+                  == client)
+                {
+                        fd = slot->fd;
+                        index = client % LOG_MAX_CLIENTS;
+                }
+        }
+        va_start(ap, format);
+        log_vprintf(fd, index, format, ap);
+        va_end(ap);
+        epoch_exit();
+}
+
+// Writes the whole of the iovec array, carrying on after short writes
+static void log_writev (int fd, struct iovec *iov, int count)
+{
+        ssize_t written;
+
+        while (count > 0)
+        {
+                written = writev(fd, iov, count);
+                if (written < 0)
+                {
+                        if (errno == EINTR)
+                                continue;
+                        return;
+                }
+                atomic_fetch_add(&log_writes, 1);
+                while (count > 0 && (size_t)written >= iov->iov_len)
+                {
+                        written -= iov->iov_len;
+                        iov++;
+                        count--;
+                }
+                if (count > 0)
+                {
+                        iov->iov_base = (char*)iov->iov_base + written;
+                        iov->iov_len -= written;
+                }
+        }
+}
+
+// Adds "length" bytes to the client's backlog, growing it to fit
+static void log_backlog_add (log_client_t *slot, const char *text,
+  size_t length)
+{
+        size_t used = atomic_load_explicit(&slot->backlog_used,
+          memory_order_relaxed), size;
+        char *grown;
+
+        if (used == 0)
+        {
+                slot->owner = atomic_load(&slot->id);
+                log_backlogged++;
+        }
+        if (used + length > slot->backlog_size)
+        {
+                for (size = slot->backlog_size ? slot->backlog_size : 4096;
+                  size < used + length; size *= 2)
+                        ;
+                grown = (char*)realloc(slot->backlog, size);
+                if (grown == NULL)
+                        errno_abort ("Grow client backlog");
+                slot->backlog = grown;
+                slot->backlog_size = size;
+        }
+        memcpy(slot->backlog + used, text, length);
+        atomic_store(&slot->backlog_used, used + length);
+}
+
+/*
+ * Sends as much of the client's backlog as its socket will take, or
+ * throws it away if the client has gone or the socket has failed.
+ * Returns 1 if some of it is still held.
+ */
+static int log_backlog_send (log_client_t *slot)
+{
+        size_t used = atomic_load(&slot->backlog_used);
+        ssize_t sent = 0;
+        int id = atomic_load(&slot->id);
+
+        if (used == 0)
+                return 0;
+        if (id > LOG_CONSOLE && id == slot->owner)
+        {
+                do
+                        sent = send(slot->fd, slot->backlog, used,
+                          MSG_DONTWAIT | MSG_NOSIGNAL);
+                while (sent < 0 && errno == EINTR);
+                if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return 1;
+                if (sent > 0 && (size_t)sent < used)
+                {
+                        atomic_fetch_add(&log_writes, 1);
+                        memmove(slot->backlog, slot->backlog + sent,
+                          used - sent);
+                        atomic_store(&slot->backlog_used, used - sent);
+                        return 1;
+                }
+        }
+        //All sent, or nowhere to send it
+        free(slot->backlog);
+        slot->backlog = NULL;
+        slot->backlog_size = 0;
+        atomic_store(&slot->backlog_used, 0);
+        log_backlogged--;
+        if (atomic_load(&log_blocked))
+        {
+                pthread_mutex_lock(&log_mutex);
+                pthread_cond_broadcast(&log_space);
+                pthread_mutex_unlock(&log_mutex);
+        }
+        return 0;
+}
+
+// Tries again to send what is held for every client that has any
+static void log_backlog_retry (void)
+{
+        int i;
+
+        for (i = 0; i < LOG_MAX_CLIENTS && log_backlogged > 0; i++)
+                log_backlog_send(&log_clients[i]);
+}
+
+/*
+ * Writes lines to a client's socket without ever waiting on it. What
+ * the socket does not take goes into the client's backlog: always
+ * the rest of a line that was partly sent, and after that each whole
+ * line that fits under LOG_CLIENT_BACKLOG, the others being dropped.
+ */
+static void log_client_writev (log_client_t *slot, struct iovec *iov,
+  int count)
+{
+        ssize_t written = 0;
+
+        //Lines cannot overtake what is already held
+        if (log_backlog_send(slot) == 0)
+        {
+                do
+                        written = writev(slot->fd, iov, count);
+                while (written < 0 && errno == EINTR);
+                if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                        return;
+                if (written < 0)
+                        written = 0;
+                else
+                        atomic_fetch_add(&log_writes, 1);
+                while (count > 0 && (size_t)written >= iov->iov_len)
+                {
+                        written -= iov->iov_len;
+                        iov++;
+                        count--;
+                }
+                if (count > 0 && written > 0)
+                {
+                        log_backlog_add(slot, (char*)iov->iov_base + written,
+                          iov->iov_len - written);
+                        iov++;
+                        count--;
+                }
+        }
+        for (; count > 0; iov++, count--)
+        {
+                if (atomic_load(&slot->backlog_used) + iov->iov_len
+                  > LOG_CLIENT_BACKLOG)
+                        atomic_fetch_add(&log_client_dropped, 1);
+                else
+                        log_backlog_add(slot, iov->iov_base, iov->iov_len);
+        }
+}
+
+/*
+ * Writes out, in sequence order, as many lines as are ready, up to
+ * one writev worth for a single file descriptor. Returns the number
+ * of lines written; 0 with "pending" set means a line with the next
+ * stamp is still being formatted.
+ */
+static int log_drain (uint64_t *next_seq, int *pending)
+{
+        static struct iovec iov[LOG_BATCH];
+        static char *spills[LOG_BATCH];
+        size_t cursor[LOG_MAX_RINGS], tail[LOG_MAX_RINGS];
+        log_record_t *record;
+        int nrings, i, count = 0, nspills = 0, fd = -1, client = -1, found;
+
+        nrings = atomic_load(&log_nrings);
+        *pending = 0;
+        for (i = 0; i < nrings; i++)
+        {
+                cursor[i] = atomic_load_explicit(&log_rings[i]->head,
+                  memory_order_relaxed);
+                tail[i] = atomic_load_explicit(&log_rings[i]->tail,
+                  memory_order_acquire);
+                if (cursor[i] != tail[i])
+                        *pending = 1;
+        }
+
+        while (count < LOG_BATCH)
+        {
+                //Each ring is in stamp order, so the next line is at the
+                //front of one of them or not published yet
+                found = 0;
+                for (i = 0; i < nrings && !found; i++)
+                {
+                        if (cursor[i] == tail[i])
+                                continue;
+                        record = &log_rings[i]->records[cursor[i]
+                          & log_rings[i]->mask];
+                        if (record->seq == *next_seq)
+                                found = 1;
+                }
+                if (!found || (fd >= 0 && (record->fd != fd
+                  || record->client != client)))
+                        break;
+                fd = record->fd;
+                client = record->client;
+                iov[count].iov_base = record->text;
+                if (record->spill != NULL)
+                        iov[count].iov_base = spills[nspills++] = record->spill;
+                iov[count].iov_len = record->length;
+                count++;
+                cursor[i - 1]++;
+                (*next_seq)++;
+        }
+
+        if (count > 0)
+        {
+                if (client >= 0)
+                        log_client_writev(&log_clients[client], iov, count);
+                else
+                        log_writev(fd, iov, count);
+                while (nspills > 0)
+                        free(spills[--nspills]);
+                atomic_fetch_add(&log_written, count);
+                atomic_store(&log_flushed, *next_seq);
+                //Only now can the producers reuse the slots
+                for (i = 0; i < nrings; i++)
+                        atomic_store_explicit(&log_rings[i]->head, cursor[i],
+                          memory_order_release);
+                if (atomic_load(&log_blocked))
+                {
+                        pthread_mutex_lock(&log_mutex);
+                        pthread_cond_broadcast(&log_space);
+                        pthread_mutex_unlock(&log_mutex);
+                }
+        }
+        return count;
+}
+
+// Stamp of the next line to write; only the logger touches it while running
+static uint64_t log_next_seq;
+
+static void *logger_thread (void *arg)
+{
+        unsigned long dropped, reported = 0;
+        int pending, count, length;
+        char line[64];
+
+        while (1)
+        {
+                count = log_drain(&log_next_seq, &pending);
+                if (log_backlogged > 0)
+                        log_backlog_retry();
+                if (log_config.overflow == LOG_COUNT
+                  && (dropped = atomic_load(&log_dropped)) != reported)
+                {
+                        length = snprintf(line, sizeof(line),
+                          "LOG: %lu lines dropped\n", dropped - reported);
+                        write(STDERR_FILENO, line, length);
+                        reported = dropped;
+                }
+                if (count > 0)
+                        continue;
+                if (pending)
+                {
+                        sched_yield();
+                        continue;
+                }
+                if (atomic_load(&log_stopping))
+                        break;
+
+                //Everything is out: sleep until a line is published, then
+                //give the other threads one interval to add to the batch
+                pthread_mutex_lock(&log_mutex);
+                atomic_store(&log_sleeping, 1);
+                atomic_thread_fence(memory_order_seq_cst);
+                count = log_drain(&log_next_seq, &pending);
+                //Wakes now and then to send what clients have not taken
+                if (count == 0 && !pending && !atomic_load(&log_stopping))
+                {
+                        if (log_backlogged > 0)
+                                pthread_cond_timedwait(&log_cond, &log_mutex,
+                                  log_deadline(LOG_RETRY_MS));
+                        else
+                                pthread_cond_wait(&log_cond, &log_mutex);
+                }
+                atomic_store(&log_sleeping, 0);
+                pthread_mutex_unlock(&log_mutex);
+                //Lets the batch build up for one interval, cut short if a
+                //thread runs low on room
+                if (log_config.flush_ms > 0)
+                {
+                        pthread_mutex_lock(&log_mutex);
+                        if (!atomic_load(&log_blocked))
+                                pthread_cond_timedwait(&log_cond, &log_mutex,
+                                  log_deadline(log_config.flush_ms));
+                        pthread_mutex_unlock(&log_mutex);
+                }
+        }
+        return NULL;
+}
+
+void log_start (log_config_t *config)
+{
+        int status;
+
+        log_config = *config;
+        //Rounds the ring size up to a power of two
+        if (log_config.ring_lines < 2)
+                log_config.ring_lines = 2;
+        while (log_config.ring_lines & (log_config.ring_lines - 1))
+                log_config.ring_lines += log_config.ring_lines
+                  & -log_config.ring_lines;
+        atomic_store(&log_running, 1);
+        status = pthread_create(&log_thread, NULL, logger_thread, NULL);
+        if (status != 0)
+                err_abort (status, "Create logger thread");
+        atexit(log_stop);
+}
+
+/*
+ * Writes out every line published so far and stops the logger. Runs
+ * from atexit, so the output is complete when the program exits.
+ */
+void log_stop (void)
+{
+        int pending;
+
+        if (!atomic_load(&log_running) || atomic_exchange(&log_stopping, 1))
+                return;
+        pthread_mutex_lock(&log_mutex);
+        pthread_cond_signal(&log_cond);
+        pthread_mutex_unlock(&log_mutex);
+        pthread_join(log_thread, NULL);
+        atomic_store(&log_running, 0);
+        //Picks up anything published while the logger was finishing
+        while (log_drain(&log_next_seq, &pending) > 0 || pending)
+                ;
+}
+
+/*
+ * Waits until every line stamped before the call has been written.
+ */
+void log_sync (void)
+{
+        uint64_t last = atomic_load(&log_seq);
+
+        if (!atomic_load(&log_running))
+                return;
+        //Counting as a blocked producer keeps the logger from waiting out
+        //its flush interval and has it signal after every batch
+        pthread_mutex_lock(&log_mutex);
+        atomic_fetch_add(&log_blocked, 1);
+        while (atomic_load(&log_flushed) < last
+          && atomic_load(&log_running))
+        {
+                pthread_cond_signal(&log_cond);
+                pthread_cond_timedwait(&log_space, &log_mutex,
+                  log_deadline(1));
+        }
+        atomic_fetch_sub(&log_blocked, 1);
+        pthread_mutex_unlock(&log_mutex);
+}
+
+void log_get_stats (log_stats_t *stats)
+{
+        stats->written = atomic_load(&log_written);
+        stats->dropped = atomic_load(&log_dropped);
+        stats->writes = atomic_load(&log_writes);
+        stats->client_dropped = atomic_load(&log_client_dropped);
+}
+
+// Maps "block", "drop" or "count" to the overflow policy, -1 if none
+int log_overflow_policy (const char *name)
+{
+        if (strcmp(name, "block") == 0)
+                return LOG_BLOCK;
+        if (strcmp(name, "drop") == 0)
+                return LOG_DROP;
+        if (strcmp(name, "count") == 0)
+                return LOG_COUNT;
+        return -1;
+}
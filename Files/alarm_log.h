@@ -0,0 +1,64 @@
+#ifndef __alarm_log_h
+#define __alarm_log_h
+
+#include <stddef.h>
+#include <unistd.h>
+
+/*
+ * Asynchronous output sink. Threads format their lines straight into
+ * a ring buffer of their own (one producer, no lock) and a single
+ * logger thread gathers them into large writev calls. Every line is
+ * stamped from one global sequence counter and the logger writes
+ * them back in that order, so the output reads exactly as it would
+ * have with printf, just without a write per line.
+ *
+ * Before log_start is called, and after log_stop, log_printf writes
+ * directly, so code that prints can also be used outside the program.
+ *
+ * Lines can also be addressed to a client (see alarm_server.c) rather
+ * than a file descriptor: they go to the client's socket while it is
+ * connected, and to the fallback descriptor otherwise. Client 0,
+ * LOG_CONSOLE, is never connected and always falls back. Lines for
+ * a negative client are dropped: those clients are sent binary
+ * events instead (see alarm_shm_server.h).
+ */
+// Lines up to this long are formatted in place, longer ones on the heap
+#define LOG_TEXT_MAX            240
+
+// What a thread does when its ring is full
+#define LOG_BLOCK               0                       /* wait for space */
+#define LOG_DROP                1                       /* lose the line */
+#define LOG_COUNT               2                       /* lose it, report how many */
+
+typedef struct log_config_tag {
+        int               flush_ms;                     /* longest a line waits */
+        int               overflow;                     /* LOG_BLOCK, ... */
+        size_t            ring_lines;                   /* per thread, power of 2 */
+} log_config_t;
+
+#define LOG_DEFAULT_FLUSH_MS    5
+#define LOG_DEFAULT_RING_LINES  1024
+
+#define LOG_CONSOLE             0
+#define LOG_MAX_CLIENTS         1024                    /* connected at once */
+
+typedef struct log_stats_tag {
+        unsigned long     written;
+        unsigned long     dropped;
+        unsigned long     writes;                       /* writev calls */
+        unsigned long     client_dropped;               /* client not reading */
+} log_stats_t;
+
+void log_start (log_config_t *config);
+void log_stop (void);
+void log_printf (int fd, const char *format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+void log_sync (void);
+int log_client_open (int fd);
+void log_client_close (int client);
+void log_client_printf (int client, int fd, const char *format, ...)
+  __attribute__ ((format (printf, 3, 4)));
+void log_get_stats (log_stats_t *stats);
+int log_overflow_policy (const char *name);
+
+#endif
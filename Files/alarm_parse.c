@@ -0,0 +1,260 @@
+/*
+ * alarm_parse.c
+ *
+ * Single-pass parser for the Alarm> command lines.
+ */
+#include <limits.h>
+#include "errors.h"
+#include "alarm_sched.h"
+#include "alarm_intern.h"
+#include "alarm_parse.h"
+
+// The characters a blank in a scanf format skips
+static int parse_blank (char c)
+{
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'
+          || c == '\v';
+}
+
+static const char *skip_blanks (const char *p, const char *end)
+{
+        while (p < end && parse_blank(*p))
+                p++;
+        return p;
+}
+
+// Returns the position just past "text" if the line has it at "p"
+static const char *match (const char *p, const char *end, const char *text)
+{
+        if (p == NULL)
+                return NULL;
+        for (; *text != '\0'; p++, text++)
+                if (p == end || *p != *text)
+                        return NULL;
+        return p;
+}
+
+// Reads an optionally signed decimal int, after optional blanks (%d)
+static const char *parse_int (const char *p, const char *end, int *value)
+{
+        long long number = 0;
+        const char *digits;
+        int negative = 0;
+
+        if (p == NULL)
+                return NULL;
+        p = skip_blanks(p, end);
+        if (p < end && (*p == '+' || *p == '-'))
+                negative = *p++ == '-';
+        for (digits = p; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+                number = number * 10 + (*p - '0');
+                if (number > (long long)INT_MAX + 1)
+                        return NULL;
+        }
+        if (p == digits)
+                return NULL;
+        if (negative)
+                number = -number;
+        if (number > INT_MAX)
+                return NULL;
+        *value = (int)number;
+        return p;
+}
+
+/*
+ * Reads a decimal number with an optional fraction and exponent,
+ * after optional blanks (%lf, less the hex and inf/nan forms). The
+ * digits are gathered as a whole number and scaled once at the end,
+ * so up to 15 or so significant digits come out exact.
+ */
+static const char *parse_seconds (const char *p, const char *end,
+  double *value)
+{
+        double mantissa = 0, scale = 1;
+        const char *q;
+        int negative = 0, digits = 0, exponent = 0, power = 0, power_negative;
+
+        p = skip_blanks(p, end);
+        if (p < end && (*p == '+' || *p == '-'))
+                negative = *p++ == '-';
+        for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+                mantissa = mantissa * 10 + (*p - '0');
+        if (p < end && *p == '.')
+                for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+                {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        exponent--;
+                }
+        if (digits == 0)
+                return NULL;
+
+        //The exponent only counts if it has digits, as with strtod
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+                q = p + 1;
+                power_negative = 0;
+                if (q < end && (*q == '+' || *q == '-'))
+                        power_negative = *q++ == '-';
+                if (q < end && *q >= '0' && *q <= '9')
+                {
+                        for (; q < end && *q >= '0' && *q <= '9'; q++)
+                                if (power < 1000)
+                                        power = power * 10 + (*q - '0');
+                        exponent += power_negative ? -power : power;
+                        p = q;
+                }
+        }
+
+        for (power = exponent < 0 ? -exponent : exponent; power > 0; power--)
+                scale *= 10;
+        mantissa = exponent < 0 ? mantissa / scale : mantissa * scale;
+        *value = negative ? -mantissa : mantissa;
+        return p;
+}
+
+/*
+ * Reads the "-<last>)" that ends a range, after blanks, once the first
+ * number is in "range". Returns the position past the ")" or NULL.
+ */
+static const char *parse_range_end (const char *p, const char *end,
+  parse_range_t *range)
+{
+        if (p != NULL)
+                p = skip_blanks(p, end);
+        p = parse_int(match(p, end, "-"), end, &range->last);
+        if (p != NULL)
+                p = skip_blanks(p, end);
+        p = match(p, end, ")");
+        if (p == NULL || range->first > range->last)
+                return NULL;
+        return p;
+}
+
+/*
+ * Reads the optional "Once" or "Times(<count>)" and "Expires(<seconds>)"
+ * before the message number into the alarm, with the blanks after
+ * them. Returns the position past them, or NULL if one is malformed.
+ */
+static const char *parse_limits (const char *p, const char *end,
+  alarm_t *alarm)
+{
+        const char *q;
+        double ttl;
+
+        if ((q = match(p, end, "Once")) != NULL)
+        {
+                alarm->limit = 1;
+                p = skip_blanks(q, end);
+        }
+        else if ((q = match(p, end, "Times(")) != NULL)
+        {
+                q = parse_int(q, end, &alarm->limit);
+                if (q != NULL)
+                        q = skip_blanks(q, end);
+                q = match(q, end, ")");
+                if (q == NULL || alarm->limit <= 0)
+                        return NULL;
+                p = skip_blanks(q, end);
+        }
+        if ((q = match(p, end, "Expires(")) != NULL)
+        {
+                q = parse_seconds(q, end, &ttl);
+                if (q != NULL)
+                        q = skip_blanks(q, end);
+                q = match(q, end, ")");
+                if (q == NULL || !(ttl > 0 && ttl <= SCHED_MAX_SECONDS))
+                        return NULL;
+                alarm->expires = (uint64_t)(ttl * 1e9 + 0.5);
+                p = skip_blanks(q, end);
+        }
+        return p;
+}
+
+/*
+ * Parses one command from "line" up to "end" (or the first newline)
+ * into the alarm. Returns PARSE_ALARM or PARSE_CANCEL with the alarm
+ * filled in, PARSE_LIST or PARSE_CANCEL_RANGE with the range filled
+ * in, PARSE_STATS, or PARSE_BAD if the line is in none of the formats
+ * or asks for an impossible period or an empty range.
+ */
+int parse_command (const char *line, const char *end, alarm_t *alarm,
+  parse_range_t *range)
+{
+        const char *p, *message;
+        double seconds;
+        size_t length;
+
+        p = match(line, end, "Stats");
+        if (p != NULL && skip_blanks(p, end) == end)
+                return PARSE_STATS;
+
+        p = match(line, end, "List");
+        if (p != NULL)
+        {
+                p = skip_blanks(p, end);
+                if (p == end)
+                {
+                        range->first = INT_MIN;
+                        range->last = INT_MAX;
+                        return PARSE_LIST;
+                }
+                p = match(p, end, ":");
+                if (p != NULL)
+                        p = skip_blanks(p, end);
+                p = parse_int(match(p, end, "Message("), end, &range->first);
+                range->last = range->first;
+                if (match(p, end, ")") == NULL)
+                        p = parse_range_end(p, end, range);
+                return p != NULL ? PARSE_LIST : PARSE_BAD;
+        }
+
+        p = parse_seconds(line, end, &seconds);
+        alarm->seconds = seconds;
+        alarm->limit = 0;
+        alarm->expires = 0;
+        if (p != NULL)
+                p = skip_blanks(p, end);
+        p = parse_limits(p, end, alarm);
+        p = parse_int(match(p, end, "Message("), end, &alarm->messageNum);
+        p = match(p, end, ")");
+        if (p != NULL)
+                p = skip_blanks(p, end);
+        if (p != NULL && p < end)
+        {
+                for (message = p; p < end && *p != '\n'; p++)
+                        ;
+                length = p - message;
+                if (length > 0 && message[length - 1] == '\r')
+                        length--;
+                if (length > ALARM_MESSAGE_MAX)
+                        length = ALARM_MESSAGE_MAX;
+
+                //Negative periods, and ones too long for a nanosecond
+                //count, are refused
+                if (!(seconds >= 0 && seconds <= SCHED_MAX_SECONDS))
+                        return PARSE_BAD;
+                alarm->message = intern_get(message, length);
+                alarm->alarmRequestType = PARSE_ALARM;
+                return PARSE_ALARM;
+        }
+
+        p = match(line, end, "Cancel:");
+        if (p != NULL)
+                p = skip_blanks(p, end);
+        p = parse_int(match(p, end, "Message("), end, &alarm->messageNum);
+        if (p != NULL && match(p, end, ")") == NULL)
+        {
+                range->first = alarm->messageNum;
+                return parse_range_end(p, end, range) != NULL
+                  ? PARSE_CANCEL_RANGE : PARSE_BAD;
+        }
+        if (match(p, end, ")") == NULL)
+                return PARSE_BAD;
+        alarm->seconds = 0;
+        alarm->limit = 0;
+        alarm->expires = 0;
+        alarm->message = intern_empty;
+        alarm->alarmRequestType = PARSE_CANCEL;
+        return PARSE_CANCEL;
+}
@@ -0,0 +1,53 @@
+#ifndef __alarm_parse_h
+#define __alarm_parse_h
+
+#include "alarm.h"
+
+/*
+ * Hand-written parser for the command lines, in one pass over the
+ * text and without allocating. It accepts what the original sscanf
+ * formats did:
+ *
+ *      <seconds> Message(<number>) <message>
+ *      Cancel: Message(<number>)
+ *
+ * with, between the seconds and the message number, an optional
+ * limit on the alarm's displays and an optional time to live:
+ *
+ *      <seconds> [Once | Times(<count>)] [Expires(<seconds>)]
+ *        Message(<number>) <message>
+ *
+ * Such an alarm first shows one period after it is added, and
+ * retires itself after its last display, or once its next one would
+ * come after the time to live, which the alarm's "expires" holds,
+ * in nanoseconds, until the engine takes it in.
+ *
+ * plus "Stats" and the range commands
+ *
+ *      List
+ *      List: Message(<first>-<last>)
+ *      Cancel: Message(<first>-<last>)
+ *
+ * where the range takes in both ends and may be a single number in
+ * a listing. Seconds may have a fraction and an exponent, white
+ * space is optional wherever the formats had a blank, and anything
+ * after the ")" of a cancel is ignored. The message is interned and
+ * cut at ALARM_MESSAGE_MAX characters; the alarm owns the reference
+ * when the result is PARSE_ALARM or PARSE_CANCEL, and has none
+ * otherwise; a range command fills in the range instead.
+ */
+#define PARSE_BAD               -1
+#define PARSE_CANCEL            0                       /* alarmRequestType */
+#define PARSE_ALARM             1
+#define PARSE_STATS             2
+#define PARSE_LIST              3
+#define PARSE_CANCEL_RANGE      4
+
+typedef struct parse_range_tag {
+        int               first, last;                  /* both included */
+} parse_range_t;
+
+int parse_command (const char *line, const char *end, alarm_t *alarm,
+  parse_range_t *range);
+
+#endif
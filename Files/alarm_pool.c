@@ -0,0 +1,114 @@
+/*
+ * alarm_pool.c
+ *
+ * Slab allocator for alarm_t with per-thread caches.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include "errors.h"
+#include "alarm_pool.h"
+
+// A free alarm is reused as the link on the free lists. Nodes start on
+// cache line boundaries, so an alarm's leading fields share one line
+typedef union pool_node_tag {
+        union pool_node_tag       *next;
+        _Alignas(64) alarm_t      alarm;
+} pool_node_t;
+
+// Alarms freed by this thread, handed out again before the shared list
+typedef struct pool_cache_tag {
+        pool_node_t       *nodes[POOL_CACHE_MAX];
+        int               count;
+} pool_cache_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pool_node_t *pool_free_list;                     /* under pool_mutex */
+static size_t pool_slabs;                               /* under pool_mutex */
+static atomic_size_t pool_live;
+static atomic_size_t pool_high_water;
+static _Thread_local pool_cache_t cache;
+
+/*
+ * Moves up to POOL_BATCH alarms from the shared free list into this
+ * thread's cache, first carving a new slab if the list is empty.
+ */
+static void pool_refill (void)
+{
+        pool_node_t *slab;
+        int i;
+
+        pthread_mutex_lock(&pool_mutex);
+        if (pool_free_list == NULL)
+        {
+                slab = (pool_node_t*)aligned_alloc(_Alignof(pool_node_t),
+                  POOL_SLAB_ALARMS * sizeof(pool_node_t));
+                if (slab == NULL)
+                        errno_abort ("Allocate alarm slab");
+                for (i = 0; i < POOL_SLAB_ALARMS - 1; i++)
+                        slab[i].next = &slab[i + 1];
+                slab[POOL_SLAB_ALARMS - 1].next = NULL;
+                pool_free_list = slab;
+                pool_slabs++;
+        }
+        while (cache.count < POOL_BATCH && pool_free_list != NULL)
+        {
+                cache.nodes[cache.count++] = pool_free_list;
+                pool_free_list = pool_free_list->next;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+}
+
+// Hands half of a full cache back to the shared free list
+static void pool_flush (void)
+{
+        pool_node_t *node;
+
+        pthread_mutex_lock(&pool_mutex);
+        while (cache.count > POOL_CACHE_MAX - POOL_BATCH)
+        {
+                node = cache.nodes[--cache.count];
+                node->next = pool_free_list;
+                pool_free_list = node;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+}
+
+alarm_t *alarm_alloc (void)
+{
+        size_t live, high;
+
+        if (cache.count == 0)
+                pool_refill();
+
+        live = atomic_fetch_add_explicit(&pool_live, 1,
+          memory_order_relaxed) + 1;
+        high = atomic_load_explicit(&pool_high_water, memory_order_relaxed);
+        while (live > high && !atomic_compare_exchange_weak(&pool_high_water,
+          &high, live))
+                ;
+        return &cache.nodes[--cache.count]->alarm;
+}
+
+/*
+ * Returns an alarm to the pool. Takes a void pointer so it can be
+ * given to epoch_retire directly.
+ */
+void alarm_free (void *alarm)
+{
+        if (cache.count == POOL_CACHE_MAX)
+                pool_flush();
+        cache.nodes[cache.count++] = (pool_node_t*)alarm;
+        atomic_fetch_sub_explicit(&pool_live, 1, memory_order_relaxed);
+}
+
+void alarm_pool_stats (alarm_pool_stats_t *stats)
+{
+        pthread_mutex_lock(&pool_mutex);
+        stats->slabs = pool_slabs;
+        pthread_mutex_unlock(&pool_mutex);
+        stats->live = atomic_load(&pool_live);
+        stats->high_water = atomic_load(&pool_high_water);
+        //Everything carved and not live is on a free list or in a cache
+        stats->free = stats->slabs * POOL_SLAB_ALARMS > stats->live
+          ? stats->slabs * POOL_SLAB_ALARMS - stats->live : 0;
+}
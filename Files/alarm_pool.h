@@ -0,0 +1,29 @@
+#ifndef __alarm_pool_h
+#define __alarm_pool_h
+
+#include <stddef.h>
+#include "alarm.h"
+
+/*
+ * Fixed-size pool for alarm_t. Alarms are carved out of slabs of
+ * POOL_SLAB_ALARMS at a time and never handed back to malloc: a
+ * freed alarm goes into a small cache owned by the freeing thread,
+ * and whole batches move between those caches and a shared free list,
+ * so a steady add/cancel workload reuses the same memory.
+ */
+#define POOL_SLAB_ALARMS        256
+#define POOL_CACHE_MAX          64
+#define POOL_BATCH              32
+
+typedef struct alarm_pool_stats_tag {
+        size_t            live;                         /* allocated now */
+        size_t            free;                         /* ready for reuse */
+        size_t            high_water;                   /* most ever live */
+        size_t            slabs;
+} alarm_pool_stats_t;
+
+alarm_t *alarm_alloc (void);
+void alarm_free (void *alarm);
+void alarm_pool_stats (alarm_pool_stats_t *stats);
+
+#endif
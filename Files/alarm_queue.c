@@ -0,0 +1,90 @@
+/*
+ * alarm_queue.c
+ *
+ * Request queue between the threads that take commands and the
+ * alarm thread. This is the usual intrusive MPSC list with a stub
+ * node: a push is one atomic exchange and one store.
+ */
+#include <sched.h>
+#include "errors.h"
+#include "alarm_queue.h"
+
+void queue_init (alarm_queue_t *queue)
+{
+        atomic_store(&queue->stub.next, NULL);
+        atomic_store(&queue->back, &queue->stub);
+        queue->front = &queue->stub;
+        if (sem_init(&queue->items, 0, 0) != 0)
+                errno_abort ("Init request queue");
+}
+
+static void queue_link (alarm_queue_t *queue, queue_node_t *node)
+{
+        queue_node_t *prev;
+
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        prev = atomic_exchange_explicit(&queue->back, node,
+          memory_order_acq_rel);
+        atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/*
+ * Adds a request at the back of the queue and wakes the consumer.
+ */
+void queue_push (alarm_queue_t *queue, queue_node_t *node)
+{
+        queue_link(queue, node);
+        sem_post(&queue->items);
+}
+
+/*
+ * Takes the request off the front, or returns NULL if the producer
+ * that pushed it has not finished linking it in yet.
+ */
+static queue_node_t *queue_try_pop (alarm_queue_t *queue)
+{
+        queue_node_t *front = queue->front;
+        queue_node_t *next;
+
+        next = atomic_load_explicit(&front->next, memory_order_acquire);
+        //Steps over the stub node
+        if (front == &queue->stub)
+        {
+                if (next == NULL)
+                        return NULL;
+                queue->front = front = next;
+                next = atomic_load_explicit(&front->next, memory_order_acquire);
+        }
+        if (next != NULL)
+        {
+                queue->front = next;
+                return front;
+        }
+        //"front" is the last node; put the stub behind it so it can go
+        if (front != atomic_load_explicit(&queue->back, memory_order_acquire))
+                return NULL;
+        queue_link(queue, &queue->stub);
+        next = atomic_load_explicit(&front->next, memory_order_acquire);
+        if (next == NULL)
+                return NULL;
+        queue->front = next;
+        return front;
+}
+
+/*
+ * Waits for the next request and takes it off the queue. Only the
+ * consumer thread may call this.
+ */
+queue_node_t *queue_pop (alarm_queue_t *queue)
+{
+        queue_node_t *node;
+
+        while (sem_wait(&queue->items) != 0)
+                if (errno != EINTR)
+                        errno_abort ("Wait for request");
+        //The semaphore says a push has started; it may take a moment for
+        //the producer to store the link that makes it visible
+        while ((node = queue_try_pop(queue)) == NULL)
+                sched_yield();
+        return node;
+}
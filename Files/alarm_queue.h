@@ -0,0 +1,29 @@
+#ifndef __alarm_queue_h
+#define __alarm_queue_h
+
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/*
+ * Intrusive multi-producer, single-consumer queue of requests for
+ * the alarm thread. Any thread can push without taking a lock; only
+ * the alarm thread pops, and it sleeps on the "items" semaphore while
+ * the queue is empty instead of polling. Requests come out in the
+ * order they were pushed.
+ */
+typedef struct queue_node_tag {
+        _Atomic(struct queue_node_tag *) next;
+} queue_node_t;
+
+typedef struct alarm_queue_tag {
+        _Atomic(queue_node_t *)  back;                  /* producers push here */
+        queue_node_t             *front;                /* consumer pops here */
+        queue_node_t             stub;
+        sem_t                    items;
+} alarm_queue_t;
+
+void queue_init (alarm_queue_t *queue);
+void queue_push (alarm_queue_t *queue, queue_node_t *node);
+queue_node_t *queue_pop (alarm_queue_t *queue);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * alarm_rwlock.c
+ *
+ * The reader/writer lock policies described in alarm_rwlock.h.
+ */
+#include <sched.h>
+#include "errors.h"
+#include "alarm_rwlock.h"
+
+#if RWLOCK_POLICY == RWLOCK_READER_PREF
+
+void rwlock_init (alarm_rwlock_t *lock)
+{
+        lock->counter = 0;
+        //Semaphores start at 1 so the first sem_wait on each succeeds
+        sem_init(&lock->alarm_mutex1, 0, 1);
+        sem_init(&lock->alarm_cond1, 0, 1);
+}
+
+void rwlock_read_lock (alarm_rwlock_t *lock)
+{
+        //aquire
+        sem_wait(&lock->alarm_mutex1);
+        //The first reader in locks out the writers
+        lock->counter = lock->counter + 1;
+        if (lock->counter == 1)
+                sem_wait(&lock->alarm_cond1);
+        //release
+        sem_post(&lock->alarm_mutex1);
+}
+
+void rwlock_read_unlock (alarm_rwlock_t *lock)
+{
+        //aquire
+        sem_wait(&lock->alarm_mutex1);
+        //The last reader out lets the writers back in
+        lock->counter = lock->counter - 1;
+        if (lock->counter == 0)
+                sem_post(&lock->alarm_cond1);
+        //release
+        sem_post(&lock->alarm_mutex1);
+}
+
+void rwlock_write_lock (alarm_rwlock_t *lock)
+{
+        sem_wait(&lock->alarm_cond1);
+}
+
+void rwlock_write_unlock (alarm_rwlock_t *lock)
+{
+        sem_post(&lock->alarm_cond1);
+}
+
+#elif RWLOCK_POLICY == RWLOCK_PHASE_FAIR
+
+/*
+ * Phase-fair ticket lock (Brandenburg and Anderson's PF-T). "rin"
+ * counts readers in steps of RINC; its low bits hold PRES while a
+ * writer is present and the writer's phase bit, which is what lets
+ * blocked readers tell one write phase from the next.
+ */
+#define RINC    0x100u
+#define WBITS   0x3u
+#define PRES    0x2u
+#define PHID    0x1u
+
+// Spins a little, then gives the processor to whoever holds the lock
+static void rwlock_pause (int *spins)
+{
+        if (++*spins > 64)
+                sched_yield();
+}
+
+void rwlock_init (alarm_rwlock_t *lock)
+{
+        atomic_init(&lock->rin, 0);
+        atomic_init(&lock->rout, 0);
+        atomic_init(&lock->win, 0);
+        atomic_init(&lock->wout, 0);
+}
+
+void rwlock_read_lock (alarm_rwlock_t *lock)
+{
+        unsigned w;
+        int spins = 0;
+
+        //Waits out the write phase that was current on arrival, only
+        w = atomic_fetch_add(&lock->rin, RINC) & WBITS;
+        if (w != 0)
+                while (w == (atomic_load(&lock->rin) & WBITS))
+                        rwlock_pause(&spins);
+}
+
+void rwlock_read_unlock (alarm_rwlock_t *lock)
+{
+        atomic_fetch_add(&lock->rout, RINC);
+}
+
+void rwlock_write_lock (alarm_rwlock_t *lock)
+{
+        unsigned ticket, readers;
+        int spins = 0;
+
+        //Writers queue among themselves in ticket order
+        ticket = atomic_fetch_add(&lock->win, 1);
+        while (ticket != atomic_load(&lock->wout))
+                rwlock_pause(&spins);
+        //Closes the read phase, then waits for the readers already in
+        readers = atomic_fetch_add(&lock->rin, PRES | (ticket & PHID));
+        while (readers != atomic_load(&lock->rout))
+                rwlock_pause(&spins);
+}
+
+void rwlock_write_unlock (alarm_rwlock_t *lock)
+{
+        atomic_fetch_and(&lock->rin, ~WBITS);
+        atomic_fetch_add(&lock->wout, 1);
+}
+
+#else
+
+void rwlock_init (alarm_rwlock_t *lock)
+{
+        pthread_mutex_init(&lock->mutex, NULL);
+        pthread_cond_init(&lock->readers_ok, NULL);
+        pthread_cond_init(&lock->writers_ok, NULL);
+        lock->readers = lock->writer = lock->writers_waiting = 0;
+        lock->next_ticket = lock->serving = 0;
+}
+
+#if RWLOCK_POLICY == RWLOCK_TASK_FAIR
+
+/*
+ * Every thread takes a ticket and waits for its turn. A reader's
+ * turn ends as soon as it is in, so readers queued back to back
+ * share the lock; a writer's lasts until the readers ahead drain.
+ */
+void rwlock_read_lock (alarm_rwlock_t *lock)
+{
+        unsigned ticket;
+
+        pthread_mutex_lock(&lock->mutex);
+        ticket = lock->next_ticket++;
+        while (ticket != lock->serving || lock->writer)
+                pthread_cond_wait(&lock->readers_ok, &lock->mutex);
+        lock->readers++;
+        lock->serving++;
+        pthread_cond_broadcast(&lock->readers_ok);
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_read_unlock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        if (--lock->readers == 0)
+                pthread_cond_broadcast(&lock->readers_ok);
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_write_lock (alarm_rwlock_t *lock)
+{
+        unsigned ticket;
+
+        pthread_mutex_lock(&lock->mutex);
+        ticket = lock->next_ticket++;
+        while (ticket != lock->serving || lock->writer || lock->readers)
+                pthread_cond_wait(&lock->readers_ok, &lock->mutex);
+        lock->writer = 1;
+        lock->serving++;
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_write_unlock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        lock->writer = 0;
+        pthread_cond_broadcast(&lock->readers_ok);
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+#else /* RWLOCK_WRITER_PREF */
+
+void rwlock_read_lock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        //New readers stay out while a writer holds or waits for the lock
+        while (lock->writer || lock->writers_waiting)
+                pthread_cond_wait(&lock->readers_ok, &lock->mutex);
+        lock->readers++;
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_read_unlock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        if (--lock->readers == 0 && lock->writers_waiting)
+                pthread_cond_signal(&lock->writers_ok);
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_write_lock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        lock->writers_waiting++;
+        while (lock->writer || lock->readers)
+                pthread_cond_wait(&lock->writers_ok, &lock->mutex);
+        lock->writers_waiting--;
+        lock->writer = 1;
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+void rwlock_write_unlock (alarm_rwlock_t *lock)
+{
+        pthread_mutex_lock(&lock->mutex);
+        lock->writer = 0;
+        //Hands the lock to the next writer, or to all waiting readers
+        if (lock->writers_waiting)
+                pthread_cond_signal(&lock->writers_ok);
+        else
+                pthread_cond_broadcast(&lock->readers_ok);
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+#endif
+#endif
+
+const char *rwlock_policy_name (void)
+{
+#if RWLOCK_POLICY == RWLOCK_READER_PREF
+        return "reader-pref";
+#elif RWLOCK_POLICY == RWLOCK_WRITER_PREF
+        return "writer-pref";
+#elif RWLOCK_POLICY == RWLOCK_TASK_FAIR
+        return "task-fair";
+#else
+        return "phase-fair";
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef __alarm_rwlock_h
+#define __alarm_rwlock_h
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/*
+ * Reader/writer lock around the alarm list. The policy is picked at
+ * build time with -DRWLOCK_POLICY=...:
+ *
+ *  RWLOCK_READER_PREF  the original counter + two semaphores. Readers
+ *                      that keep overlapping can starve a writer.
+ *  RWLOCK_WRITER_PREF  a waiting writer holds back new readers.
+ *  RWLOCK_TASK_FAIR    readers and writers get in in arrival order;
+ *                      consecutive readers share the lock.
+ *  RWLOCK_PHASE_FAIR   read and write phases alternate whenever both
+ *                      are waiting, so neither side waits for more
+ *                      than one phase of the other (spinning ticket
+ *                      lock, for short critical sections).
+ */
+#define RWLOCK_READER_PREF      0
+#define RWLOCK_WRITER_PREF      1
+#define RWLOCK_TASK_FAIR        2
+#define RWLOCK_PHASE_FAIR       3
+
+#ifndef RWLOCK_POLICY
+# define RWLOCK_POLICY RWLOCK_WRITER_PREF
+#endif
+
+typedef struct alarm_rwlock_tag {
+#if RWLOCK_POLICY == RWLOCK_READER_PREF
+        // Keeps track of threads using the list
+        int               counter;
+        sem_t             alarm_mutex1;                 /* guards counter */
+        sem_t             alarm_cond1;                  /* held by writer */
+#elif RWLOCK_POLICY == RWLOCK_PHASE_FAIR
+        atomic_uint       rin;                          /* readers in, phase */
+        atomic_uint       rout;                         /* readers out */
+        atomic_uint       win;                          /* writer tickets */
+        atomic_uint       wout;                         /* writer served */
+#else
+        pthread_mutex_t   mutex;
+        pthread_cond_t    readers_ok;
+        pthread_cond_t    writers_ok;
+        int               readers;                      /* holding the lock */
+        int               writer;                       /* 1 if held to write */
+        int               writers_waiting;
+        unsigned          next_ticket;                  /* task fair only */
+        unsigned          serving;
+#endif
+} alarm_rwlock_t;
+
+void rwlock_init (alarm_rwlock_t *lock);
+void rwlock_read_lock (alarm_rwlock_t *lock);
+void rwlock_read_unlock (alarm_rwlock_t *lock);
+void rwlock_write_lock (alarm_rwlock_t *lock);
+void rwlock_write_unlock (alarm_rwlock_t *lock);
+const char *rwlock_policy_name (void);
+
+#endif
@@ -0,0 +1,504 @@
+/*
+ * alarm_sched.c
+ *
+ * Timing wheel scheduler and the dispatcher threads that run it.
+ * Times are nanoseconds on the alarm clock (alarm_clock.h); one wheel
+ * tick is SCHED_TICK_NS of them. Each alarm keeps its exact deadline
+ * and sits on the wheel in the first tick that starts at or after
+ * it, so it never fires early and is never more than a tick late.
+ */
+#define _GNU_SOURCE                                     /* for CPU affinity */
+#include <stddef.h>
+#include <sched.h>
+#include "errors.h"
+//Linux scheduling policies, unused here, named like two of ours
+#undef SCHED_BATCH
+#undef SCHED_IDLE
+#include "alarm_clock.h"
+#include "alarm_sched.h"
+#include "alarm_stats.h"
+
+// Recovers the alarm from the wheel timer embedded in it
+#define timer_alarm(t) ((alarm_t*)((char*)(t) - offsetof(alarm_t, timer)))
+
+uint64_t sched_now (void)
+{
+        return clock_now();
+}
+
+// Puts the alarm on the wheel in the tick that covers its deadline
+static void sched_place (alarm_sched_t *sched, alarm_t *alarm)
+{
+        alarm->timer.expires = (alarm->deadline + SCHED_TICK_NS - 1)
+          / SCHED_TICK_NS;
+        wheel_add(&sched->wheel, &alarm->timer);
+        alarm->schedState = SCHED_WAITING;
+}
+
+// Makes the alarm due now, so the next free dispatcher fires it
+static void sched_ready (alarm_sched_t *sched, alarm_t *alarm)
+{
+        alarm->deadline = sched_now();
+        timer_list_append(&sched->ready, &alarm->timer);
+        alarm->schedState = SCHED_READY;
+}
+
+// Takes the scheduler mutex, recording how long that took
+static void sched_lock (alarm_sched_t *sched)
+{
+        uint64_t start = stats_clock();
+        int status;
+
+        status = pthread_mutex_lock(&sched->mutex);
+        if (status != 0)
+                err_abort (status, "Lock scheduler");
+        stats_record(STAT_SCHED_WAIT, stats_clock() - start);
+}
+
+/*
+ * Puts a fired alarm back on the wheel one period after the time it
+ * was due, so that slow printing does not push later firings back.
+ * An alarm woken while it was firing is fired again at once, and
+ * its periods start over from then. Called with the scheduler mutex
+ * held.
+ */
+static void sched_rearm (alarm_sched_t *sched, alarm_t *alarm, int64_t period)
+{
+        uint64_t now;
+
+        if (alarm->schedState == SCHED_WOKEN)
+        {
+                sched_ready(sched, alarm);
+                return;
+        }
+
+        //A zero period still waits for the next tick
+        if (period < SCHED_TICK_NS)
+                period = SCHED_TICK_NS;
+        alarm->deadline += period;
+        //Skips any firings that were missed while the alarm was late,
+        //staying on the alarm's own grid of start + N * period
+        now = sched_now();
+        if (alarm->deadline <= now)
+                alarm->deadline += ((now - alarm->deadline) / period + 1)
+                  * period;
+        sched_place(sched, alarm);
+}
+
+// Takes the deque's mutex
+static void worker_lock (sched_worker_t *worker)
+{
+        int status;
+
+        status = pthread_mutex_lock(&worker->mutex);
+        if (status != 0)
+                err_abort (status, "Lock dispatcher deque");
+}
+
+/*
+ * Adds "count" alarms to the back of the worker's deque, leaving
+ * the scheduler's count of queued alarms to the caller.
+ */
+static void worker_append (sched_worker_t *worker, alarm_t **alarms,
+  size_t count)
+{
+        alarm_t **grown;
+        size_t capacity, i;
+
+        worker_lock(worker);
+        if (worker->count + count > worker->capacity)
+        {
+                //Unwraps the deque into one twice the size, or more
+                for (capacity = worker->capacity * 2;
+                  capacity < worker->count + count; capacity *= 2)
+                        ;
+                grown = (alarm_t**)malloc(capacity * sizeof(alarm_t*));
+                if (grown == NULL)
+                        errno_abort ("Grow dispatcher deque");
+                for (i = 0; i < worker->count; i++)
+                        grown[i] = worker->alarms[(worker->head + i)
+                          & (worker->capacity - 1)];
+                free(worker->alarms);
+                worker->alarms = grown;
+                worker->capacity = capacity;
+                worker->head = 0;
+        }
+        for (i = 0; i < count; i++)
+                worker->alarms[(worker->head + worker->count + i)
+                  & (worker->capacity - 1)] = alarms[i];
+        worker->count += count;
+        pthread_mutex_unlock(&worker->mutex);
+}
+
+// Adds "count" newly dealt alarms to the back of the worker's deque
+static void worker_push (sched_worker_t *worker, alarm_t **alarms, size_t count)
+{
+        worker_append(worker, alarms, count);
+        atomic_fetch_add(&worker->sched->queued, count);
+}
+
+// Takes up to "max" alarms off the front of the worker's own deque
+static size_t worker_pop (sched_worker_t *worker, alarm_t **alarms, size_t max)
+{
+        size_t count, i;
+
+        worker_lock(worker);
+        count = worker->count < max ? worker->count : max;
+        for (i = 0; i < count; i++)
+                alarms[i] = worker->alarms[(worker->head + i)
+                  & (worker->capacity - 1)];
+        worker->head = (worker->head + count) & (worker->capacity - 1);
+        worker->count -= count;
+        pthread_mutex_unlock(&worker->mutex);
+        if (count > 0)
+                atomic_fetch_sub(&worker->sched->queued, count);
+        return count;
+}
+
+/*
+ * Takes half the alarms off the back of another dispatcher's deque,
+ * the ones it would have come to last, into the thief's own. Returns
+ * how many it took.
+ */
+static size_t worker_steal (sched_worker_t *thief, sched_worker_t *victim)
+{
+        size_t count, i;
+
+        worker_lock(victim);
+        count = (victim->count + 1) / 2;
+        if (count > SCHED_STEAL_MAX)
+                count = SCHED_STEAL_MAX;
+        for (i = 0; i < count; i++)
+                thief->scratch[i] = victim->alarms[(victim->head
+                  + victim->count - count + i) & (victim->capacity - 1)];
+        victim->count -= count;
+        pthread_mutex_unlock(&victim->mutex);
+        if (count == 0)
+                return 0;
+        //Still counted in queued while they move, so no dispatcher
+        //sleeps on them
+        worker_append(thief, thief->scratch, count);
+        return count;
+}
+
+/*
+ * Fills "batch" from the worker's own deque, or failing that from a
+ * steal, trying the others in turn from the next one along. Returns
+ * how many alarms it found.
+ */
+static size_t worker_take (sched_worker_t *worker, alarm_t **batch)
+{
+        alarm_sched_t *sched = worker->sched;
+        size_t count;
+        int i;
+
+        count = worker_pop(worker, batch, SCHED_FIRE_BATCH);
+        if (count > 0)
+                return count;
+        for (i = 1; i < sched->nthreads
+          && atomic_load(&sched->queued) > 0; i++)
+        {
+                if (worker_steal(worker, &sched->workers[(worker->index + i)
+                  % sched->nthreads]) > 0)
+                {
+                        stats_count(STAT_STEALS, 1);
+                        return worker_pop(worker, batch, SCHED_FIRE_BATCH);
+                }
+        }
+        return 0;
+}
+
+/*
+ * Deals the ready list out to the deques, SCHED_SPREAD alarms to a
+ * dispatcher at a time, one round of the pool starting with the
+ * caller, and wakes the pool if that gave the others any. What is
+ * left on the ready list is dealt by the next dispatcher to run out,
+ * so no one holds the scheduler for long however big the burst.
+ * Called with the scheduler mutex held.
+ */
+static void sched_spread (alarm_sched_t *sched, sched_worker_t *worker)
+{
+        wheel_timer_t *timer;
+        alarm_t *alarm;
+        size_t count;
+        int round;
+
+        for (round = 0; round < sched->nthreads; round++)
+        {
+                for (count = 0; count < SCHED_SPREAD
+                  && (timer = timer_list_pop(&sched->ready)) != NULL;
+                  count++)
+                {
+                        //Dealt is as good as firing: sched_wake leaves it
+                        //there and sched_rearm sees the wake afterwards
+                        alarm = timer_alarm(timer);
+                        alarm->schedState = SCHED_FIRING;
+                        worker->scratch[count] = alarm;
+                }
+                if (count == 0)
+                        break;
+                worker_push(&sched->workers[(worker->index + round)
+                  % sched->nthreads], worker->scratch, count);
+        }
+        if (round > 1 || !timer_list_empty(&sched->ready))
+                pthread_cond_broadcast(&sched->cond);
+}
+
+/*
+ * Pins the calling dispatcher to the index'th of the CPUs the process
+ * may run on, wrapping round when there are more dispatchers than
+ * CPUs. Does nothing if the CPUs cannot be had.
+ */
+static void sched_pin (int index)
+{
+        cpu_set_t allowed, one;
+        int cpu, seen = 0;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0
+          || CPU_COUNT(&allowed) == 0)
+                return;
+        index %= CPU_COUNT(&allowed);
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &allowed) && seen++ == index)
+                        break;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+}
+
+/*
+ * Waits for something to fire: deals out the ready list if anything
+ * is on it, otherwise brings the wheel up to the current time and
+ * deals out what came due, and otherwise sleeps until the next tick
+ * that has something on it, a new alarm is added or alarms are dealt.
+ */
+static void sched_idle (alarm_sched_t *sched, sched_worker_t *worker)
+{
+        uint64_t next, now;
+        int status;
+
+        sched_lock(sched);
+        now = sched_now() / SCHED_TICK_NS;
+        if (timer_list_empty(&sched->ready) && now > sched->wheel.now)
+                wheel_advance(&sched->wheel, now, &sched->ready);
+        if (!timer_list_empty(&sched->ready))
+                sched_spread(sched, worker);
+        //Dealt out since the deques were looked at, or just now
+        else if (atomic_load(&sched->queued) == 0)
+        {
+                //The next tick to run starts at the end of this one
+                next = wheel_next(&sched->wheel);
+                if (next != UINT64_MAX)
+                        next = (sched->wheel.now + next) * SCHED_TICK_NS;
+                status = clock_wait(&sched->cond, &sched->mutex, next);
+                if (status != 0 && status != ETIMEDOUT)
+                        err_abort (status, "Wait on scheduler");
+        }
+        pthread_mutex_unlock(&sched->mutex);
+}
+
+/*
+ * The dispatcher threads' start routine. Each thread fires a batch
+ * of alarms from its deque, or stolen from another's, without holding
+ * the scheduler, then puts the periodic ones back on the wheel with
+ * one hold of it. With none to be had it goes to sched_idle.
+ */
+static void *dispatcher_thread (void *arg)
+{
+        sched_worker_t *worker = (sched_worker_t*)arg;
+        alarm_sched_t *sched = worker->sched;
+        alarm_t *batch[SCHED_FIRE_BATCH];
+        int64_t periods[SCHED_FIRE_BATCH];
+        size_t count, i;
+
+        if (sched->pin)
+                sched_pin(worker->index);
+        while (1)
+        {
+                count = worker_take(worker, batch);
+                if (count == 0)
+                {
+                        sched_idle(sched, worker);
+                        continue;
+                }
+                for (i = 0; i < count; i++)
+                        periods[i] = sched->fire(batch[i]);
+                sched_lock(sched);
+                //A dropped alarm may already be gone
+                for (i = 0; i < count; i++)
+                        if (periods[i] >= 0)
+                                sched_rearm(sched, batch[i], periods[i]);
+                //Alarms woken while firing are on the ready list
+                if (!timer_list_empty(&sched->ready))
+                        pthread_cond_signal(&sched->cond);
+                pthread_mutex_unlock(&sched->mutex);
+        }
+        return NULL;
+}
+
+/*
+ * Starts the dispatcher pool. "fire" is called for each alarm as it
+ * comes due, from one of the dispatcher threads. With "pin", each
+ * dispatcher is kept to a CPU of its own where there are enough. With
+ * no threads the alarms only fire when sched_run is called.
+ */
+void sched_start (alarm_sched_t *sched, int nthreads, int pin,
+  sched_fire_t fire)
+{
+        sched_worker_t *worker;
+        int status, i;
+
+        pthread_mutex_init(&sched->mutex, NULL);
+        //Timed waits are on the same clock as the deadlines
+        clock_cond_init(&sched->cond);
+        wheel_init(&sched->wheel, sched_now() / SCHED_TICK_NS);
+        timer_list_init(&sched->ready);
+        sched->fire = fire;
+        sched->nthreads = nthreads;
+        sched->pin = pin;
+        atomic_init(&sched->queued, 0);
+        sched->workers = NULL;
+        if (nthreads > 0)
+        {
+                sched->workers = (sched_worker_t*)aligned_alloc(
+                  _Alignof(sched_worker_t), nthreads * sizeof(sched_worker_t));
+                if (sched->workers == NULL)
+                        errno_abort ("Allocate dispatchers");
+        }
+
+        for (i = 0; i < nthreads; i++)
+        {
+                worker = &sched->workers[i];
+                pthread_mutex_init(&worker->mutex, NULL);
+                worker->capacity = SCHED_SPREAD * 4;
+                worker->alarms = (alarm_t**)malloc(worker->capacity
+                  * sizeof(alarm_t*));
+                worker->scratch = (alarm_t**)malloc(SCHED_STEAL_MAX
+                  * sizeof(alarm_t*));
+                if (worker->alarms == NULL || worker->scratch == NULL)
+                        errno_abort ("Allocate dispatcher deque");
+                worker->head = worker->count = 0;
+                worker->sched = sched;
+                worker->index = i;
+        }
+        for (i = 0; i < nthreads; i++)
+        {
+                status = pthread_create(&sched->workers[i].thread, NULL,
+                  dispatcher_thread, &sched->workers[i]);
+                if (status != 0)
+                        err_abort (status, "Create dispatcher thread");
+        }
+}
+
+/*
+ * Fires, in the calling thread, every alarm due up to "until", a tick
+ * at a time, moving the virtual clock on to each tick as it is run
+ * and to "until" at the end. Ticks with nothing to run are jumped
+ * over, so this takes as long as the firing does and not the time it
+ * covers. For the virtual clock, with no dispatcher threads.
+ */
+void sched_run (alarm_sched_t *sched, uint64_t until)
+{
+        wheel_timer_t *timer;
+        alarm_t *alarm;
+        uint64_t next, last = until / SCHED_TICK_NS;
+        int64_t period;
+
+        sched_lock(sched);
+        while (1)
+        {
+                timer = timer_list_pop(&sched->ready);
+                if (timer != NULL)
+                {
+                        alarm = timer_alarm(timer);
+                        alarm->schedState = SCHED_FIRING;
+                        pthread_mutex_unlock(&sched->mutex);
+                        period = sched->fire(alarm);
+                        sched_lock(sched);
+                        if (period >= 0)
+                                sched_rearm(sched, alarm, period);
+                        continue;
+                }
+
+                //The next tick with something on it, or a cascade to run
+                next = wheel_next(&sched->wheel);
+                if (sched->wheel.now >= last || next == UINT64_MAX
+                  || next > last - sched->wheel.now)
+                        break;
+                next += sched->wheel.now;
+                clock_advance(next * SCHED_TICK_NS);
+                wheel_advance(&sched->wheel, next, &sched->ready);
+        }
+        //Nothing is due in the ticks left before "until"
+        if (sched->wheel.now < last)
+                wheel_advance(&sched->wheel, last, &sched->ready);
+        clock_advance(until);
+        pthread_mutex_unlock(&sched->mutex);
+}
+
+/*
+ * Schedules the alarm to fire "delay" nanoseconds from now, and then
+ * every time the fire routine asks for it again.
+ */
+void sched_add (alarm_sched_t *sched, alarm_t *alarm, int64_t delay)
+{
+        sched_lock(sched);
+        if (delay <= 0)
+                sched_ready(sched, alarm);
+        else
+        {
+                alarm->deadline = sched_now() + delay;
+                sched_place(sched, alarm);
+        }
+        //A sleeping dispatcher may be waiting longer than this alarm
+        pthread_cond_signal(&sched->cond);
+        pthread_mutex_unlock(&sched->mutex);
+}
+
+/*
+ * Schedules "count" alarms at the deadlines already set in them, and
+ * then every time the fire routine asks for them again. Takes the
+ * scheduler once per SCHED_BATCH alarms and wakes the pool once for
+ * each, instead of once per alarm, for loading many alarms at once.
+ */
+void sched_add_batch (alarm_sched_t *sched, alarm_t **alarms, int count)
+{
+        int i, last;
+
+        for (i = 0; i < count; i = last)
+        {
+                last = i + SCHED_BATCH < count ? i + SCHED_BATCH : count;
+                sched_lock(sched);
+                for (; i < last; i++)
+                        sched_place(sched, alarms[i]);
+                pthread_cond_signal(&sched->cond);
+                pthread_mutex_unlock(&sched->mutex);
+        }
+}
+
+/*
+ * Fires the alarm as soon as a dispatcher is free instead of at its
+ * deadline, and then every period from then on. Used when the alarm
+ * has been cancelled or changed, so that shows at once. Does nothing
+ * to an alarm that is not scheduled yet, since that fires as soon as
+ * it is added. The caller must keep the alarm from being freed
+ * meanwhile: either it is still on the list and the caller holds
+ * the lock on its shard, or the caller has been inside an epoch
+ * section since before it was taken off.
+ */
+void sched_wake (alarm_sched_t *sched, alarm_t *alarm)
+{
+        sched_lock(sched);
+        switch (alarm->schedState)
+        {
+        case SCHED_WAITING:
+                wheel_remove(&sched->wheel, &alarm->timer);
+                sched_ready(sched, alarm);
+                pthread_cond_signal(&sched->cond);
+                break;
+        case SCHED_FIRING:
+                alarm->schedState = SCHED_WOKEN;
+                break;
+        }
+        pthread_mutex_unlock(&sched->mutex);
+}
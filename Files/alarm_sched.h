@@ -0,0 +1,93 @@
+#ifndef __alarm_sched_h
+#define __alarm_sched_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include "alarm.h"
+#include "alarm_wheel.h"
+
+/*
+ * Fires one alarm. Returns the period in nanoseconds until the alarm
+ * should fire again, or -1 to drop it from the scheduler.
+ */
+typedef int64_t (*sched_fire_t) (alarm_t *alarm);
+
+struct alarm_sched_tag;
+
+/*
+ * A dispatcher and its deque of due alarms handed out to it. The
+ * owner takes batches off the front; a dispatcher with nothing left
+ * steals half from the back of another's. The deque has a lock of
+ * its own, held only to move alarms in or out.
+ */
+typedef struct sched_worker_tag {
+        _Alignas(64) pthread_mutex_t mutex;
+        alarm_t           **alarms;                     /* circular */
+        size_t            capacity;                     /* power of 2 */
+        size_t            head, count;
+        alarm_t           **scratch;                    /* owner's, SCHED_STEAL_MAX */
+        struct alarm_sched_tag *sched;
+        int               index;
+        pthread_t         thread;
+} sched_worker_t;
+
+/*
+ * The alarm scheduler: a timing wheel of alarms waiting to fire and
+ * a fixed pool of dispatcher threads that share it. Whichever thread
+ * runs out of work advances the wheel and deals the alarms that have
+ * come due out among the dispatchers' deques, a round at a time, so
+ * a burst of alarms due at once is spread over every dispatcher (and,
+ * pinned, every core) instead of being taken one at a time off one
+ * list. Each dispatcher fires its alarms in batches and puts the
+ * periodic ones back on the wheel with one hold of the scheduler per
+ * batch. The number of threads does not depend on the number of
+ * alarms.
+ */
+typedef struct alarm_sched_tag {
+        pthread_mutex_t   mutex;
+        pthread_cond_t    cond;
+        wheel_t           wheel;
+        wheel_timer_t     ready;                        /* due, not handed out */
+        sched_fire_t      fire;
+        int               nthreads;
+        int               pin;                          /* to a CPU each */
+        sched_worker_t    *workers;
+        atomic_size_t     queued;                       /* in the deques */
+} alarm_sched_t;
+
+// Dispatcher threads started when no size is given on the command line
+#define SCHED_DEFAULT_THREADS 4
+// Length of one wheel tick, and so the shortest period, in nanoseconds
+#define SCHED_TICK_NS   1000000
+// Longest period accepted, about 31 years
+#define SCHED_MAX_SECONDS 1e9
+// Alarms sched_add_batch places per hold of the scheduler
+#define SCHED_BATCH     4096
+// Alarms a dispatcher fires between holds of the scheduler
+#define SCHED_FIRE_BATCH 64
+// Due alarms dealt to each dispatcher's deque per round
+#define SCHED_SPREAD    256
+// Most alarms one steal takes
+#define SCHED_STEAL_MAX 4096
+
+/*
+ * Where an alarm is in the scheduler (alarm->schedState). An alarm
+ * counts as firing from when it is dealt to a dispatcher. One woken
+ * while it is firing goes straight back on the ready list instead of
+ * waiting out its period.
+ */
+#define SCHED_IDLE      0                               /* not scheduled */
+#define SCHED_WAITING   1                               /* on the wheel */
+#define SCHED_READY     2                               /* due, not fired */
+#define SCHED_FIRING    3
+#define SCHED_WOKEN     4                               /* firing, woken */
+
+void sched_start (alarm_sched_t *sched, int nthreads, int pin,
+  sched_fire_t fire);
+void sched_add (alarm_sched_t *sched, alarm_t *alarm, int64_t delay);
+void sched_add_batch (alarm_sched_t *sched, alarm_t **alarms, int count);
+void sched_wake (alarm_sched_t *sched, alarm_t *alarm);
+void sched_run (alarm_sched_t *sched, uint64_t until);
+uint64_t sched_now (void);
+
+#endif
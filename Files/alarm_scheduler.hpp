@@ -0,0 +1,471 @@
+#ifndef __alarm_scheduler_hpp
+#define __alarm_scheduler_hpp
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * The alarm engine as a header-only C++ template, for programs that
+ * embed it rather than run New_Alarm_Cond. Everything the engine
+ * keeps in globals is in the AlarmScheduler object, so a program can
+ * run as many as it likes, and a firing calls the handler instead of
+ * writing a line:
+ *
+ *      AlarmScheduler<Payload, Clock, LockPolicy, Index, Handler>
+ *
+ * The alarms behave as the engine's repeating alarms do; its Once,
+ * Times(n) and Expires(s) alarms have no counterpart here. Adding an
+ * alarm fires it at once and then every period, each firing due a
+ * whole period after the one before; adding one whose number is taken
+ * changes its period and payload in place and fires it at once,
+ * reporting the change; cancelling one fires it a last time as gone.
+ * Any number of dispatcher threads take the firings that are due and
+ * call the handler outside the lock, one firing of an alarm at a
+ * time.
+ *
+ * The policies are template parameters, so every call on the hot
+ * path is resolved at compile time:
+ *
+ *      Clock       SteadyClock waits on std::chrono::steady_clock;
+ *                  ManualClock only moves when run_until moves it, for
+ *                  replaying a run as fast as it will go
+ *      LockPolicy  MutexLock, SpinLock, or NullLock when only one
+ *                  thread ever touches the scheduler
+ *      Index       HashIndex or OrderedIndex, which for_each walks in
+ *                  number order
+ *      Handler     anything callable with a const Firing<Payload>&; a
+ *                  plain function pointer by default, or a lambda, or
+ *                  ExecutorHandler to post each firing to an executor
+ */
+namespace alarm_scheduler {
+
+// Results of add and cancel, as alarm.h numbers them
+enum {
+        ADDED = 0,
+        CHANGED = 1,
+        CANCELLED = 2,
+        MISSING = -1,
+        BAD_PERIOD = -2                                 /* refused, as PARSE_BAD */
+};
+
+// Shortest period, one of the engine's wheel ticks, and the longest
+constexpr uint64_t MIN_PERIOD_NS = 1000000;
+constexpr double MAX_SECONDS = 1e9;
+
+// What a firing says, as the engine's events do
+enum FiringKind {
+        DISPLAY,
+        MESSAGE_CHANGED,                                /* first since a change */
+        GONE                                            /* cancelled, last one */
+};
+
+template <class Payload>
+struct Firing {
+        int                             id;
+        FiringKind                      kind;
+        uint64_t                        due;            /* ns on the clock */
+        std::shared_ptr<const Payload>  payload;        /* as of the firing */
+};
+
+// Nanoseconds on std::chrono::steady_clock
+struct SteadyClock {
+        static constexpr bool is_virtual = false;
+
+        uint64_t now () const
+        {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        template <class Condition, class Lock>
+        void wait_until (Condition &condition, Lock &lock, uint64_t deadline)
+          const
+        {
+                uint64_t at = now();
+
+                if (deadline == UINT64_MAX)
+                        condition.wait(lock);
+                else if (deadline > at)
+                        condition.wait_for(lock,
+                          std::chrono::nanoseconds(deadline - at));
+        }
+};
+
+// A clock that stands still between calls to run_until
+struct ManualClock {
+        static constexpr bool is_virtual = true;
+        std::atomic<uint64_t>           time{0};
+
+        uint64_t now () const { return time.load(std::memory_order_acquire); }
+        void set (uint64_t when)
+        {
+                time.store(when, std::memory_order_release);
+        }
+};
+
+struct MutexLock {
+        static constexpr bool threaded = true;
+        std::mutex                      mutex;
+
+        void lock () { mutex.lock(); }
+        void unlock () { mutex.unlock(); }
+};
+
+// For short critical sections on a machine with processors to spare
+struct SpinLock {
+        static constexpr bool threaded = true;
+        std::atomic_flag                flag = ATOMIC_FLAG_INIT;
+
+        void lock ()
+        {
+                while (flag.test_and_set(std::memory_order_acquire))
+                        std::this_thread::yield();
+        }
+        void unlock () { flag.clear(std::memory_order_release); }
+};
+
+// No locking at all: no dispatcher threads, one caller
+struct NullLock {
+        static constexpr bool threaded = false;
+
+        void lock () {}
+        void unlock () {}
+};
+
+struct HashIndex {
+        template <class Value>
+        using map = std::unordered_map<int, Value>;
+};
+
+struct OrderedIndex {
+        template <class Value>
+        using map = std::map<int, Value>;
+};
+
+template <class Payload>
+using FireFunction = void (*) (const Firing<Payload> &firing);
+
+/*
+ * A handler that hands each firing to an executor, anything with a
+ * post(callable), to be run there by "function".
+ */
+template <class Executor, class Function>
+struct ExecutorHandler {
+        Executor                        *executor;
+        Function                        function;
+
+        template <class Payload>
+        void operator() (const Firing<Payload> &firing) const
+        {
+                Function call = function;
+
+                executor->post([call, firing] () { call(firing); });
+        }
+};
+
+template <class Payload, class Clock = SteadyClock,
+  class LockPolicy = MutexLock, class Index = HashIndex,
+  class Handler = FireFunction<Payload>>
+class AlarmScheduler {
+public:
+        typedef Firing<Payload> firing_type;
+
+        explicit AlarmScheduler (Handler handler, Clock *clock = nullptr)
+          : handler_(std::move(handler)), clock_(clock != nullptr ? clock
+          : &own_clock_)
+        {
+        }
+
+        ~AlarmScheduler () { stop(); }
+
+        AlarmScheduler (const AlarmScheduler &) = delete;
+        AlarmScheduler &operator= (const AlarmScheduler &) = delete;
+
+        /*
+         * Adds alarm "id", or changes it if it is there. Returns ADDED
+         * or CHANGED, or BAD_PERIOD for a negative period, one too long
+         * for a nanosecond count, or NaN. A period shorter than
+         * MIN_PERIOD_NS fires every MIN_PERIOD_NS, as the engine's do.
+         */
+        int add (int id, double seconds, Payload payload)
+        {
+                if (!(seconds >= 0 && seconds <= MAX_SECONDS))
+                        return BAD_PERIOD;
+                std::shared_ptr<const Payload> shared =
+                  std::make_shared<const Payload>(std::move(payload));
+                uint64_t period = std::max((uint64_t)(seconds * 1e9 + 0.5),
+                  MIN_PERIOD_NS);
+                std::lock_guard<LockPolicy> guard(lock_);
+                auto found = index_.find(id);
+                std::shared_ptr<entry_t> entry;
+
+                if (found != index_.end())
+                {
+                        entry = found->second;
+                        entry->period = period;
+                        entry->payload = std::move(shared);
+                        entry->changed = true;
+                        fire_now(entry);
+                        return CHANGED;
+                }
+                entry = std::make_shared<entry_t>();
+                entry->id = id;
+                entry->period = period;
+                entry->payload = std::move(shared);
+                index_.emplace(id, entry);
+                fire_now(entry);
+                return ADDED;
+        }
+
+        // Cancels alarm "id". Returns CANCELLED, or MISSING.
+        int cancel (int id)
+        {
+                std::lock_guard<LockPolicy> guard(lock_);
+                auto found = index_.find(id);
+
+                if (found == index_.end())
+                        return MISSING;
+                found->second->live = false;
+                fire_now(found->second);
+                index_.erase(found);
+                return CANCELLED;
+        }
+
+        size_t size ()
+        {
+                std::lock_guard<LockPolicy> guard(lock_);
+
+                return index_.size();
+        }
+
+        /*
+         * Calls visit(id, seconds, payload) for every alarm, under the
+         * lock, in number order with OrderedIndex.
+         */
+        template <class Visit>
+        void for_each (Visit visit)
+        {
+                std::lock_guard<LockPolicy> guard(lock_);
+
+                for (auto &item : index_)
+                        visit(item.first, item.second->period / 1e9,
+                          *item.second->payload);
+        }
+
+        // Starts "threads" dispatchers firing alarms as they come due
+        void start (int threads = 1)
+        {
+                static_assert(LockPolicy::threaded && !Clock::is_virtual,
+                  "dispatchers need a lock and a real clock");
+                running_ = true;
+                for (int i = 0; i < threads; i++)
+                        threads_.emplace_back([this] () { dispatch(); });
+        }
+
+        // Stops the dispatchers, letting the firings in hand finish
+        void stop ()
+        {
+                if (threads_.empty())
+                        return;
+                {
+                        std::lock_guard<LockPolicy> guard(lock_);
+
+                        running_ = false;
+                }
+                wake_.notify_all();
+                for (auto &thread : threads_)
+                        thread.join();
+                threads_.clear();
+        }
+
+        /*
+         * Fires every alarm due up to "until", in the caller's thread,
+         * moving the ManualClock to each due time in turn and then to
+         * "until", as sched_run does for the engine.
+         */
+        void run_until (uint64_t until)
+        {
+                static_assert(Clock::is_virtual,
+                  "run_until is for a ManualClock");
+                firing_t firing;
+
+                while (1)
+                {
+                        {
+                                std::lock_guard<LockPolicy> guard(lock_);
+
+                                if (!take(until, firing))
+                                        break;
+                        }
+                        if (firing.firing.due > clock_->now())
+                                clock_->set(firing.firing.due);
+                        fire(firing);
+                }
+                if (until > clock_->now())
+                        clock_->set(until);
+        }
+
+        Clock &clock () { return *clock_; }
+
+private:
+        struct entry_t {
+                int                             id;
+                uint64_t                        period;         /* ns */
+                std::shared_ptr<const Payload>  payload;
+                uint64_t                        armed = 0;      /* queued item */
+                bool                            live = true;
+                bool                            changed = false;
+                bool                            firing = false;
+                bool                            again = false;  /* while firing */
+        };
+
+        // A firing in the queue; stale once the entry is armed again
+        struct item_t {
+                uint64_t                        due;
+                uint64_t                        sequence;
+                std::shared_ptr<entry_t>        entry;
+
+                bool operator> (const item_t &other) const
+                {
+                        return due != other.due ? due > other.due
+                          : sequence > other.sequence;
+                }
+        };
+
+        struct firing_t {
+                std::shared_ptr<entry_t>        entry;
+                firing_type                     firing;
+        };
+
+        typedef std::priority_queue<item_t, std::vector<item_t>,
+          std::greater<item_t>> queue_t;
+
+        // Queues a firing of the entry, due "due"; called with the lock
+        void arm (const std::shared_ptr<entry_t> &entry, uint64_t due)
+        {
+                bool earliest = queue_.empty() || due < queue_.top().due;
+
+                entry->armed = ++sequence_;
+                queue_.push(item_t{due, entry->armed, entry});
+                if (earliest && LockPolicy::threaded)
+                        wake_.notify_one();
+        }
+
+        // Fires the entry straight away, or as soon as its handler returns
+        void fire_now (const std::shared_ptr<entry_t> &entry)
+        {
+                if (entry->firing)
+                        entry->again = true;
+                else
+                        arm(entry, clock_->now());
+        }
+
+        /*
+         * Takes the next firing due by "until" off the queue, dropping
+         * stale items. Called with the lock; returns false if none is.
+         */
+        bool take (uint64_t until, firing_t &firing)
+        {
+                while (!queue_.empty())
+                {
+                        const item_t &top = queue_.top();
+
+                        if (top.sequence != top.entry->armed)
+                        {
+                                queue_.pop();
+                                continue;
+                        }
+                        if (top.due > until)
+                                return false;
+                        firing.entry = top.entry;
+                        firing.firing.id = top.entry->id;
+                        firing.firing.due = top.due;
+                        firing.firing.payload = top.entry->payload;
+                        firing.firing.kind = !top.entry->live ? GONE
+                          : top.entry->changed ? MESSAGE_CHANGED : DISPLAY;
+                        top.entry->armed = 0;
+                        top.entry->firing = true;
+                        top.entry->changed = false;
+                        queue_.pop();
+                        return true;
+                }
+                return false;
+        }
+
+        // Calls the handler, then queues the alarm's next firing
+        void fire (firing_t &firing)
+        {
+                entry_t *entry = firing.entry.get();
+
+                handler_(firing.firing);
+                std::lock_guard<LockPolicy> guard(lock_);
+
+                entry->firing = false;
+                if (firing.firing.kind == GONE)
+                        return;
+                if (entry->again || !entry->live)
+                {
+                        entry->again = false;
+                        arm(firing.entry, clock_->now());
+                }
+                else
+                        arm(firing.entry, firing.firing.due + entry->period);
+        }
+
+        void dispatch ()
+        {
+                firing_t firing;
+
+                while (1)
+                {
+                        {
+                                std::unique_lock<LockPolicy> guard(lock_);
+
+                                while (running_
+                                  && !take(clock_->now(), firing))
+                                        clock_->wait_until(wake_, guard,
+                                          next_due());
+                                if (!running_)
+                                        return;
+                        }
+                        fire(firing);
+                        firing.entry.reset();
+                        firing.firing.payload.reset();
+                }
+        }
+
+        // When the first live item is due; called with the lock
+        uint64_t next_due ()
+        {
+                while (!queue_.empty()
+                  && queue_.top().sequence != queue_.top().entry->armed)
+                        queue_.pop();
+                return queue_.empty() ? UINT64_MAX : queue_.top().due;
+        }
+
+        Handler                         handler_;
+        Clock                           own_clock_;
+        Clock                           *clock_;
+        LockPolicy                      lock_;
+        std::condition_variable_any     wake_;
+        typename Index::template map<std::shared_ptr<entry_t>> index_;
+        queue_t                         queue_;
+        uint64_t                        sequence_ = 0;
+        bool                            running_ = false;
+        std::vector<std::thread>        threads_;
+};
+
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * alarm_server.c
+ *
+ * The epoll loop behind the Unix-domain socket front end.
+ */
+#define _GNU_SOURCE                                     /* for accept4 */
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "errors.h"
+#include "alarm_log.h"
+#include "alarm_engine.h"
+#include "alarm_server.h"
+
+// Events handled per epoll_wait
+#define SERVER_EVENTS           64
+// Output a client's socket holds
+#define SERVER_SNDBUF           (1 << 20)
+
+typedef struct server_client_tag {
+        int               fd;
+        int               id;                           /* for log_client_* */
+        size_t            used;                         /* bytes in "input" */
+        int               discarding;                   /* line too long */
+        char              input[SERVER_LINE_MAX];
+} server_client_t;
+
+static void server_accept (int epoll_fd, int listen_fd)
+{
+        struct epoll_event event;
+        server_client_t *client;
+        int fd, size = SERVER_SNDBUF;
+
+        /*
+         * The socket never blocks, for the reads here or for the logger,
+         * which writes to it: what a client that stops reading cannot
+         * take is held for it up to a point, then dropped (see
+         * alarm_log.c), and nobody else's output waits on it.
+         */
+        while ((fd = accept4(listen_fd, NULL, NULL,
+          SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+        {
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+                client = (server_client_t*)calloc(1, sizeof(server_client_t));
+                if (client == NULL)
+                        errno_abort ("Allocate client");
+                client->fd = fd;
+                client->id = log_client_open(fd);
+                if (client->id < 0)
+                {
+                        //Too many clients: turn this one away
+                        close(fd);
+                        free(client);
+                        continue;
+                }
+                event.events = EPOLLIN;
+                event.data.ptr = client;
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+                        errno_abort ("Watch client");
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+          && errno != ECONNABORTED)
+                errno_abort ("Accept client");
+}
+
+static void server_close (int epoll_fd, server_client_t *client)
+{
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        //Only once nothing can be written to the socket is it closed, so
+        //its descriptor cannot be reused under a line still on its way
+        log_client_close(client->id);
+        close(client->fd);
+        free(client);
+}
+
+// Runs one complete command line, without its newline
+static void server_command (server_client_t *client, char *line)
+{
+        size_t length = strlen(line);
+
+        if (length > 0 && line[length - 1] == '\r')
+                line[--length] = '\0';
+        if (length == 0)
+                return;
+        if (engine_command(line, client->id) == 0)
+                log_client_printf(client->id, STDOUT_FILENO, "ACK: %s\n",
+                  line);
+}
+
+/*
+ * Reads whatever the client has sent and runs every complete line in
+ * it, keeping a partial line for the next read. Returns 1 when the
+ * client has finished sending and -1 if the connection failed.
+ */
+static int server_read (server_client_t *client)
+{
+        char *line, *newline;
+        ssize_t count;
+
+        while (1)
+        {
+                count = recv(client->fd, client->input + client->used,
+                  sizeof(client->input) - 1 - client->used, MSG_DONTWAIT);
+                if (count == 0)
+                        return 1;
+                if (count < 0)
+                {
+                        if (errno == EINTR)
+                                continue;
+                        return errno == EAGAIN || errno == EWOULDBLOCK
+                          ? 0 : -1;
+                }
+                client->used += count;
+                client->input[client->used] = '\0';
+
+                line = client->input;
+                while ((newline = strchr(line, '\n')) != NULL)
+                {
+                        *newline = '\0';
+                        if (!client->discarding)
+                                server_command(client, line);
+                        client->discarding = 0;
+                        line = newline + 1;
+                }
+                client->used -= line - client->input;
+                memmove(client->input, line, client->used);
+
+                //A line that fills the buffer is thrown away up to its end
+                if (client->used == sizeof(client->input) - 1)
+                {
+                        if (!client->discarding)
+                                log_client_printf(client->id, STDERR_FILENO,
+                                  "ERROR!!! Line Too Long\n");
+                        client->discarding = 1;
+                        client->used = 0;
+                }
+        }
+}
+
+/*
+ * Listens on the Unix-domain socket at "path" and serves clients
+ * until the program is killed. The engine must have been started.
+ */
+void server_run (const char *path)
+{
+        struct sockaddr_un address;
+        struct epoll_event event, events[SERVER_EVENTS];
+        server_client_t *client;
+        int listen_fd, epoll_fd, count, status, i;
+
+        //A client that goes away must not take the program with it when
+        //the logger next writes to its socket
+        signal(SIGPIPE, SIG_IGN);
+
+        if (strlen(path) >= sizeof(address.sun_path))
+        {
+                fprintf(stderr, "Socket path too long: %s\n", path);
+                exit(1);
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path);
+        unlink(path);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+          0);
+        if (listen_fd < 0)
+                errno_abort ("Create socket");
+        if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+                errno_abort ("Bind socket");
+        if (listen(listen_fd, SOMAXCONN) != 0)
+                errno_abort ("Listen on socket");
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0)
+                errno_abort ("Create epoll");
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0)
+                errno_abort ("Watch socket");
+
+        while (1)
+        {
+                count = epoll_wait(epoll_fd, events, SERVER_EVENTS, -1);
+                if (count < 0)
+                {
+                        if (errno == EINTR)
+                                continue;
+                        errno_abort ("Wait for clients");
+                }
+                for (i = 0; i < count; i++)
+                {
+                        client = (server_client_t*)events[i].data.ptr;
+                        if (client == NULL)
+                        {
+                                server_accept(epoll_fd, listen_fd);
+                                continue;
+                        }
+                        //Runs what the client sent before it hung up
+                        status = events[i].events & EPOLLIN
+                          ? server_read(client) : 0;
+                        if (status < 0
+                          || (events[i].events & (EPOLLHUP | EPOLLERR)))
+                                server_close(epoll_fd, client);
+                        //A client that has only shut down its sending side
+                        //still gets the output for its alarms
+                        else if (status > 0)
+                        {
+                                event.events = 0;
+                                event.data.ptr = client;
+                                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd,
+                                  &event);
+                        }
+                }
+        }
+}
@@ -0,0 +1,25 @@
+#ifndef __alarm_server_h
+#define __alarm_server_h
+
+/*
+ * Unix-domain socket front end. Clients connect to the socket and
+ * send the same lines that would be typed at the Alarm> prompt, as
+ * many at a time as they like. Each accepted command is answered
+ * with "ACK: <command>", each rejected one with the usual ERROR
+ * line; a command that has been accepted into the intake ring may
+ * still get an ERROR line once it is applied. All the output about
+ * an alarm (creation, displays, changes, cancellation) goes to the
+ * client that added it.
+ *
+ * One thread serves every client from an epoll loop. Output is
+ * written by the logger, which never waits on a client's socket: a
+ * client that stops reading has its output held for a while and then
+ * loses whole lines, rather than holding up the others. When a
+ * client disconnects its alarms carry on, with their output going to
+ * standard output.
+ */
+#define SERVER_LINE_MAX         4096                    /* longest command */
+
+void server_run (const char *path);
+
+#endif
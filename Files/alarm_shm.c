@@ -0,0 +1,268 @@
+/*
+ * alarm_shm.c
+ *
+ * The shared-memory rings, and the client side of the front end.
+ * This file uses nothing from the engine, so client programs link
+ * it on its own.
+ */
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "alarm_shm.h"
+
+#define shm_cell(cells, size, mask, position) \
+        ((atomic_size_t*)((char*)(cells) + ((position) & (mask)) * (size)))
+
+/*
+ * Claims the cell at the tail for the caller to fill, storing its
+ * position in "position". Returns NULL if the ring is full. Unless
+ * "claim" is NULL, each position is stored there before the caller
+ * tries for it, so that a producer that dies holding a cell can be
+ * found.
+ */
+void *shm_ring_claim (atomic_size_t *tail, void *cells, size_t size,
+  size_t mask, size_t *position, atomic_size_t *claim)
+{
+        atomic_size_t *cell;
+        size_t at, sequence;
+
+        at = atomic_load_explicit(tail, memory_order_relaxed);
+        while (1)
+        {
+                cell = shm_cell(cells, size, mask, at);
+                sequence = atomic_load_explicit(cell, memory_order_acquire);
+                //The cell still holds an entry from the lap before
+                if (sequence < at)
+                        return NULL;
+                if (sequence == at && claim != NULL)
+                        atomic_store(claim, at);
+                if (sequence == at && atomic_compare_exchange_weak_explicit(
+                  tail, &at, at + 1, memory_order_relaxed,
+                  memory_order_relaxed))
+                        break;
+                //Another producer took the cell: try the next one
+                if (sequence > at)
+                        at = atomic_load_explicit(tail, memory_order_relaxed);
+        }
+        *position = at;
+        return cell;
+}
+
+// Makes a claimed cell visible to the consumer
+void shm_ring_publish (void *cell, size_t position)
+{
+        atomic_store_explicit((atomic_size_t*)cell, position + 1,
+          memory_order_release);
+}
+
+// Returns the cell at the head if it has been published, else NULL
+void *shm_ring_peek (atomic_size_t *head, void *cells, size_t size,
+  size_t mask)
+{
+        size_t at = atomic_load_explicit(head, memory_order_relaxed);
+        atomic_size_t *cell = shm_cell(cells, size, mask, at);
+
+        if (atomic_load_explicit(cell, memory_order_acquire) != at + 1)
+                return NULL;
+        return cell;
+}
+
+// Hands the cell at the head back to the producers for their next lap
+void shm_ring_consume (atomic_size_t *head, void *cell, size_t mask)
+{
+        size_t at = atomic_load_explicit(head, memory_order_relaxed);
+
+        atomic_store_explicit((atomic_size_t*)cell, at + mask + 1,
+          memory_order_release);
+        atomic_store_explicit(head, at + 1, memory_order_release);
+}
+
+/*
+ * Wakes the consumer of a ring if it is asleep. Pairs with the fence
+ * in shm_sleep: either the consumer sees what was just published or
+ * the producer sees that it went to sleep.
+ */
+void shm_wake (atomic_int *sleeping, sem_t *wake)
+{
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(sleeping, memory_order_relaxed))
+                sem_post(wake);
+}
+
+// Sleeps until something is put in the ring, unless something is
+void shm_sleep (atomic_int *sleeping, sem_t *wake, atomic_size_t *head,
+  atomic_size_t *tail)
+{
+        atomic_store(sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(head) == atomic_load(tail))
+                while (sem_wait(wake) != 0 && errno == EINTR)
+                        ;
+        atomic_store(sleeping, 0);
+}
+
+/*
+ * Maps the region the server created under "name" and takes a free
+ * client slot, or the slot of a client that died without detaching
+ * once the server has skipped any request it left half made. The
+ * slot is marked SHM_CLAIMING until its pid is in, so that no other
+ * attacher takes it for a dead client's meanwhile. Returns 0, or -1
+ * with errno set.
+ */
+int shm_attach (const char *name, shm_client_t *client)
+{
+        shm_region_t *region;
+        shm_slot_t *slot;
+        const shm_event_t *event;
+        struct stat info;
+        unsigned state;
+        size_t claim;
+        int fd, i;
+
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &info) != 0 || info.st_size != sizeof(shm_region_t))
+        {
+                close(fd);
+                errno = EINVAL;
+                return -1;
+        }
+        region = (shm_region_t*)mmap(NULL, sizeof(shm_region_t),
+          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (region == MAP_FAILED)
+                return -1;
+        if (atomic_load(&region->magic) != SHM_MAGIC)
+        {
+                munmap(region, sizeof(shm_region_t));
+                errno = EAGAIN;
+                return -1;
+        }
+
+        for (i = 0; i < SHM_MAX_CLIENTS; i++)
+        {
+                slot = &region->clients[i];
+                state = atomic_load(&slot->state);
+                claim = atomic_load(&slot->claim);
+                //A cell the server has yet to pass may be the dead one's
+                if ((state & SHM_CLAIMING) || ((state & SHM_ATTACHED)
+                  && ((claim != SHM_NO_CLAIM
+                  && claim >= atomic_load(&region->head))
+                  || !(kill(slot->pid, 0) != 0 && errno == ESRCH))))
+                        continue;
+                if (atomic_compare_exchange_strong(&slot->state, &state,
+                  (state & ~(SHM_ATTACHED | SHM_CLAIMING)) + SHM_GENERATION
+                  + SHM_ATTACHED + SHM_CLAIMING))
+                        break;
+        }
+        if (i == SHM_MAX_CLIENTS)
+        {
+                munmap(region, sizeof(shm_region_t));
+                errno = EBUSY;
+                return -1;
+        }
+        slot->pid = getpid();
+        atomic_store(&slot->claim, SHM_NO_CLAIM);
+        atomic_fetch_and(&slot->state, ~SHM_CLAIMING);
+        atomic_store(&slot->dropped, 0);
+        client->region = region;
+        client->slot = slot;
+        client->index = i;
+        //Events meant for the slot's last client are not this one's
+        while ((event = shm_next_event(client)) != NULL)
+                shm_event_done(client, event);
+        return 0;
+}
+
+// Gives up the slot; the client's alarms carry on without it
+void shm_detach (shm_client_t *client)
+{
+        atomic_fetch_and(&client->slot->state, ~SHM_ATTACHED);
+        munmap(client->region, sizeof(shm_region_t));
+}
+
+/*
+ * Puts a request in the region for the server, with the fields of
+ * the alarm_t the prompt would have made. "tag" comes back in its
+ * SHM_EVENT_DONE. Returns 0, or -1 with errno EAGAIN if the ring is
+ * full, or EINVAL if the message is too long.
+ */
+int shm_submit (shm_client_t *client, int type, int messageNum,
+  double seconds, const char *message, uint64_t tag)
+{
+        return shm_submit_limited(client, type, messageNum, seconds, 0, 0,
+          message, tag);
+}
+
+/*
+ * As shm_submit, for an alarm that retires itself after "limit"
+ * displays, or once "expires" seconds have gone by, as "Times(limit)
+ * Expires(expires)" at the prompt; 0 leaves either out.
+ */
+int shm_submit_limited (shm_client_t *client, int type, int messageNum,
+  double seconds, int limit, double expires, const char *message,
+  uint64_t tag)
+{
+        shm_region_t *region = client->region;
+        shm_request_cell_t *cell;
+        size_t position, length = strlen(message);
+
+        if (length > SHM_MESSAGE_MAX)
+        {
+                errno = EINVAL;
+                return -1;
+        }
+        cell = (shm_request_cell_t*)shm_ring_claim(&region->tail,
+          region->requests, sizeof(shm_request_cell_t), SHM_REQUESTS - 1,
+          &position, &client->slot->claim);
+        if (cell == NULL)
+        {
+                atomic_store(&client->slot->claim, SHM_NO_CLAIM);
+                errno = EAGAIN;
+                return -1;
+        }
+        cell->request.alarmRequestType = type;
+        cell->request.messageNum = messageNum;
+        cell->request.seconds = seconds;
+        cell->request.limit = limit;
+        cell->request.expires = expires;
+        cell->request.tag = tag;
+        cell->request.client = client->index;
+        cell->request.length = length;
+        memcpy(cell->request.message, message, length);
+        shm_ring_publish(cell, position);
+        atomic_store(&client->slot->claim, SHM_NO_CLAIM);
+        shm_wake(&region->sleeping, &region->wake);
+        return 0;
+}
+
+/*
+ * Returns the next event for the client, where it lies in the
+ * region, or NULL if there is none yet. It stays valid until it is
+ * handed back with shm_event_done.
+ */
+const shm_event_t *shm_next_event (shm_client_t *client)
+{
+        shm_event_cell_t *cell;
+
+        cell = (shm_event_cell_t*)shm_ring_peek(&client->slot->head,
+          client->slot->events, sizeof(shm_event_cell_t), SHM_EVENTS - 1);
+        return cell != NULL ? &cell->event : NULL;
+}
+
+void shm_event_done (shm_client_t *client, const shm_event_t *event)
+{
+        shm_ring_consume(&client->slot->head, (char*)event
+          - offsetof(shm_event_cell_t, event), SHM_EVENTS - 1);
+}
+
+// Sleeps until the server puts an event in the client's ring
+void shm_wait (shm_client_t *client)
+{
+        shm_sleep(&client->slot->sleeping, &client->slot->wake,
+          &client->slot->head, &client->slot->tail);
+}
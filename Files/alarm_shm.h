@@ -0,0 +1,158 @@
+#ifndef __alarm_shm_h
+#define __alarm_shm_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+/*
+ * Shared-memory front end, for processes on the same host. The
+ * server creates a POSIX shared memory object holding one ring of
+ * requests that every client puts into and the server takes out of,
+ * and a slot per client with a ring of events going the other way.
+ * A request is a fixed binary record with the fields of alarm_t the
+ * prompt would have parsed, so there is nothing to format or parse,
+ * and no system call on either side while the other is busy: a side
+ * only posts the other's semaphore when it has gone to sleep.
+ *
+ * The rings are arrays of cells with a sequence number each, as in
+ * alarm_intake.c: any number of producers claim cells by moving the
+ * tail on, and the one consumer reads each cell where it lies and
+ * hands it back. The client reads its events in place, straight out
+ * of the shared memory.
+ *
+ * For every request the client gets SHM_EVENT_DONE with its tag and
+ * the ALARM_ result once the request has been applied; the events
+ * about its alarms (created, displayed, changed, cancelled, gone)
+ * may come before or after it. Events for a client whose ring is
+ * full are dropped and counted, as lines are for a socket client
+ * that stops reading, so no client can hold up the dispatchers. The
+ * last quarter of the ring is kept for SHM_EVENT_DONE, so a client
+ * with no more than SHM_EVENTS / 4 requests in flight gets every
+ * answer.
+ *
+ * A client that dies leaves its slot to the next client to attach.
+ * If it dies with a request cell claimed and not yet published, the
+ * server finds the cell in the slot's "claim" once the ring has been
+ * stuck on it for SHM_STALL_MS, and skips it.
+ */
+#define SHM_MAGIC               0x314d48534d524c41ULL   /* "ALRMSHM1" */
+#define SHM_MESSAGE_MAX         224
+#define SHM_REQUESTS            4096                    /* cells, power of 2 */
+#define SHM_EVENTS              1024                    /* per client, power of 2 */
+#define SHM_MAX_CLIENTS         32
+// How long the server waits on an unpublished request before asking whose
+#define SHM_STALL_MS            100
+
+// A slot's state: an attachment count, and what the low bits say
+#define SHM_ATTACHED            1u
+#define SHM_CLAIMING            2u                      /* attacher setting up */
+#define SHM_GENERATION          4u                      /* one attachment */
+// A slot's claim while it has no request cell claimed
+#define SHM_NO_CLAIM            SIZE_MAX
+
+// What an event says
+#define SHM_EVENT_DONE          0                       /* request applied */
+#define SHM_EVENT_CREATED       1                       /* alarm scheduled */
+#define SHM_EVENT_DISPLAY       2
+#define SHM_EVENT_CHANGED       3                       /* displayed, changed */
+#define SHM_EVENT_CANCELLED     4                       /* cancel carried out */
+#define SHM_EVENT_GONE          5                       /* alarm dropped */
+
+// SHM_EVENT_DONE result of a request the server could not take
+#define SHM_INVALID             -16
+
+typedef struct shm_request_tag {
+        int32_t           alarmRequestType;             /* 1 add or change, 0 cancel */
+        int32_t           messageNum;
+        double            seconds;
+        int32_t           limit;                        /* displays, 0 for none */
+        uint32_t          client;                       /* slot, shm_submit sets */
+        double            expires;                      /* time to live, 0 for none */
+        uint64_t          tag;                          /* the client's own */
+        uint32_t          length;                       /* of message */
+        char              message[SHM_MESSAGE_MAX];     /* not terminated */
+} shm_request_t;
+
+typedef struct shm_event_tag {
+        int32_t           kind;                         /* SHM_EVENT_ */
+        int32_t           messageNum;
+        int32_t           result;                       /* ALARM_, for DONE */
+        uint32_t          length;                       /* of message */
+        uint64_t          tag;                          /* the request's, for DONE */
+        double            time;                         /* s, CLOCK_MONOTONIC */
+        char              message[SHM_MESSAGE_MAX];     /* not terminated */
+} shm_event_t;
+
+typedef struct shm_request_cell_tag {
+        atomic_size_t     sequence;
+        shm_request_t     request;
+} shm_request_cell_t;
+
+typedef struct shm_event_cell_tag {
+        atomic_size_t     sequence;
+        shm_event_t       event;
+} shm_event_cell_t;
+
+typedef struct shm_slot_tag {
+        /* Attachment count times SHM_GENERATION, with SHM_ATTACHED set
+         * while a client is attached and SHM_CLAIMING until its pid is
+         * in place */
+        _Alignas(64) atomic_uint  state;
+        int32_t                   pid;
+        atomic_size_t             claim;                /* request cell */
+        atomic_int                sleeping;             /* in shm_wait */
+        sem_t                     wake;
+        atomic_ulong              dropped;              /* events lost */
+        _Alignas(64) atomic_size_t tail;                /* server puts */
+        _Alignas(64) atomic_size_t head;                /* client takes */
+        shm_event_cell_t          events[SHM_EVENTS];
+} shm_slot_t;
+
+typedef struct shm_region_tag {
+        atomic_uint_fast64_t      magic;                /* set once ready */
+        int32_t                   server_pid;
+        atomic_int                sleeping;             /* server idle */
+        sem_t                     wake;
+        _Alignas(64) atomic_size_t tail;                /* clients put */
+        _Alignas(64) atomic_size_t head;                /* server takes */
+        shm_request_cell_t        requests[SHM_REQUESTS];
+        shm_slot_t                clients[SHM_MAX_CLIENTS];
+} shm_region_t;
+
+// A client's attachment to the region
+typedef struct shm_client_tag {
+        shm_region_t      *region;
+        shm_slot_t        *slot;
+        int               index;                        /* of slot */
+} shm_client_t;
+
+/*
+ * The rings, used by both sides. A producer claims a cell, fills it
+ * and publishes it; the consumer peeks at the cell at its head and,
+ * when it is done with it, hands it back.
+ */
+void *shm_ring_claim (atomic_size_t *tail, void *cells, size_t size,
+  size_t mask, size_t *position, atomic_size_t *claim);
+void shm_ring_publish (void *cell, size_t position);
+void *shm_ring_peek (atomic_size_t *head, void *cells, size_t size,
+  size_t mask);
+void shm_ring_consume (atomic_size_t *head, void *cell, size_t mask);
+void shm_wake (atomic_int *sleeping, sem_t *wake);
+void shm_sleep (atomic_int *sleeping, sem_t *wake, atomic_size_t *head,
+  atomic_size_t *tail);
+
+// The client side
+int shm_attach (const char *name, shm_client_t *client);
+void shm_detach (shm_client_t *client);
+int shm_submit (shm_client_t *client, int type, int messageNum,
+  double seconds, const char *message, uint64_t tag);
+int shm_submit_limited (shm_client_t *client, int type, int messageNum,
+  double seconds, int limit, double expires, const char *message,
+  uint64_t tag);
+const shm_event_t *shm_next_event (shm_client_t *client);
+void shm_event_done (shm_client_t *client, const shm_event_t *event);
+void shm_wait (shm_client_t *client);
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * alarm_shm_server.c
+ *
+ * Serving shared-memory clients: the thread that applies their
+ * requests and the hook that sends them their events.
+ */
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+#include "alarm_sched.h"
+#include "alarm_stats.h"
+#include "alarm_engine.h"
+#include "alarm_shm.h"
+#include "alarm_shm_server.h"
+
+// Attachments told apart in a client number
+#define SHM_GENERATIONS         (1 << 20)
+
+// A request taken out of the ring, until its SHM_EVENT_DONE is sent
+typedef struct shm_pending_tag {
+        alarm_t           *alarm;                       /* NULL if invalid */
+        int               slot;
+        int               client;
+        int               messageNum;
+        uint64_t          tag;
+} shm_pending_t;
+
+static shm_region_t *shm_region;
+
+/*
+ * The engine's client number for whoever is attached to "slot" now:
+ * negative, so that the logger writes nothing for it, and different
+ * for each attachment, so that the alarms of a client that has gone
+ * send nothing to the next one in its slot.
+ */
+static int shm_client (int slot)
+{
+        unsigned state = atomic_load(&shm_region->clients[slot].state);
+
+        return -(1 + slot + SHM_MAX_CLIENTS
+          * (int)((state / SHM_GENERATION) % SHM_GENERATIONS));
+}
+
+/*
+ * Puts an event in a client's ring, and wakes the client if it is
+ * waiting for one. Drops it if the client has gone or its ring is
+ * full; events about alarms are dropped once it is three quarters
+ * full, keeping the last quarter for SHM_EVENT_DONE.
+ */
+static void shm_post (int client, int kind, int messageNum, int result,
+  uint64_t tag, double time, const char *message)
+{
+        shm_event_cell_t *cell;
+        shm_slot_t *slot;
+        size_t position, length;
+        int index = (-client - 1) % SHM_MAX_CLIENTS;
+
+        slot = &shm_region->clients[index];
+        if (shm_client(index) != client
+          || !(atomic_load(&slot->state) & SHM_ATTACHED))
+                return;
+        cell = kind != SHM_EVENT_DONE && atomic_load(&slot->tail)
+          - atomic_load(&slot->head) >= SHM_EVENTS / 4 * 3 ? NULL
+          : (shm_event_cell_t*)shm_ring_claim(&slot->tail, slot->events,
+            sizeof(shm_event_cell_t), SHM_EVENTS - 1, &position, NULL);
+        if (cell == NULL)
+        {
+                atomic_fetch_add_explicit(&slot->dropped, 1,
+                  memory_order_relaxed);
+                return;
+        }
+        length = message != NULL ? strlen(message) : 0;
+        if (length > SHM_MESSAGE_MAX)
+                length = SHM_MESSAGE_MAX;
+        cell->event.kind = kind;
+        cell->event.messageNum = messageNum;
+        cell->event.result = result;
+        cell->event.length = length;
+        cell->event.tag = tag;
+        cell->event.time = time;
+        if (length > 0)
+                memcpy(cell->event.message, message, length);
+        shm_ring_publish(cell, position);
+        shm_wake(&slot->sleeping, &slot->wake);
+}
+
+/*
+ * The engine's event hook. Sends a shared-memory client what has
+ * happened to one of its alarms; a display is stamped with the time
+ * it was due.
+ */
+void shm_event (alarm_t *alarm, int event, const char *message)
+{
+        static const int kinds[] = { SHM_EVENT_CREATED, SHM_EVENT_DISPLAY,
+          SHM_EVENT_CHANGED, SHM_EVENT_CANCELLED, SHM_EVENT_GONE };
+        double time;
+
+        if (shm_region == NULL || alarm->client >= 0)
+                return;
+        time = event == ENGINE_EVENT_CREATED || event == ENGINE_EVENT_CANCELLED
+          ? engine_now() : alarm->deadline / 1e9;
+        shm_post(alarm->client, kinds[event], alarm->messageNum, 0, 0, time,
+          message);
+}
+
+/*
+ * Makes an alarm of a request, as parsing the same command would
+ * have. Returns NULL if the request is not one the prompt would take.
+ */
+static alarm_t *shm_request_alarm (shm_request_t *request, int client)
+{
+        alarm_t *alarm;
+
+        if (request->alarmRequestType != 0 && request->alarmRequestType != 1)
+                return NULL;
+        if (request->alarmRequestType == 1 && (request->length == 0
+          || request->length > SHM_MESSAGE_MAX
+          || !(request->seconds >= 0 && request->seconds <= SCHED_MAX_SECONDS)
+          || request->limit < 0 || !(request->expires >= 0
+          && request->expires <= SCHED_MAX_SECONDS)))
+                return NULL;
+        alarm = alarm_alloc();
+        alarm->messageNum = request->messageNum;
+        alarm->alarmRequestType = request->alarmRequestType;
+        alarm->client = client;
+        if (request->alarmRequestType == 1)
+        {
+                alarm->seconds = request->seconds;
+                alarm->limit = request->limit;
+                //A time to live, as the parser leaves it
+                alarm->expires = (uint64_t)(request->expires * 1e9 + 0.5);
+                alarm->message = intern_get(request->message,
+                  request->length);
+        }
+        else
+        {
+                alarm->seconds = 0;
+                alarm->limit = 0;
+                alarm->expires = 0;
+                alarm->message = intern_empty;
+        }
+        return alarm;
+}
+
+/*
+ * Skips the request cell at the head if the client that claimed it
+ * has died before publishing it. Only if some slot's claim is the
+ * cell, and every such slot's client is gone, can no one still be
+ * writing it. Returns 1 if it skipped the cell.
+ */
+static int shm_skip_dead (shm_region_t *region)
+{
+        size_t head = atomic_load(&region->head);
+        shm_slot_t *slot;
+        unsigned state;
+        int i, dead = 0;
+
+        for (i = 0; i < SHM_MAX_CLIENTS; i++)
+        {
+                slot = &region->clients[i];
+                if (atomic_load(&slot->claim) != head)
+                        continue;
+                state = atomic_load(&slot->state);
+                if (!(state & SHM_ATTACHED) || (state & SHM_CLAIMING)
+                  || !(kill(slot->pid, 0) != 0 && errno == ESRCH))
+                        return 0;
+                dead++;
+        }
+        if (dead == 0)
+                return 0;
+        shm_ring_consume(&region->head, &region->requests[head
+          & (SHM_REQUESTS - 1)], SHM_REQUESTS - 1);
+        //Lets the next client have the dead ones' slots
+        for (i = 0; i < SHM_MAX_CLIENTS; i++)
+                if (atomic_load(&region->clients[i].claim) == head)
+                        atomic_store(&region->clients[i].claim,
+                          SHM_NO_CLAIM);
+        return 1;
+}
+
+// Milliseconds on CLOCK_MONOTONIC
+static uint64_t shm_ms (void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The server thread. It takes out whatever requests have built up,
+ * up to SHM_BATCH, applies them as one batch and answers each, and
+ * sleeps once the ring has stayed empty for SHM_SPIN looks. A request
+ * claimed and not published holds up the ring; once it has done so
+ * for SHM_STALL_MS, the thread checks whether its client has died.
+ */
+static void *shm_thread (void *arg)
+{
+        shm_region_t *region = shm_region;
+        shm_request_cell_t *cell;
+        shm_pending_t *pending;
+        alarm_t **batch;
+        int *results, count, applied, idle = 0, i;
+        size_t stalled_at = SHM_NO_CLAIM;
+        uint64_t stalled_since = 0;
+
+        pending = (shm_pending_t*)malloc(SHM_BATCH * sizeof(shm_pending_t));
+        batch = (alarm_t**)malloc(SHM_BATCH * sizeof(alarm_t*));
+        results = (int*)malloc(SHM_BATCH * sizeof(int));
+        if (pending == NULL || batch == NULL || results == NULL)
+                errno_abort ("Allocate shared memory batch");
+        while (1)
+        {
+                for (count = applied = 0; count < SHM_BATCH; count++)
+                {
+                        cell = (shm_request_cell_t*)shm_ring_peek(
+                          &region->head, region->requests,
+                          sizeof(shm_request_cell_t), SHM_REQUESTS - 1);
+                        if (cell == NULL)
+                                break;
+                        pending[count].slot = cell->request.client
+                          % SHM_MAX_CLIENTS;
+                        pending[count].client = shm_client(
+                          pending[count].slot);
+                        pending[count].messageNum = cell->request.messageNum;
+                        pending[count].tag = cell->request.tag;
+                        pending[count].alarm = shm_request_alarm(
+                          &cell->request, pending[count].client);
+                        if (pending[count].alarm != NULL)
+                                batch[applied++] = pending[count].alarm;
+                        shm_ring_consume(&region->head, cell,
+                          SHM_REQUESTS - 1);
+                }
+                if (count == 0 && atomic_load(&region->head)
+                  != atomic_load(&region->tail))
+                {
+                        if (stalled_at != atomic_load(&region->head))
+                        {
+                                stalled_at = atomic_load(&region->head);
+                                stalled_since = shm_ms();
+                        }
+                        else if (shm_ms() - stalled_since >= SHM_STALL_MS
+                          && shm_skip_dead(region))
+                                stats_count(STAT_BAD, 1);
+                        sched_yield();
+                        continue;
+                }
+                if (count == 0)
+                {
+                        if (++idle < SHM_SPIN)
+                                sched_yield();
+                        else
+                        {
+                                shm_sleep(&region->sleeping, &region->wake,
+                                  &region->head, &region->tail);
+                                idle = 0;
+                        }
+                        continue;
+                }
+                idle = 0;
+
+                stats_count(STAT_COMMANDS, count);
+                stats_count(STAT_BAD, count - applied);
+                engine_submit_batch(batch, applied, results);
+                for (i = applied = 0; i < count; i++)
+                        shm_post(pending[i].client, SHM_EVENT_DONE,
+                          pending[i].messageNum, pending[i].alarm != NULL
+                          ? results[applied++] : SHM_INVALID, pending[i].tag,
+                          engine_now(), NULL);
+        }
+        return NULL;
+}
+
+/*
+ * Creates the shared memory object "name" (as for shm_open, "/name")
+ * and starts the thread that serves the clients that attach to it.
+ * The engine must have been started, with shm_event as its event
+ * hook.
+ */
+void shm_serve (const char *name)
+{
+        shm_region_t *region;
+        pthread_t thread;
+        size_t i;
+        int fd, status, slot;
+
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+                errno_abort ("Create shared memory");
+        if (ftruncate(fd, sizeof(shm_region_t)) != 0)
+                errno_abort ("Size shared memory");
+        region = (shm_region_t*)mmap(NULL, sizeof(shm_region_t),
+          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (region == MAP_FAILED)
+                errno_abort ("Map shared memory");
+
+        //The object starts out zeroed; each cell's sequence starts at its
+        //index, free for the first lap
+        for (i = 0; i < SHM_REQUESTS; i++)
+                atomic_store(&region->requests[i].sequence, i);
+        for (slot = 0; slot < SHM_MAX_CLIENTS; slot++)
+        {
+                for (i = 0; i < SHM_EVENTS; i++)
+                        atomic_store(&region->clients[slot].events[i].sequence,
+                          i);
+                atomic_store(&region->clients[slot].claim, SHM_NO_CLAIM);
+                if (sem_init(&region->clients[slot].wake, 1, 0) != 0)
+                        errno_abort ("Init shared memory");
+        }
+        if (sem_init(&region->wake, 1, 0) != 0)
+                errno_abort ("Init shared memory");
+        region->server_pid = getpid();
+        shm_region = region;
+        atomic_store(&region->magic, SHM_MAGIC);
+
+        status = pthread_create(&thread, NULL, shm_thread, NULL);
+        if (status != 0)
+                err_abort (status, "Create shared memory thread");
+}
@@ -0,0 +1,22 @@
+#ifndef __alarm_shm_server_h
+#define __alarm_shm_server_h
+
+#include "alarm.h"
+
+/*
+ * The server side of the shared-memory front end (alarm_shm.h): a
+ * thread that takes requests out of the region and applies them in
+ * batches, and the engine event hook that turns what happens to the
+ * alarms of a shared-memory client into events in its ring. Such a
+ * client's alarms have a negative client number, so the logger
+ * writes no text for them.
+ */
+// Requests taken out of the ring for one batch at most
+#define SHM_BATCH               1024
+// Empty looks at the ring before the server thread goes to sleep
+#define SHM_SPIN                1000
+
+void shm_serve (const char *name);
+void shm_event (alarm_t *alarm, int event, const char *message);
+
+#endif
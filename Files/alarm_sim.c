@@ -0,0 +1,71 @@
+/*
+ * alarm_sim.c
+ *
+ * Replaying command traces on the virtual clock.
+ */
+#include <time.h>
+#include "errors.h"
+#include "alarm_log.h"
+#include "alarm_server.h"
+#include "alarm_engine.h"
+#include "alarm_sim.h"
+
+static double sim_clock (void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Replays the trace in "path" ("-" for standard input), then runs on
+ * to "horizon" seconds after the start if that is later than the last
+ * command. Returns 0, or -1 with errno set if the trace could not be read.
+ */
+int sim_replay (const char *path, double horizon, sim_stats_t *stats)
+{
+        char line[SERVER_LINE_MAX], *command;
+        double start = sim_clock(), when = 0, stamp;
+        FILE *trace;
+        int status;
+
+        trace = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+        if (trace == NULL)
+                return -1;
+        stats->commands = 0;
+        while (fgets(line, sizeof(line), trace) != NULL)
+        {
+                stamp = strtod(line, &command);
+                //Time never goes back, whatever order the lines are in
+                if (stamp > when)
+                        when = stamp;
+                while (*command == ' ')
+                        command++;
+                if (strlen(command) <= 1)
+                        continue;
+                //What was due before the command first, then what it
+                //makes due at once, as the dispatchers would have
+                engine_advance(when);
+                engine_command(command, LOG_CONSOLE);
+                engine_advance(when);
+                stats->commands++;
+        }
+        status = ferror(trace) ? -1 : 0;
+        if (trace != stdin)
+                fclose(trace);
+        if (horizon > when)
+                when = horizon;
+        engine_advance(when);
+        stats->simulated = when;
+        stats->seconds = sim_clock() - start;
+        return status;
+}
+
+void sim_report (int fd, sim_stats_t *stats)
+{
+        log_printf(fd, "SIMULATION: %lu commands, %.3f s of alarms in "
+          "%.3f s (%.0fx)\n", stats->commands, stats->simulated,
+          stats->seconds, stats->seconds > 0
+          ? stats->simulated / stats->seconds : 0);
+}
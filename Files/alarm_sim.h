@@ -0,0 +1,24 @@
+#ifndef __alarm_sim_h
+#define __alarm_sim_h
+
+/*
+ * Replays a recorded command trace on the virtual clock. A trace is
+ * what the engine writes with config->trace_path set: one command a
+ * line, after the seconds since the engine started when it came in,
+ * "12.345678 5 Message(3) hello". The engine must have
+ * been started with config->virtual_clock set; the replay then fires
+ * the alarms due up to each command's time before running it, and
+ * the displays due after it, at each one's exact time, without ever
+ * waiting. Given the same trace it gives the same output and the same
+ * firing log every time, however long the trace covers.
+ */
+typedef struct sim_stats_tag {
+        unsigned long     commands;
+        double            simulated;                    /* seconds covered */
+        double            seconds;                      /* taken to do it */
+} sim_stats_t;
+
+int sim_replay (const char *path, double horizon, sim_stats_t *stats);
+void sim_report (int fd, sim_stats_t *stats);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * alarm_snapshot.c
+ *
+ * Writing snapshots of the alarm table and mapping them back in.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_snapshot.h"
+
+#define SNAPSHOT_MAGIC          "ALRMSNP1"
+
+typedef struct snapshot_header_tag {
+        char              magic[8];
+        uint64_t          generation;
+        uint64_t          count;
+        uint64_t          text_bytes;
+} snapshot_header_t;
+
+// Where a message seen during the walk went in the text
+typedef struct snapshot_text_tag {
+        const char        *message;
+        uint64_t          offset;
+        uint32_t          length;
+} snapshot_text_t;
+
+// A snapshot being built by the walk
+typedef struct snapshot_build_tag {
+        snapshot_record_t *records;
+        size_t            count, size;
+        char              *text;
+        size_t            used, room;
+        snapshot_text_t   *seen;                        /* by message pointer */
+        size_t            mask;                         /* seen slots - 1 */
+        size_t            distinct;
+} snapshot_build_t;
+
+static void snapshot_grow_seen (snapshot_build_t *build)
+{
+        snapshot_text_t *old = build->seen;
+        size_t size = build->mask + 1, i, slot;
+
+        build->seen = (snapshot_text_t*)calloc(size * 2,
+          sizeof(snapshot_text_t));
+        if (build->seen == NULL)
+                errno_abort ("Allocate snapshot");
+        build->mask = size * 2 - 1;
+        for (i = 0; i < size; i++)
+        {
+                if (old[i].message == NULL)
+                        continue;
+                slot = ((uintptr_t)old[i].message >> 4) & build->mask;
+                while (build->seen[slot].message != NULL)
+                        slot = (slot + 1) & build->mask;
+                build->seen[slot] = old[i];
+        }
+        free(old);
+}
+
+/*
+ * Returns where the message's text is in the snapshot, adding it if
+ * it is not there yet. Alarms with the same text share one interned
+ * copy, so the pointer finds it; the text is compared as well, since
+ * a message dropped during the walk may have its memory reused.
+ */
+static snapshot_text_t *snapshot_text (snapshot_build_t *build,
+  const char *message)
+{
+        snapshot_text_t *seen;
+        size_t slot, length;
+
+        slot = ((uintptr_t)message >> 4) & build->mask;
+        while ((seen = &build->seen[slot])->message != NULL
+          && seen->message != message)
+                slot = (slot + 1) & build->mask;
+        length = strlen(message);
+        if (seen->message == message && seen->length == length
+          && memcmp(build->text + seen->offset, message, length) == 0)
+                return seen;
+
+        if (build->used + length > build->room)
+        {
+                while (build->used + length > build->room)
+                        build->room *= 2;
+                build->text = (char*)realloc(build->text, build->room);
+                if (build->text == NULL)
+                        errno_abort ("Allocate snapshot");
+        }
+        memcpy(build->text + build->used, message, length);
+        if (seen->message == NULL)
+                build->distinct++;
+        seen->message = message;
+        seen->offset = build->used;
+        seen->length = length;
+        build->used += length;
+        if (build->distinct * 2 > build->mask)
+        {
+                snapshot_grow_seen(build);
+                return snapshot_text(build, message);
+        }
+        return seen;
+}
+
+static void snapshot_visit (alarm_t *alarm, void *arg)
+{
+        snapshot_build_t *build = (snapshot_build_t*)arg;
+        snapshot_record_t *record;
+        snapshot_text_t *text;
+        alarm_snapshot_t snapshot;
+
+        //Cancel requests are not state; an alarm they are about to take
+        //off is kept, and the log replays the cancel. Alarms that retire
+        //themselves are not kept across a restart (see alarm_engine.c)
+        if (alarm->alarmRequestType != 1 || alarm->alarmExistsFlag == 0
+          || alarm_limited(alarm))
+                return;
+        if (build->count == build->size)
+        {
+                build->size *= 2;
+                build->records = (snapshot_record_t*)realloc(build->records,
+                  build->size * sizeof(snapshot_record_t));
+                if (build->records == NULL)
+                        errno_abort ("Allocate snapshot");
+        }
+        alarm_read(alarm, &snapshot);
+        text = snapshot_text(build, snapshot.message);
+        record = &build->records[build->count++];
+        record->messageNum = alarm->messageNum;
+        record->changes = snapshot.version;
+        record->seconds = snapshot.seconds;
+        record->offset = text->offset;
+        record->length = text->length;
+        record->reserved = 0;
+}
+
+// Writes all of "data", carrying on after short writes
+static int snapshot_write (int fd, const void *data, size_t length)
+{
+        const char *p = (const char*)data;
+        ssize_t count;
+
+        while (length > 0)
+        {
+                count = write(fd, p, length);
+                if (count < 0 && errno == EINTR)
+                        continue;
+                if (count < 0)
+                        return -1;
+                p += count;
+                length -= count;
+        }
+        return 0;
+}
+
+/*
+ * Writes a snapshot of every alarm to "snapshot" in "dir", to be
+ * followed on restore by the log from segment "generation" on.
+ * Stores the number of alarms in "count". Returns 0, or -1 with
+ * errno set if it could not be written, in which case the last
+ * snapshot is left as it was.
+ */
+int snapshot_save (const char *dir, unsigned long generation, size_t *count)
+{
+        snapshot_build_t build;
+        snapshot_header_t header;
+        int dirfd, fd, status = 0;
+
+        build.size = 4096;
+        build.count = 0;
+        build.records = (snapshot_record_t*)malloc(build.size
+          * sizeof(snapshot_record_t));
+        build.room = 4096;
+        build.used = 0;
+        build.text = (char*)malloc(build.room);
+        build.mask = 1023;
+        build.distinct = 0;
+        build.seen = (snapshot_text_t*)calloc(build.mask + 1,
+          sizeof(snapshot_text_t));
+        if (build.records == NULL || build.text == NULL || build.seen == NULL)
+                errno_abort ("Allocate snapshot");
+        alarm_list_walk(snapshot_visit, &build);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.generation = generation;
+        header.count = build.count;
+        header.text_bytes = build.used;
+
+        dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+        fd = dirfd < 0 ? -1 : openat(dirfd, "snapshot.tmp",
+          O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0
+          || snapshot_write(fd, &header, sizeof(header)) != 0
+          || snapshot_write(fd, build.records,
+          build.count * sizeof(snapshot_record_t)) != 0
+          || snapshot_write(fd, build.text, build.used) != 0
+          || fsync(fd) != 0
+          || renameat(dirfd, "snapshot.tmp", dirfd, "snapshot") != 0
+          || fsync(dirfd) != 0)
+                status = -1;
+        if (fd >= 0)
+                close(fd);
+        if (dirfd >= 0)
+                close(dirfd);
+        *count = build.count;
+        free(build.records);
+        free(build.text);
+        free(build.seen);
+        return status;
+}
+
+/*
+ * Maps the snapshot in "dir". Returns 0, or -1 if there is none or
+ * it is not a whole snapshot.
+ */
+int snapshot_open (const char *dir, snapshot_t *snapshot)
+{
+        const snapshot_record_t *record;
+        snapshot_header_t header;
+        struct stat info;
+        char path[4096];
+        size_t i;
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/snapshot", dir);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header))
+        {
+                close(fd);
+                return -1;
+        }
+        snapshot->size = info.st_size;
+        snapshot->map = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE,
+          fd, 0);
+        close(fd);
+        if (snapshot->map == MAP_FAILED)
+                return -1;
+        madvise(snapshot->map, snapshot->size, MADV_SEQUENTIAL);
+
+        memcpy(&header, snapshot->map, sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+          || header.count > (snapshot->size - sizeof(header))
+          / sizeof(snapshot_record_t)
+          || sizeof(header) + header.count * sizeof(snapshot_record_t)
+          + header.text_bytes != snapshot->size)
+        {
+                munmap(snapshot->map, snapshot->size);
+                return -1;
+        }
+        snapshot->generation = header.generation;
+        snapshot->count = header.count;
+        snapshot->records = (const snapshot_record_t*)
+          ((const char*)snapshot->map + sizeof(header));
+        snapshot->text = (const char*)(snapshot->records + header.count);
+        snapshot->text_bytes = header.text_bytes;
+
+        //The records must be in order and their messages in the text for
+        //the table to be loaded from them as they are
+        for (i = 0; i < snapshot->count; i++)
+        {
+                record = &snapshot->records[i];
+                if ((i > 0 && record->messageNum
+                  <= snapshot->records[i - 1].messageNum)
+                  || record->offset > snapshot->text_bytes
+                  || record->length > snapshot->text_bytes - record->offset)
+                {
+                        munmap(snapshot->map, snapshot->size);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+void snapshot_close (snapshot_t *snapshot)
+{
+        munmap(snapshot->map, snapshot->size);
+}
@@ -0,0 +1,46 @@
+#ifndef __alarm_snapshot_h
+#define __alarm_snapshot_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compact binary snapshots of the alarm table, written now and then
+ * so that a restart only has to replay the log written since. A
+ * snapshot is a header, a record per alarm in message number order,
+ * and the text of the distinct messages, each once. It is written to
+ * "snapshot.tmp" and renamed over "snapshot" once it is synced, so
+ * "snapshot" is always whole. At startup it is mapped and read in
+ * place.
+ *
+ * The table is not stopped while it is written: the snapshot is
+ * taken right after the log moves to a new segment, and records the
+ * alarms as they are when the walk reaches them. Replaying the log
+ * from that segment on puts every alarm into its last logged state
+ * whatever state the walk found it in, so replay over the snapshot
+ * gives the table as it was logged.
+ */
+typedef struct snapshot_record_tag {
+        int32_t           messageNum;
+        uint32_t          changes;                      /* alarm version / 2 */
+        double            seconds;
+        uint64_t          offset;                       /* of the message */
+        uint32_t          length;
+        uint32_t          reserved;
+} snapshot_record_t;
+
+typedef struct snapshot_tag {
+        unsigned long     generation;                   /* replay log from */
+        size_t            count;
+        const snapshot_record_t *records;
+        const char        *text;                        /* the messages */
+        size_t            text_bytes;
+        void              *map;
+        size_t            size;
+} snapshot_t;
+
+int snapshot_save (const char *dir, unsigned long generation, size_t *count);
+int snapshot_open (const char *dir, snapshot_t *snapshot);
+void snapshot_close (snapshot_t *snapshot);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * alarm_stats.c
+ *
+ * Per-thread metric slots and the report that adds them up. Slots go
+ * on a registry the first time a thread records and are never
+ * removed, so the counts of threads that have finished still show.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include "errors.h"
+#include "alarm_hist.h"
+#include "alarm_log.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+#include "alarm_wal.h"
+#include "alarm_intake.h"
+#include "alarm_stats.h"
+
+typedef struct stats_slot_tag {
+        _Alignas(64) atomic_ulong counters[STAT_COUNTERS];
+        alarm_hist_t              hists[STAT_HISTS];
+        struct stats_slot_tag     *next;
+} stats_slot_t;
+
+static _Atomic(stats_slot_t *) slots;
+static _Thread_local stats_slot_t *self;
+
+// Makes reports one at a time, and remembers the last for the rates
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alarm_hist_t merged[STAT_HISTS];
+static uint64_t start_time, last_time;
+static unsigned long last_commands;
+static int stats_dispatchers;
+
+static const char *hist_names[STAT_HISTS] = {
+        "shard lock wait (us)", "shard lock hold (us)",
+        "scheduler wait (us)", "index probes", "insert search steps",
+        "firing lateness (us)"
+};
+// Nanosecond histograms are reported in microseconds
+static const double hist_scale[STAT_HISTS] = { 1e3, 1e3, 1e3, 1, 1, 1e3 };
+
+static stats_slot_t *stats_self (void)
+{
+        stats_slot_t *slot;
+
+        if (self != NULL)
+                return self;
+        //The slot is made of whole cache lines, so nothing else shares them
+        slot = (stats_slot_t*)aligned_alloc(64, (sizeof(stats_slot_t) + 63)
+          & ~(size_t)63);
+        if (slot == NULL)
+                errno_abort ("Allocate stats slot");
+        memset(slot, 0, sizeof(stats_slot_t));
+        slot->next = atomic_load(&slots);
+        while (!atomic_compare_exchange_weak(&slots, &slot->next, slot))
+                ;
+        self = slot;
+        return slot;
+}
+
+void stats_count (int counter, unsigned long amount)
+{
+        atomic_fetch_add_explicit(&stats_self()->counters[counter], amount,
+          memory_order_relaxed);
+}
+
+void stats_record (int hist, uint64_t value)
+{
+        hist_record(&stats_self()->hists[hist], value);
+}
+
+// Nanoseconds on CLOCK_MONOTONIC, for timing what is recorded
+uint64_t stats_clock (void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void stats_hist_line (int client, int fd, int hist)
+{
+        alarm_hist_t *h = &merged[hist];
+        double scale = hist_scale[hist];
+
+        log_client_printf(client, fd,
+          "STATS: %-21s %9lu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+          hist_names[hist], (unsigned long)atomic_load(&h->total),
+          hist_mean(h) / scale, hist_percentile(h, 50) / scale,
+          hist_percentile(h, 90) / scale, hist_percentile(h, 99) / scale,
+          hist_percentile(h, 100) / scale);
+}
+
+// Starts the clock for the rates; "dispatchers" is only reported
+void stats_init (int dispatchers)
+{
+        pthread_mutex_lock(&report_mutex);
+        start_time = last_time = stats_clock();
+        stats_dispatchers = dispatchers;
+        pthread_mutex_unlock(&report_mutex);
+}
+
+/*
+ * Adds up every thread's slot and prints the totals, one "STATS:"
+ * line each, through the logger to the client, or to "fd" for the
+ * console.
+ */
+void stats_report (int client, int fd)
+{
+        unsigned long counters[STAT_COUNTERS] = { 0 };
+        stats_slot_t *slot;
+        uint64_t now;
+        double since_last, uptime;
+        intern_stats_t interned;
+        alarm_pool_stats_t pool;
+        wal_stats_t logged;
+        intake_stats_t intake;
+        int i;
+
+        intern_get_stats(&interned);
+        alarm_pool_stats(&pool);
+        wal_get_stats(&logged);
+        intake_get_stats(&intake);
+        pthread_mutex_lock(&report_mutex);
+        for (i = 0; i < STAT_HISTS; i++)
+                hist_reset(&merged[i]);
+        for (slot = atomic_load(&slots); slot != NULL; slot = slot->next)
+        {
+                for (i = 0; i < STAT_COUNTERS; i++)
+                        counters[i] += atomic_load_explicit(
+                          &slot->counters[i], memory_order_relaxed);
+                for (i = 0; i < STAT_HISTS; i++)
+                        hist_merge(&merged[i], &slot->hists[i]);
+        }
+
+        now = stats_clock();
+        uptime = (now - start_time) / 1e9;
+        since_last = (now - last_time) / 1e9;
+
+        log_client_printf(client, fd, "STATS: uptime %.1f s, %lu alarms "
+          "live, %d dispatchers, %lu firings, %lu expired, %lu steals\n",
+          uptime, counters[STAT_LINKED] - counters[STAT_UNLINKED],
+          stats_dispatchers, counters[STAT_FIRINGS], counters[STAT_EXPIRED],
+          counters[STAT_STEALS]);
+        log_client_printf(client, fd, "STATS: %lu commands (%lu add, "
+          "%lu change, %lu cancel, %lu bad, %lu refused), %.1f/s since "
+          "last, %.1f/s overall\n",
+          counters[STAT_COMMANDS], counters[STAT_ADDS],
+          counters[STAT_CHANGES], counters[STAT_CANCELS], counters[STAT_BAD],
+          counters[STAT_REFUSED],
+          since_last > 0 ? (counters[STAT_COMMANDS] - last_commands)
+          / since_last : 0.0,
+          uptime > 0 ? counters[STAT_COMMANDS] / uptime : 0.0);
+        log_client_printf(client, fd, "STATS: %zu distinct messages in %zu "
+          "bytes, %zu references\n", interned.strings, interned.bytes,
+          interned.references);
+        log_client_printf(client, fd, "STATS: pool %zu alarms live, %zu "
+          "free (%zu high-water) in %zu slabs\n", pool.live, pool.free,
+          pool.high_water, pool.slabs);
+        if (wal_enabled())
+                log_client_printf(client, fd, "STATS: %lu requests logged in "
+                  "%lu writes, %lu syncs; %lu replayed, %lu torn\n",
+                  logged.records, logged.groups, logged.syncs,
+                  logged.replayed, logged.torn);
+        if (intake_running())
+                log_client_printf(client, fd, "STATS: intake %zu of %zu "
+                  "queued (%zu high-water), %lu taken, %lu rejected, "
+                  "%lu shed, %lu waits for room\n", intake.depth,
+                  intake.capacity, intake.high_water, intake.queued,
+                  intake.rejected, intake.shed, intake.blocked);
+        log_client_printf(client, fd,
+          "STATS: %-21s %9s %9s %9s %9s %9s %9s\n", "", "count", "mean",
+          "p50", "p90", "p99", "max");
+        for (i = 0; i < STAT_HISTS; i++)
+                stats_hist_line(client, fd, i);
+
+        last_time = now;
+        last_commands = counters[STAT_COMMANDS];
+        pthread_mutex_unlock(&report_mutex);
+}
+
+typedef struct stats_dump_tag {
+        int               fd;
+        int               seconds;
+} stats_dump_t;
+
+static void *stats_dump_thread (void *arg)
+{
+        stats_dump_t *dump = (stats_dump_t*)arg;
+
+        while (1)
+        {
+                sleep(dump->seconds);
+                stats_report(LOG_CONSOLE, dump->fd);
+        }
+        return NULL;
+}
+
+/*
+ * Appends a report to the file at "path" every "seconds" seconds,
+ * from a thread of its own, for as long as the program runs.
+ */
+void stats_dump_start (const char *path, int seconds)
+{
+        static stats_dump_t dump;
+        pthread_t thread;
+        int status;
+
+        dump.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (dump.fd < 0)
+                errno_abort ("Open stats file");
+        dump.seconds = seconds;
+        status = pthread_create(&thread, NULL, stats_dump_thread, &dump);
+        if (status != 0)
+                err_abort (status, "Create stats thread");
+}
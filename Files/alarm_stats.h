@@ -0,0 +1,44 @@
+#ifndef __alarm_stats_h
+#define __alarm_stats_h
+
+#include <stdint.h>
+
+/*
+ * Runtime metrics for the alarm engine. Each thread that records
+ * gets a slot of its own, padded out to whole cache lines, so a
+ * counter bump or a histogram sample never shares a line with
+ * another thread. Nothing is added up until someone asks: the
+ * "Stats" command or the periodic dump walk the slots and merge them.
+ */
+
+// Counters
+#define STAT_COMMANDS           0                       /* lines handled */
+#define STAT_ADDS               1
+#define STAT_CHANGES            2
+#define STAT_CANCELS            3
+#define STAT_BAD                4                       /* bad input */
+#define STAT_LINKED             5                       /* alarms put on list */
+#define STAT_UNLINKED           6                       /* and taken off */
+#define STAT_FIRINGS            7
+#define STAT_REFUSED            8                       /* over the alarm limit */
+#define STAT_EXPIRED            9                       /* retired themselves */
+#define STAT_STEALS             10                      /* dispatcher deques */
+#define STAT_COUNTERS           11
+
+// Histograms
+#define STAT_LIST_WAIT          0                       /* ns for a shard lock */
+#define STAT_LIST_HOLD          1                       /* ns holding it */
+#define STAT_SCHED_WAIT         2                       /* ns for sched mutex */
+#define STAT_PROBES             3                       /* index slots looked at */
+#define STAT_WALK               4                       /* search steps to insert */
+#define STAT_LATENESS           5                       /* ns past deadline */
+#define STAT_HISTS              6
+
+void stats_count (int counter, unsigned long amount);
+void stats_record (int hist, uint64_t value);
+uint64_t stats_clock (void);
+void stats_init (int dispatchers);
+void stats_report (int client, int fd);
+void stats_dump_start (const char *path, int seconds);
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * alarm_wal.c
+ *
+ * The write-ahead log: group commit of requests, and reading them
+ * back at startup.
+ */
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "alarm_log.h"
+#include "alarm_wal.h"
+
+/*
+ * A record as it is stored: this header, then "length" bytes of
+ * message. "check" covers everything after it, the message included.
+ */
+typedef struct wal_header_tag {
+        uint32_t          length;
+        uint32_t          check;
+        int32_t           type;
+        int32_t           messageNum;
+        double            seconds;
+} wal_header_t;
+
+#define WAL_MAX_GENERATIONS     4096                    /* segments at startup */
+
+static wal_config_t wal_config;
+static int wal_on;
+static int wal_dirfd = -1;
+static int wal_fd = -1;
+static unsigned long wal_generation;                    /* of wal_fd */
+static pthread_t wal_thread;
+
+// Everything below is guarded by wal_mutex
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wal_done = PTHREAD_COND_INITIALIZER;
+static char *wal_buffer, *wal_spare;
+static size_t wal_used, wal_size, wal_spare_size;
+static uint64_t wal_appended;                           /* records so far */
+static uint64_t wal_durable;                            /* all before written */
+static int wal_waiting;                                 /* in wal_wait */
+static int wal_rotating;                                /* wal_rotate asked */
+static wal_stats_t wal_stats;
+
+// FNV-1a, as for interned messages
+static uint32_t wal_check (const void *data, size_t length, uint32_t hash)
+{
+        const unsigned char *p = (const unsigned char*)data;
+        size_t i;
+
+        for (i = 0; i < length; i++)
+                hash = (hash ^ p[i]) * 16777619u;
+        return hash;
+}
+
+static uint32_t wal_record_check (const wal_header_t *header,
+  const char *message)
+{
+        uint32_t hash = 2166136261u;
+
+        hash = wal_check(&header->length, sizeof(header->length), hash);
+        hash = wal_check(&header->type, sizeof(wal_header_t)
+          - offsetof(wal_header_t, type), hash);
+        return wal_check(message, header->length, hash);
+}
+
+static struct timespec *wal_deadline (struct timespec *when, int ms)
+{
+        clock_gettime(CLOCK_REALTIME, when);
+        when->tv_sec += ms / 1000;
+        when->tv_nsec += (long)(ms % 1000) * 1000000;
+        if (when->tv_nsec >= 1000000000)
+        {
+                when->tv_sec++;
+                when->tv_nsec -= 1000000000;
+        }
+        return when;
+}
+
+// Writes all of "data", carrying on after short writes
+static void wal_write (int fd, const char *data, size_t length)
+{
+        ssize_t count;
+
+        while (length > 0)
+        {
+                count = write(fd, data, length);
+                if (count < 0 && errno == EINTR)
+                        continue;
+                if (count < 0)
+                        errno_abort ("Write log");
+                data += count;
+                length -= count;
+        }
+}
+
+static int wal_segment (unsigned long generation, int flags)
+{
+        char name[32];
+        int fd;
+
+        snprintf(name, sizeof(name), "wal.%lu", generation);
+        fd = openat(wal_dirfd, name, flags, 0644);
+        if (fd < 0 && (flags & O_CREAT))
+                errno_abort ("Open log segment");
+        return fd;
+}
+
+/*
+ * Writes out each group of records as it builds up: at once for a
+ * thread waiting in wal_wait or wal_rotate, and otherwise after at
+ * most commit_ms. Records appended while a group is being written
+ * and synced make up the next group.
+ */
+static void *wal_commit_thread (void *arg)
+{
+        struct timespec when;
+        uint64_t last;
+        size_t length, size;
+        char *group;
+        int rotate, fd;
+
+        while (1)
+        {
+                pthread_mutex_lock(&wal_mutex);
+                while (wal_used == 0 && !wal_rotating)
+                        pthread_cond_wait(&wal_cond, &wal_mutex);
+                if (!wal_waiting && !wal_rotating)
+                        pthread_cond_timedwait(&wal_cond, &wal_mutex,
+                          wal_deadline(&when, wal_config.commit_ms));
+                group = wal_buffer;
+                length = wal_used;
+                size = wal_size;
+                wal_buffer = wal_spare;
+                wal_size = wal_spare_size;
+                wal_used = 0;
+                wal_spare = group;
+                wal_spare_size = size;
+                last = wal_appended;
+                rotate = wal_rotating;
+                pthread_mutex_unlock(&wal_mutex);
+
+                if (length > 0)
+                {
+                        wal_write(wal_fd, group, length);
+                        if (wal_config.sync != WAL_SYNC_NONE)
+                                fdatasync(wal_fd);
+                }
+
+                //Everything logged before the rotation is in the old
+                //segment; what has come in since goes in the new one
+                fd = -1;
+                if (rotate)
+                {
+                        fdatasync(wal_fd);
+                        fd = wal_segment(wal_generation + 1,
+                          O_WRONLY | O_CREAT | O_APPEND);
+                        fsync(wal_dirfd);
+                        close(wal_fd);
+                }
+
+                pthread_mutex_lock(&wal_mutex);
+                if (length > 0)
+                {
+                        wal_stats.groups++;
+                        wal_stats.syncs += wal_config.sync != WAL_SYNC_NONE;
+                }
+                if (rotate)
+                {
+                        wal_fd = fd;
+                        wal_generation++;
+                        wal_rotating = 0;
+                }
+                wal_durable = last;
+                pthread_cond_broadcast(&wal_done);
+                pthread_mutex_unlock(&wal_mutex);
+        }
+        return NULL;
+}
+
+/*
+ * Reads back one segment, calling "replay" on each whole record.
+ * Returns 0, or -1 if it ended in a torn or damaged record, in which
+ * case the segment is cut back to the records before it.
+ */
+static int wal_replay_segment (int fd, wal_replay_t replay, void *arg)
+{
+        struct stat info;
+        wal_header_t header;
+        wal_record_t record;
+        const char *data;
+        size_t offset = 0;
+        int status = 0;
+
+        if (fstat(fd, &info) != 0)
+                errno_abort ("Stat log segment");
+        if (info.st_size == 0)
+                return 0;
+        data = (const char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+          fd, 0);
+        if (data == MAP_FAILED)
+                errno_abort ("Map log segment");
+        madvise((void*)data, info.st_size, MADV_SEQUENTIAL);
+        while (offset < (size_t)info.st_size)
+        {
+                if (info.st_size - offset < sizeof(wal_header_t))
+                {
+                        status = -1;
+                        break;
+                }
+                memcpy(&header, data + offset, sizeof(header));
+                if (header.length > info.st_size - offset - sizeof(header)
+                  || wal_record_check(&header, data + offset + sizeof(header))
+                  != header.check)
+                {
+                        status = -1;
+                        break;
+                }
+                record.type = header.type;
+                record.messageNum = header.messageNum;
+                record.seconds = header.seconds;
+                record.message = data + offset + sizeof(header);
+                record.length = header.length;
+                replay(&record, arg);
+                wal_stats.replayed++;
+                offset += sizeof(header) + header.length;
+        }
+        munmap((void*)data, info.st_size);
+        if (status != 0)
+        {
+                wal_stats.torn++;
+                if (ftruncate(fd, offset) != 0)
+                        errno_abort ("Cut log segment");
+        }
+        return status;
+}
+
+static int wal_generation_compare (const void *a, const void *b)
+{
+        unsigned long x = *(const unsigned long*)a;
+        unsigned long y = *(const unsigned long*)b;
+
+        return x < y ? -1 : x > y;
+}
+
+/*
+ * Lists the segments in the log directory, oldest first. Returns how
+ * many there are.
+ */
+static int wal_segments (unsigned long *generations)
+{
+        struct dirent *entry;
+        unsigned long generation;
+        char end;
+        DIR *dir;
+        int count = 0, fd;
+
+        fd = dup(wal_dirfd);
+        if (fd < 0 || (dir = fdopendir(fd)) == NULL)
+                errno_abort ("Read log directory");
+        //The copy shares its position with the last listing
+        rewinddir(dir);
+        while ((entry = readdir(dir)) != NULL && count < WAL_MAX_GENERATIONS)
+                if (sscanf(entry->d_name, "wal.%lu%c", &generation, &end) == 1)
+                        generations[count++] = generation;
+        closedir(dir);
+        qsort(generations, count, sizeof(unsigned long),
+          wal_generation_compare);
+        return count;
+}
+
+/*
+ * Opens the log in config->dir, creating the directory if need be,
+ * and replays every record in segment "generation" and after through
+ * "replay", oldest first. A torn record ends its segment. Appends go
+ * to the newest segment from then on, and the commit thread is
+ * started. Returns the generation being appended to.
+ */
+unsigned long wal_open (wal_config_t *config, unsigned long generation,
+  wal_replay_t replay, void *arg)
+{
+        unsigned long *generations;
+        int count, i, fd, status;
+
+        wal_config = *config;
+        if (mkdir(config->dir, 0755) != 0 && errno != EEXIST)
+                errno_abort ("Create log directory");
+        wal_dirfd = open(config->dir, O_RDONLY | O_DIRECTORY);
+        if (wal_dirfd < 0)
+                errno_abort ("Open log directory");
+
+        generations = (unsigned long*)malloc(WAL_MAX_GENERATIONS
+          * sizeof(unsigned long));
+        if (generations == NULL)
+                errno_abort ("Allocate log segments");
+        count = wal_segments(generations);
+        wal_generation = generation;
+        for (i = 0; i < count; i++)
+        {
+                if (generations[i] < generation)
+                        continue;
+                fd = wal_segment(generations[i], O_RDWR);
+                if (fd < 0)
+                        errno_abort ("Open log segment");
+                status = wal_replay_segment(fd, replay, arg);
+                close(fd);
+                wal_generation = generations[i];
+                //Each segment was synced before the next was begun, so the
+                //later ones are whole even if this one was cut short
+                if (status != 0)
+                        log_printf(STDERR_FILENO, "WAL: wal.%lu ended in "
+                          "a torn record, cut back to the records before "
+                          "it\n", wal_generation);
+        }
+        free(generations);
+
+        wal_fd = wal_segment(wal_generation, O_WRONLY | O_CREAT | O_APPEND);
+        fsync(wal_dirfd);
+        wal_size = wal_spare_size = 1 << 16;
+        wal_buffer = (char*)malloc(wal_size);
+        wal_spare = (char*)malloc(wal_spare_size);
+        if (wal_buffer == NULL || wal_spare == NULL)
+                errno_abort ("Allocate log buffer");
+        wal_on = 1;
+        status = pthread_create(&wal_thread, NULL, wal_commit_thread, NULL);
+        if (status != 0)
+                err_abort (status, "Create log thread");
+        return wal_generation;
+}
+
+int wal_enabled (void)
+{
+        return wal_on;
+}
+
+/*
+ * Logs one request. Returns its sequence number, for wal_wait, or 0
+ * if there is no log.
+ */
+uint64_t wal_append (int type, int messageNum, double seconds,
+  const char *message)
+{
+        wal_header_t header;
+        size_t length, need;
+        uint64_t lsn;
+
+        if (!wal_on)
+                return 0;
+        length = strlen(message);
+        header.length = length;
+        header.type = type;
+        header.messageNum = messageNum;
+        header.seconds = seconds;
+        header.check = wal_record_check(&header, message);
+
+        pthread_mutex_lock(&wal_mutex);
+        need = wal_used + sizeof(header) + length;
+        if (need > wal_size)
+        {
+                while (wal_size < need)
+                        wal_size *= 2;
+                wal_buffer = (char*)realloc(wal_buffer, wal_size);
+                if (wal_buffer == NULL)
+                        errno_abort ("Grow log buffer");
+        }
+        memcpy(wal_buffer + wal_used, &header, sizeof(header));
+        memcpy(wal_buffer + wal_used + sizeof(header), message, length);
+        //The commit thread only sleeps unbounded on an empty buffer
+        if (wal_used == 0)
+                pthread_cond_signal(&wal_cond);
+        wal_used = need;
+        lsn = ++wal_appended;
+        wal_stats.records++;
+        pthread_mutex_unlock(&wal_mutex);
+        return lsn;
+}
+
+// Has the commit thread write out everything up to record "lsn" now
+static void wal_commit (uint64_t lsn)
+{
+        pthread_mutex_lock(&wal_mutex);
+        wal_waiting++;
+        while (wal_durable < lsn)
+        {
+                pthread_cond_signal(&wal_cond);
+                pthread_cond_wait(&wal_done, &wal_mutex);
+        }
+        wal_waiting--;
+        pthread_mutex_unlock(&wal_mutex);
+}
+
+/*
+ * Under WAL_SYNC_FULL, waits until the record numbered "lsn", and
+ * every one before it, has been written and synced. Otherwise it
+ * returns at once.
+ */
+void wal_wait (uint64_t lsn)
+{
+        if (wal_on && wal_config.sync == WAL_SYNC_FULL)
+                wal_commit(lsn);
+}
+
+/*
+ * Writes out every record appended so far, whatever the policy, and
+ * syncs it unless the policy is WAL_SYNC_NONE. For a clean exit.
+ */
+void wal_flush (void)
+{
+        uint64_t lsn;
+
+        if (!wal_on)
+                return;
+        pthread_mutex_lock(&wal_mutex);
+        lsn = wal_appended;
+        pthread_mutex_unlock(&wal_mutex);
+        wal_commit(lsn);
+}
+
+/*
+ * Starts a new segment. Every record appended before the call is in
+ * an older one, written and synced, by the time it returns. Returns
+ * the new segment's generation.
+ */
+unsigned long wal_rotate (void)
+{
+        unsigned long generation;
+
+        pthread_mutex_lock(&wal_mutex);
+        generation = wal_generation + 1;
+        wal_rotating = 1;
+        while (wal_generation < generation)
+        {
+                pthread_cond_signal(&wal_cond);
+                pthread_cond_wait(&wal_done, &wal_mutex);
+        }
+        pthread_mutex_unlock(&wal_mutex);
+        return generation;
+}
+
+// Removes the segments older than "generation"
+void wal_drop (unsigned long generation)
+{
+        unsigned long *generations;
+        char name[32];
+        int count, i;
+
+        generations = (unsigned long*)malloc(WAL_MAX_GENERATIONS
+          * sizeof(unsigned long));
+        if (generations == NULL)
+                errno_abort ("Allocate log segments");
+        count = wal_segments(generations);
+        for (i = 0; i < count && generations[i] < generation; i++)
+        {
+                snprintf(name, sizeof(name), "wal.%lu", generations[i]);
+                unlinkat(wal_dirfd, name, 0);
+        }
+        free(generations);
+        fsync(wal_dirfd);
+}
+
+void wal_get_stats (wal_stats_t *stats)
+{
+        pthread_mutex_lock(&wal_mutex);
+        *stats = wal_stats;
+        pthread_mutex_unlock(&wal_mutex);
+}
+
+int wal_sync_policy (const char *name)
+{
+        if (strcmp(name, "none") == 0)
+                return WAL_SYNC_NONE;
+        if (strcmp(name, "group") == 0)
+                return WAL_SYNC_GROUP;
+        if (strcmp(name, "full") == 0)
+                return WAL_SYNC_FULL;
+        return -1;
+}
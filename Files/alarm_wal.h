@@ -0,0 +1,68 @@
+#ifndef __alarm_wal_h
+#define __alarm_wal_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Write-ahead log of the requests that change the alarm table, so
+ * it can be rebuilt after a restart. Every add or change is logged
+ * when it is applied, and every cancel when the alarm thread takes
+ * the alarm off the list, both under the lock of the alarm's shard,
+ * so the log holds each message number's requests in the order they
+ * took effect. Records go into a buffer in memory and a thread of
+ * its own writes each group that has built up with one write and,
+ * by the sync policy, one fdatasync.
+ *
+ * The log is kept in segments, "wal.<generation>" in the log
+ * directory. wal_rotate starts a new one, so that everything before
+ * it can be dropped once a snapshot covers it (see alarm_snapshot.h).
+ * A record that was being written when the program stopped fails its
+ * check and the segment is cut back to the records before it.
+ */
+#define WAL_SYNC_NONE           0                       /* leave it to the OS */
+#define WAL_SYNC_GROUP          1                       /* sync each group */
+#define WAL_SYNC_FULL           2                       /* and wait for it */
+
+#define WAL_DEFAULT_COMMIT_MS   5
+#define WAL_DEFAULT_SNAPSHOT_SECONDS 60
+
+typedef struct wal_config_tag {
+        const char        *dir;                         /* NULL for none */
+        int               sync;                         /* WAL_SYNC_ */
+        int               commit_ms;                    /* longest a group waits */
+        int               snapshot_seconds;             /* between snapshots */
+} wal_config_t;
+
+// One request read back from the log
+typedef struct wal_record_tag {
+        int               type;                         /* alarmRequestType */
+        int               messageNum;
+        double            seconds;
+        const char        *message;                     /* not terminated */
+        size_t            length;
+} wal_record_t;
+
+typedef void (*wal_replay_t) (wal_record_t *record, void *arg);
+
+typedef struct wal_stats_tag {
+        unsigned long     records;                      /* since start */
+        unsigned long     groups;                       /* writes */
+        unsigned long     syncs;
+        unsigned long     replayed;
+        unsigned long     torn;                         /* records cut off */
+} wal_stats_t;
+
+unsigned long wal_open (wal_config_t *config, unsigned long generation,
+  wal_replay_t replay, void *arg);
+int wal_enabled (void);
+uint64_t wal_append (int type, int messageNum, double seconds,
+  const char *message);
+void wal_wait (uint64_t lsn);
+void wal_flush (void);
+unsigned long wal_rotate (void);
+void wal_drop (unsigned long generation);
+void wal_get_stats (wal_stats_t *stats);
+int wal_sync_policy (const char *name);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * alarm_wheel.c
+ *
+ * Hierarchical timing wheel used by the alarm scheduler.
+ */
+#include <stddef.h>
+#include "alarm_wheel.h"
+
+void timer_list_init (wheel_timer_t *list)
+{
+        list->next = list->prev = list;
+}
+
+int timer_list_empty (wheel_timer_t *list)
+{
+        return list->next == list;
+}
+
+void timer_list_append (wheel_timer_t *list, wheel_timer_t *timer)
+{
+        timer->prev = list->prev;
+        timer->next = list;
+        list->prev->next = timer;
+        list->prev = timer;
+}
+
+wheel_timer_t *timer_list_pop (wheel_timer_t *list)
+{
+        wheel_timer_t *timer = list->next;
+
+        if (timer == list)
+                return NULL;
+        timer_unlink(timer);
+        return timer;
+}
+
+void timer_unlink (wheel_timer_t *timer)
+{
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->next = timer->prev = timer;
+}
+
+void wheel_init (wheel_t *wheel, uint64_t now)
+{
+        int level, slot;
+
+        wheel->now = now;
+        wheel->count = 0;
+        for (level = 0; level < WHEEL_LEVELS; level++)
+                for (slot = 0; slot < WHEEL_SIZE; slot++)
+                        timer_list_init(&wheel->slots[level][slot]);
+}
+
+/*
+ * Puts the timer in the slot that covers its expiry time. A timer
+ * due before "earliest" goes in the slot for that tick; one beyond
+ * the range of the top level is parked at the far end of it and
+ * placed again when that slot cascades.
+ */
+static void wheel_place (wheel_t *wheel, wheel_timer_t *timer,
+  uint64_t earliest)
+{
+        uint64_t expires = timer->expires;
+        uint64_t delta;
+        int level;
+
+        if (expires < earliest)
+                expires = earliest;
+        delta = expires - wheel->now;
+        if (delta >= (uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+        {
+                delta = ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+                expires = wheel->now + delta;
+        }
+        for (level = 0; level < WHEEL_LEVELS - 1; level++)
+                if (delta < (uint64_t)1 << (WHEEL_BITS * (level + 1)))
+                        break;
+        timer_list_append(
+          &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+          timer);
+}
+
+void wheel_add (wheel_t *wheel, wheel_timer_t *timer)
+{
+        //The current tick has already run, so the soonest is the next one
+        wheel_place(wheel, timer, wheel->now + 1);
+        wheel->count++;
+}
+
+void wheel_remove (wheel_t *wheel, wheel_timer_t *timer)
+{
+        timer_unlink(timer);
+        wheel->count--;
+}
+
+/*
+ * Empties one slot of a higher level back into the wheel. Returns
+ * the slot index so the caller knows whether this level wrapped too.
+ */
+static int wheel_cascade (wheel_t *wheel, int level)
+{
+        int slot = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        wheel_timer_t pending, *timer;
+
+        timer_list_init(&pending);
+        while ((timer = timer_list_pop(&wheel->slots[level][slot])) != NULL)
+                timer_list_append(&pending, timer);
+        while ((timer = timer_list_pop(&pending)) != NULL)
+                wheel_place(wheel, timer, wheel->now);
+        return slot;
+}
+
+/*
+ * Runs every tick up to and including "now", moving the timers that
+ * expire on the way onto the "expired" list in expiry order.
+ */
+void wheel_advance (wheel_t *wheel, uint64_t now, wheel_timer_t *expired)
+{
+        wheel_timer_t *slot, *timer;
+        int level;
+
+        while (wheel->now < now)
+        {
+                //Jumps straight over ticks that can have nothing to run
+                if (wheel->count == 0)
+                {
+                        wheel->now = now;
+                        break;
+                }
+                wheel->now++;
+                if ((wheel->now & WHEEL_MASK) == 0)
+                {
+                        for (level = 1; level < WHEEL_LEVELS; level++)
+                                if (wheel_cascade(wheel, level) != 0)
+                                        break;
+                }
+                slot = &wheel->slots[0][wheel->now & WHEEL_MASK];
+                while ((timer = timer_list_pop(slot)) != NULL)
+                {
+                        timer_list_append(expired, timer);
+                        wheel->count--;
+                }
+        }
+}
+
+/*
+ * Returns how many ticks the caller can sleep before it needs to
+ * call wheel_advance again: up to the next occupied level 0 slot,
+ * or to the next cascade if level 0 is empty. UINT64_MAX means the
+ * wheel is empty.
+ */
+uint64_t wheel_next (wheel_t *wheel)
+{
+        uint64_t tick;
+
+        if (wheel->count == 0)
+                return UINT64_MAX;
+        for (tick = wheel->now + 1; ; tick++)
+        {
+                if (!timer_list_empty(&wheel->slots[0][tick & WHEEL_MASK]))
+                        break;
+                if ((tick & WHEEL_MASK) == 0)
+                        break;
+        }
+        return tick - wheel->now;
+}
@@ -0,0 +1,50 @@
+#ifndef __alarm_wheel_h
+#define __alarm_wheel_h
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timing wheel. Time is counted in ticks; level 0 has
+ * one slot per tick for the next WHEEL_SIZE ticks, and every level
+ * above covers WHEEL_SIZE times the span of the one below. When the
+ * level 0 cursor wraps, the matching slot of the next level up is
+ * emptied back into the wheel ("cascaded"), so adding and expiring
+ * a timer are both constant time however many timers are queued.
+ *
+ * Timers are intrusive: the caller embeds a wheel_timer_t in its
+ * own structure, so the wheel never allocates.
+ */
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    5
+
+typedef struct wheel_timer_tag {
+        struct wheel_timer_tag  *next;
+        struct wheel_timer_tag  *prev;
+        uint64_t                expires;                /* absolute tick */
+} wheel_timer_t;
+
+typedef struct wheel_tag {
+        uint64_t          now;                          /* last tick run */
+        uint64_t          count;                        /* timers queued */
+        wheel_timer_t     slots[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel_t;
+
+/*
+ * Circular timer lists with a sentinel, used for the wheel slots
+ * and for lists of expired timers handed back to the caller.
+ */
+void timer_list_init (wheel_timer_t *list);
+int timer_list_empty (wheel_timer_t *list);
+void timer_list_append (wheel_timer_t *list, wheel_timer_t *timer);
+wheel_timer_t *timer_list_pop (wheel_timer_t *list);
+void timer_unlink (wheel_timer_t *timer);
+
+void wheel_init (wheel_t *wheel, uint64_t now);
+void wheel_add (wheel_t *wheel, wheel_timer_t *timer);
+void wheel_remove (wheel_t *wheel, wheel_timer_t *timer);
+void wheel_advance (wheel_t *wheel, uint64_t now, wheel_timer_t *expired);
+uint64_t wheel_next (wheel_t *wheel);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __bench_h
+#define __bench_h
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "alarm.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+
+/*
+ * Helpers the benchmark and demo programs share. Everything here is
+ * static inline, so a program only links what it calls: one that
+ * never makes an alarm needs neither the pool nor the interner.
+ */
+
+// Seconds on CLOCK_MONOTONIC
+static inline double bench_now_sec (void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Nanoseconds on CLOCK_MONOTONIC
+static inline uint64_t bench_now_ns (void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sleeps until "when", a time from bench_now_sec
+static inline void bench_sleep_until (double when)
+{
+        struct timespec ts;
+
+        ts.tv_sec = (time_t)when;
+        ts.tv_nsec = (long)((when - ts.tv_sec) * 1e9);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+// A request as the prompt would make it, for the alarm store alone
+static inline alarm_t *bench_make_alarm (int messageNum, int type)
+{
+        alarm_t *alarm = alarm_alloc();
+
+        memset(alarm, 0, sizeof(alarm_t));
+        alarm->seconds = 5;
+        alarm->messageNum = messageNum;
+        alarm->alarmRequestType = type;
+        alarm->message = intern_get("benchmark", 9);
+        return alarm;
+}
+
+#endif
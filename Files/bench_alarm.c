@@ -0,0 +1,216 @@
+/*
+ * bench_alarm.c
+ *
+ * Load generator for the alarm engine. Registers a population of
+ * alarms through engine_command, exactly as if they were typed at the
+ * prompt, then keeps changing and cancelling them at fixed rates
+ * while the dispatchers fire them. Reports command throughput,
+ * latency percentiles per command type, firing jitter (due time vs
+ * actual display time), CPU time and peak RSS, as a table and, with
+ * -o, as a CSV row appended to a file.
+ *
+ * Usage: bench_alarm [-n alarms] [-p min period] [-P max period]
+ *                    [-d seconds] [-c changes/s] [-x cancels/s]
+ *                    [-t dispatchers] [-o csv file]
+ */
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "errors.h"
+#include "alarm_engine.h"
+#include "alarm_hist.h"
+#include "alarm_rwlock.h"
+#include "bench.h"
+
+static alarm_hist_t insert_hist, change_hist, cancel_hist, jitter_hist;
+
+// A period between min and max, in whole milliseconds
+static double random_period (double min, double max)
+{
+        return min + rand() % ((int)((max - min) * 1000) + 1) / 1000.0;
+}
+
+static void on_fire (alarm_t *alarm, double lateness)
+{
+        hist_record(&jitter_hist,
+          lateness > 0 ? (uint64_t)(lateness * 1e9) : 0);
+}
+
+// Runs one command and records how long engine_command took
+static void timed_command (alarm_hist_t *hist, const char *line)
+{
+        double start = bench_now_sec();
+
+        engine_command(line, LOG_CONSOLE);
+        hist_record(hist, (uint64_t)((bench_now_sec() - start) * 1e9));
+}
+
+static void report_latency (int fd, const char *name, alarm_hist_t *hist)
+{
+        dprintf(fd, "%-16s %10lu %10.1f %10.1f %10.1f %10.1f\n", name,
+          (unsigned long)atomic_load(&hist->total),
+          hist_percentile(hist, 50) / 1e3, hist_percentile(hist, 90) / 1e3,
+          hist_percentile(hist, 99) / 1e3, hist_percentile(hist, 100) / 1e3);
+}
+
+int main (int argc, char *argv[])
+{
+        int alarms = 1000, duration = 5;
+        double min_period = 1, max_period = 5;
+        double change_rate = 100, cancel_rate = 100;
+        const char *csv = NULL;
+        engine_config_t config;
+        int option, report, null_fd, csv_fd, i, slot, live, next_id;
+        int *ids;
+        double start, load_time, end, next_change, next_cancel, when;
+        struct rusage usage;
+        char line[128];
+
+        engine_config_default(&config);
+        while ((option = getopt(argc, argv, "n:p:P:d:c:x:t:o:")) != -1)
+        {
+                switch (option)
+                {
+                case 'n': alarms = atoi(optarg); break;
+                case 'p': min_period = atof(optarg); break;
+                case 'P': max_period = atof(optarg); break;
+                case 'd': duration = atoi(optarg); break;
+                case 'c': change_rate = atof(optarg); break;
+                case 'x': cancel_rate = atof(optarg); break;
+                case 't': config.dispatchers = atoi(optarg); break;
+                case 'o': csv = optarg; break;
+                default:
+                        fprintf(stderr, "Usage: %s [-n alarms] [-p min period]"
+                          " [-P max period] [-d seconds] [-c changes/s]"
+                          " [-x cancels/s] [-t dispatchers] [-o csv file]\n",
+                          argv[0]);
+                        exit(1);
+                }
+        }
+        if (alarms < 1 || min_period < 0 || max_period < min_period)
+        {
+                fprintf(stderr, "Need at least one alarm and 0 <= min period"
+                  " <= max period\n");
+                exit(1);
+        }
+
+        //The engine's display output goes nowhere; the report goes to
+        //what was standard output
+        report = dup(STDOUT_FILENO);
+        null_fd = open("/dev/null", O_WRONLY);
+        if (report < 0 || null_fd < 0)
+                errno_abort ("Redirect output");
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+
+        config.fire_hook = on_fire;
+        config.log.overflow = LOG_DROP;
+        engine_start(&config);
+        srand(3221);
+
+        ids = (int*)malloc(alarms * sizeof(int));
+        if (ids == NULL)
+                errno_abort ("Allocate alarm ids");
+        start = bench_now_sec();
+        for (i = 0; i < alarms; i++)
+        {
+                snprintf(line, sizeof(line), "%g Message(%d) bench alarm %d",
+                  random_period(min_period, max_period), i, i);
+                timed_command(&insert_hist, line);
+                ids[i] = i;
+        }
+        load_time = bench_now_sec() - start;
+        live = next_id = alarms;
+
+        //Steady state: changes and cancels at their own rates; every
+        //cancelled alarm is replaced by a new one to keep the population
+        start = bench_now_sec();
+        end = start + duration;
+        next_change = change_rate > 0 ? start + 1 / change_rate : end;
+        next_cancel = cancel_rate > 0 ? start + 1 / cancel_rate : end;
+        while ((when = next_change < next_cancel ? next_change : next_cancel)
+          < end)
+        {
+                bench_sleep_until(when);
+                slot = rand() % live;
+                if (when == next_change)
+                {
+                        snprintf(line, sizeof(line),
+                          "%g Message(%d) changed alarm %d",
+                          random_period(min_period, max_period), ids[slot],
+                          ids[slot]);
+                        timed_command(&change_hist, line);
+                        next_change += 1 / change_rate;
+                }
+                else
+                {
+                        snprintf(line, sizeof(line), "Cancel: Message(%d)",
+                          ids[slot]);
+                        timed_command(&cancel_hist, line);
+                        ids[slot] = next_id++;
+                        snprintf(line, sizeof(line),
+                          "%g Message(%d) bench alarm %d",
+                          random_period(min_period, max_period), ids[slot],
+                          ids[slot]);
+                        timed_command(&insert_hist, line);
+                        next_cancel += 1 / cancel_rate;
+                }
+        }
+        bench_sleep_until(end);
+        getrusage(RUSAGE_SELF, &usage);
+
+        dprintf(report, "alarms %d, period %g-%g s, %d s steady state, "
+          "%d dispatchers, %s lock\n", alarms, min_period, max_period,
+          duration, config.dispatchers, rwlock_policy_name());
+        dprintf(report, "load: %d commands in %.3f s, %.0f commands/s\n",
+          alarms, load_time, alarms / load_time);
+        dprintf(report, "%-16s %10s %10s %10s %10s %10s\n", "latency (us)",
+          "count", "p50", "p90", "p99", "max");
+        report_latency(report, "insert", &insert_hist);
+        report_latency(report, "change", &change_hist);
+        report_latency(report, "cancel", &cancel_hist);
+        report_latency(report, "firing jitter", &jitter_hist);
+        dprintf(report, "cpu: %.2f s user, %.2f s system; peak rss %ld KB\n",
+          usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+          usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+          usage.ru_maxrss);
+
+        if (csv != NULL)
+        {
+                csv_fd = open(csv, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                if (csv_fd < 0)
+                        errno_abort ("Open CSV file");
+                if (lseek(csv_fd, 0, SEEK_END) == 0)
+                        dprintf(csv_fd, "alarms,min_period,max_period,"
+                          "duration,dispatchers,lock,commands_per_s,"
+                          "insert_p50_us,insert_p99_us,insert_max_us,"
+                          "change_p50_us,change_p99_us,change_max_us,"
+                          "cancel_p50_us,cancel_p99_us,cancel_max_us,"
+                          "firings,jitter_p50_us,jitter_p99_us,"
+                          "jitter_max_us,cpu_user_s,cpu_sys_s,peak_rss_kb\n");
+                dprintf(csv_fd, "%d,%g,%g,%d,%d,%s,%.0f,"
+                  "%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,"
+                  "%lu,%.1f,%.1f,%.1f,%.3f,%.3f,%ld\n",
+                  alarms, min_period, max_period, duration,
+                  config.dispatchers, rwlock_policy_name(),
+                  alarms / load_time,
+                  hist_percentile(&insert_hist, 50) / 1e3,
+                  hist_percentile(&insert_hist, 99) / 1e3,
+                  hist_percentile(&insert_hist, 100) / 1e3,
+                  hist_percentile(&change_hist, 50) / 1e3,
+                  hist_percentile(&change_hist, 99) / 1e3,
+                  hist_percentile(&change_hist, 100) / 1e3,
+                  hist_percentile(&cancel_hist, 50) / 1e3,
+                  hist_percentile(&cancel_hist, 99) / 1e3,
+                  hist_percentile(&cancel_hist, 100) / 1e3,
+                  (unsigned long)atomic_load(&jitter_hist.total),
+                  hist_percentile(&jitter_hist, 50) / 1e3,
+                  hist_percentile(&jitter_hist, 99) / 1e3,
+                  hist_percentile(&jitter_hist, 100) / 1e3,
+                  usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                  usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+                  usage.ru_maxrss);
+                close(csv_fd);
+        }
+        _exit(0);
+}
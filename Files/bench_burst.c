@@ -0,0 +1,140 @@
+/*
+ * bench_burst.c
+ *
+ * Bursts of alarms that all come due at the same instant, fired by
+ * the dispatcher pool. For each burst size, puts that many one-shot
+ * alarms on the scheduler with one deadline a little ahead, and
+ * times each firing against it. Each firing does a fixed amount of
+ * work, standing in for formatting a display. Reports the lateness
+ * of the firings, the time from the deadline to the last firing, and
+ * how the firings were shared out among the dispatchers.
+ *
+ * Usage: bench_burst [-t dispatchers] [-a] [-w ns of work per firing]
+ *                    [sizes...]
+ */
+#include <time.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_pool.h"
+#include "alarm_clock.h"
+#include "alarm_sched.h"
+#include "alarm_hist.h"
+#include "bench.h"
+
+// Dispatchers counted apart in the report, at most
+#define BURST_THREADS           64
+
+static alarm_sched_t sched;
+static alarm_hist_t lateness_hist;
+static atomic_ulong fired, fired_by[BURST_THREADS];
+static _Atomic uint64_t last_fired;
+static atomic_int next_thread;
+static _Thread_local int thread_index = -1;
+static uint64_t deadline;
+static int work_ns = 1000;
+
+// Records when the alarm fired, busies itself for a while, and drops it
+static int64_t burst_fire (alarm_t *alarm)
+{
+        uint64_t now = bench_now_ns(), last, until;
+
+        if (thread_index < 0)
+                thread_index = atomic_fetch_add(&next_thread, 1)
+                  % BURST_THREADS;
+        hist_record(&lateness_hist, now > deadline ? now - deadline : 0);
+        last = atomic_load_explicit(&last_fired, memory_order_relaxed);
+        while (now > last && !atomic_compare_exchange_weak(&last_fired,
+          &last, now))
+                ;
+        for (until = now + work_ns; bench_now_ns() < until; )
+                ;
+        atomic_fetch_add_explicit(&fired_by[thread_index], 1,
+          memory_order_relaxed);
+        atomic_fetch_add_explicit(&fired, 1, memory_order_release);
+        alarm_free(alarm);
+        return -1;
+}
+
+static void run_burst (int size, int threads)
+{
+        alarm_t **alarms;
+        struct timespec pause = { 0, 1000000 };
+        unsigned long count, low = (unsigned long)-1, high = 0;
+        int i;
+
+        alarms = (alarm_t**)malloc(size * sizeof(alarm_t*));
+        if (alarms == NULL)
+                errno_abort ("Allocate burst");
+        hist_reset(&lateness_hist);
+        atomic_store(&fired, 0);
+        atomic_store(&last_fired, 0);
+        for (i = 0; i < BURST_THREADS; i++)
+                atomic_store(&fired_by[i], 0);
+
+        //Far enough ahead for the whole burst to be on the wheel first,
+        //and on a tick boundary, so the wheel adds no lateness of its own
+        deadline = (clock_now() + 200000000 + (uint64_t)size * 1000)
+          / SCHED_TICK_NS * SCHED_TICK_NS;
+        for (i = 0; i < size; i++)
+        {
+                alarms[i] = alarm_alloc();
+                alarms[i]->deadline = deadline;
+                alarms[i]->schedState = SCHED_IDLE;
+        }
+        sched_add_batch(&sched, alarms, size);
+        free(alarms);
+        while (atomic_load_explicit(&fired, memory_order_acquire)
+          < (unsigned long)size)
+                nanosleep(&pause, NULL);
+
+        for (i = 0; i < threads && i < BURST_THREADS; i++)
+        {
+                count = atomic_load(&fired_by[i]);
+                low = count < low ? count : low;
+                high = count > high ? count : high;
+        }
+        printf("%9d %10.3f %10.3f %10.3f %12.3f %10lu %10lu\n", size,
+          hist_percentile(&lateness_hist, 50) / 1e6,
+          hist_percentile(&lateness_hist, 99) / 1e6,
+          hist_percentile(&lateness_hist, 100) / 1e6,
+          (atomic_load(&last_fired) - deadline) / 1e6, low, high);
+}
+
+int main (int argc, char *argv[])
+{
+        static const int sizes[] = { 10000, 100000, 1000000 };
+        int threads = SCHED_DEFAULT_THREADS, pin = 0, option, i;
+
+        while ((option = getopt(argc, argv, "t:aw:")) != -1)
+        {
+                switch (option)
+                {
+                case 't': threads = atoi(optarg); break;
+                case 'a': pin = 1; break;
+                case 'w': work_ns = atoi(optarg); break;
+                default:
+                        fprintf(stderr, "Usage: %s [-t dispatchers] [-a]"
+                          " [-w ns of work per firing] [sizes...]\n",
+                          argv[0]);
+                        exit(1);
+                }
+        }
+        if (threads <= 0 || work_ns < 0)
+        {
+                fprintf(stderr, "Need at least one dispatcher\n");
+                exit(1);
+        }
+
+        sched_start(&sched, threads, pin, burst_fire);
+        printf("%d dispatchers%s, %d ns of work per firing\n", threads,
+          pin ? " pinned" : "", work_ns);
+        printf("%9s %10s %10s %10s %12s %10s %10s\n", "alarms", "p50 ms",
+          "p99 ms", "max ms", "last fired", "fewest", "most");
+        if (optind < argc)
+                for (i = optind; i < argc; i++)
+                        run_burst(atoi(argv[i]), threads);
+        else
+                for (i = 0; i < 3; i++)
+                        run_burst(sizes[i], threads);
+        return 0;
+}
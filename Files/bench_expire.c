@@ -0,0 +1,189 @@
+/*
+ * bench_expire.c
+ *
+ * Memory under a steady stream of short-lived timers. Adds timers
+ * that retire themselves ("Once", "Times(2)" and "Expires(...)" in
+ * turn) at a fixed rate, with periods spread between a minimum and a
+ * maximum, and lets them expire with no cancels. Every second it
+ * prints the resident set, the alarms the pool has out and the
+ * interned messages, so any growth shows; at the end it compares the
+ * second half of the run with the first.
+ *
+ * Usage: bench_expire [-r timers/s] [-d seconds] [-p min period]
+ *                     [-P max period] [-t dispatchers]
+ */
+#include <fcntl.h>
+#include <time.h>
+#include "errors.h"
+#include "alarm_engine.h"
+#include "alarm_pool.h"
+#include "alarm_intern.h"
+#include "alarm_hist.h"
+#include "bench.h"
+
+// How often the timers for the next slice of the second go in
+#define BENCH_SLICES            100
+
+static alarm_hist_t lateness_hist;
+static atomic_ulong firings;
+
+static void on_fire (alarm_t *alarm, double lateness)
+{
+        atomic_fetch_add_explicit(&firings, 1, memory_order_relaxed);
+        hist_record(&lateness_hist,
+          lateness > 0 ? (uint64_t)(lateness * 1e9) : 0);
+}
+
+// Resident set in KB, from /proc
+static long rss_kb (void)
+{
+        long pages = 0, resident = 0;
+        FILE *statm = fopen("/proc/self/statm", "r");
+
+        if (statm == NULL)
+                return 0;
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+                resident = 0;
+        fclose(statm);
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main (int argc, char *argv[])
+{
+        int rate = 100000, duration = 30, dispatchers = 0, option;
+        double min_period = 0.05, max_period = 0.5, period, start, next;
+        engine_config_t config;
+        alarm_pool_stats_t pool;
+        intern_stats_t interned;
+        long rss, half_rss = 0, max_first = 0, max_second = 0;
+        size_t max_live_first = 0, max_live_second = 0;
+        unsigned long added = 0, last_added = 0, last_firings = 0;
+        int report, null_fd, second, slice, i, per_slice, kind = 0;
+        char line[128];
+
+        engine_config_default(&config);
+        while ((option = getopt(argc, argv, "r:d:p:P:t:")) != -1)
+        {
+                switch (option)
+                {
+                case 'r': rate = atoi(optarg); break;
+                case 'd': duration = atoi(optarg); break;
+                case 'p': min_period = atof(optarg); break;
+                case 'P': max_period = atof(optarg); break;
+                case 't': dispatchers = atoi(optarg); break;
+                default:
+                        fprintf(stderr, "Usage: %s [-r timers/s] [-d seconds]"
+                          " [-p min period] [-P max period]"
+                          " [-t dispatchers]\n", argv[0]);
+                        exit(1);
+                }
+        }
+        if (rate < BENCH_SLICES || duration < 2 || min_period <= 0
+          || max_period < min_period)
+        {
+                fprintf(stderr, "Need at least %d timers/s, 2 seconds and"
+                  " 0 < min period <= max period\n", BENCH_SLICES);
+                exit(1);
+        }
+        if (dispatchers > 0)
+                config.dispatchers = dispatchers;
+
+        //The displays go nowhere; the report goes to what was standard
+        //output
+        report = dup(STDOUT_FILENO);
+        null_fd = open("/dev/null", O_WRONLY);
+        if (report < 0 || null_fd < 0)
+                errno_abort ("Redirect output");
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        config.fire_hook = on_fire;
+        config.log.overflow = LOG_DROP;
+        engine_start(&config);
+        srand(3221);
+
+        dprintf(report, "%d timers/s for %d s, periods %g-%g s, "
+          "%d dispatchers\n", rate, duration, min_period, max_period,
+          config.dispatchers);
+        dprintf(report, "%6s %10s %10s %10s %10s %10s %10s\n", "second",
+          "added/s", "fired/s", "rss KB", "pool live", "pool free",
+          "messages");
+        per_slice = rate / BENCH_SLICES;
+        start = bench_now_sec();
+        for (second = 1; second <= duration; second++)
+        {
+                for (slice = 0; slice < BENCH_SLICES; slice++)
+                {
+                        for (i = 0; i < per_slice; i++, added++)
+                        {
+                                period = min_period + (max_period - min_period)
+                                  * (rand() % 1001) / 1000.0;
+                                //Each kind retires after one or two displays
+                                switch (kind++ % 3)
+                                {
+                                case 0:
+                                        snprintf(line, sizeof(line), "%.3f Once"
+                                          " Message(%lu) timeout", period,
+                                          added % 1000000000);
+                                        break;
+                                case 1:
+                                        snprintf(line, sizeof(line), "%.3f"
+                                          " Times(2) Message(%lu) retry",
+                                          period / 2, added % 1000000000);
+                                        break;
+                                default:
+                                        snprintf(line, sizeof(line), "%.3f"
+                                          " Expires(%.3f) Message(%lu) lease",
+                                          period / 2, period,
+                                          added % 1000000000);
+                                        break;
+                                }
+                                engine_command(line, LOG_CONSOLE);
+                        }
+                        next = start + second - 1
+                          + (slice + 1) / (double)BENCH_SLICES;
+                        bench_sleep_until(next);
+                }
+
+                rss = rss_kb();
+                alarm_pool_stats(&pool);
+                intern_get_stats(&interned);
+                dprintf(report, "%6d %10lu %10lu %10ld %10zu %10zu %10zu\n",
+                  second, added - last_added,
+                  atomic_load(&firings) - last_firings, rss, pool.live,
+                  pool.free, interned.strings);
+                last_added = added;
+                last_firings = atomic_load(&firings);
+                //The first second fills the table up, so it is left out
+                if (second == 1)
+                        continue;
+                if (second <= duration / 2)
+                {
+                        max_first = rss > max_first ? rss : max_first;
+                        max_live_first = pool.live > max_live_first
+                          ? pool.live : max_live_first;
+                        half_rss = rss;
+                }
+                else
+                {
+                        max_second = rss > max_second ? rss : max_second;
+                        max_live_second = pool.live > max_live_second
+                          ? pool.live : max_live_second;
+                }
+        }
+
+        alarm_pool_stats(&pool);
+        dprintf(report, "%lu added in %.3f s, %.0f/s; %lu fired\n", added,
+          bench_now_sec() - start, added / (bench_now_sec() - start),
+          atomic_load(&firings));
+        dprintf(report, "peak rss: first half %ld KB, second half %ld KB"
+          " (%+ld KB); peak pool live: %zu, %zu; pool high-water %zu in"
+          " %zu slabs\n", max_first, max_second, max_second - max_first,
+          max_live_first, max_live_second, pool.high_water, pool.slabs);
+        dprintf(report, "rss from the middle to the end: %+ld KB\n",
+          rss_kb() - half_rss);
+        dprintf(report, "lateness (us): p50 %.1f, p99 %.1f, max %.1f\n",
+          hist_percentile(&lateness_hist, 50) / 1e3,
+          hist_percentile(&lateness_hist, 99) / 1e3,
+          hist_percentile(&lateness_hist, 100) / 1e3);
+        _exit(0);
+}
@@ -0,0 +1,76 @@
+/*
+ * bench_index.c
+ *
+ * Measures alarm_insert latency for new alarms, changes and cancels
+ * as the alarm list grows from 10 to 1,000,000 alarms. With the
+ * message number index, each column should stay flat as the list
+ * grows.
+ *
+ * Usage: bench_index [ops per size]
+ */
+#include <time.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_intern.h"
+#include "alarm_pool.h"
+#include "bench.h"
+
+int main (int argc, char *argv[])
+{
+        int ops = argc > 1 ? atoi(argv[1]) : 10000;
+        int size, i;
+        alarm_t **added, *alarm;
+        double start, insert_ns, change_ns, cancel_ns;
+
+        added = (alarm_t**)malloc(ops * sizeof(alarm_t*));
+        if (added == NULL)
+                errno_abort ("Allocate alarms");
+        srand(3221);
+
+        printf("%10s %12s %12s %12s\n", "alarms", "insert ns", "change ns",
+          "cancel ns");
+        for (size = 10; size <= 1000000; size *= 10)
+        {
+                alarm_list_init();
+                for (i = 0; i < size; i++)
+                        alarm_insert(bench_make_alarm(i, 1));
+
+                //New message numbers, one past the end of the list
+                for (i = 0; i < ops; i++)
+                        added[i] = bench_make_alarm(size + i, 1);
+                start = bench_now_ns();
+                for (i = 0; i < ops; i++)
+                        alarm_insert(added[i]);
+                insert_ns = (bench_now_ns() - start) / ops;
+
+                //Changes to message numbers spread over the whole list
+                alarm = bench_make_alarm(0, 1);
+                start = bench_now_ns();
+                for (i = 0; i < ops; i++)
+                {
+                        alarm->messageNum = rand() % size;
+                        alarm_insert(alarm);
+                }
+                change_ns = (bench_now_ns() - start) / ops;
+                alarm_free(alarm);
+
+                //Cancels of the alarms added above: the cancel request
+                //goes on the list and alarm_thread then removes both
+                start = bench_now_ns();
+                for (i = 0; i < ops; i++)
+                {
+                        alarm = bench_make_alarm(size + i, 0);
+                        alarm_insert(alarm);
+                        alarm_remove(alarm);
+                        alarm_free(alarm);
+                        alarm_free(added[i]);
+                }
+                cancel_ns = (bench_now_ns() - start) / ops;
+
+                printf("%10d %12.1f %12.1f %12.1f\n", size, insert_ns,
+                  change_ns, cancel_ns);
+                alarm_list_destroy();
+        }
+        free(added);
+        return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * bench_layout.c
+ *
+ * Measures what the layout of alarm_t costs the two loops that touch
+ * every alarm: a scan of the store in message number order, the way
+ * alarm_list_walk and a listing go, and a scheduling pass that
+ * runs each alarm through the timing wheel and reads what a firing
+ * reads. The alarms come from the pool, as in the engine, and carry
+ * a few hundred distinct messages between them.
+ *
+ * Usage: bench_layout [alarms] [distinct messages]
+ */
+#include <time.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_intern.h"
+#include "alarm_pool.h"
+#include "alarm_wheel.h"
+#include "bench.h"
+
+// Ticks the deadlines are spread over, a little over a minute at 1 ms
+#define BENCH_TICKS     (1 << 16)
+
+#define timer_alarm(t) ((alarm_t*)((char*)(t) - offsetof(alarm_t, timer)))
+
+// What a scan looks at: the number, the type and whether it is live
+static void scan_visit (alarm_t *alarm, void *arg)
+{
+        long *sum = (long*)arg;
+
+        if (alarm->alarmRequestType == 1 && alarm->alarmExistsFlag)
+                *sum += alarm->messageNum;
+}
+
+int main (int argc, char *argv[])
+{
+        int count = argc > 1 ? atoi(argv[1]) : 1000000;
+        int distinct = argc > 2 ? atoi(argv[2]) : 500;
+        alarm_t **alarms;
+        alarm_pool_stats_t pool;
+        intern_stats_t interned;
+        wheel_t wheel;
+        wheel_timer_t expired, *timer;
+        alarm_snapshot_t snapshot;
+        alarm_t *alarm;
+        char text[64];
+        double start, elapsed;
+        long sum = 0, fired = 0;
+        uint64_t deadline = 0;
+        int i, length, pass;
+
+        if (count <= 0 || distinct <= 0)
+        {
+                fprintf(stderr, "Usage: %s [alarms] [distinct messages]\n",
+                  argv[0]);
+                return 1;
+        }
+        alarm_list_init();
+        alarms = (alarm_t**)malloc(count * sizeof(alarm_t*));
+        if (alarms == NULL)
+                errno_abort ("Allocate alarms");
+
+        srand(1);
+        start = bench_now_sec();
+        for (i = 0; i < count; i++)
+        {
+                alarm = alarms[i] = alarm_alloc();
+                memset(alarm, 0, sizeof(alarm_t));
+                alarm->messageNum = i;
+                alarm->alarmRequestType = 1;
+                alarm->seconds = 1 + rand() % 60;
+                length = snprintf(text, sizeof(text),
+                  "reminder number %d for the benchmark", rand() % distinct);
+                alarm->message = intern_get(text, length);
+                alarm_insert(alarm);
+        }
+        elapsed = bench_now_sec() - start;
+        alarm_pool_stats(&pool);
+        intern_get_stats(&interned);
+        printf("%d alarms, %zu bytes each, %zu slabs; %zu distinct messages"
+          " in %zu bytes\n", count, sizeof(alarm_t), pool.slabs,
+          interned.strings, interned.bytes);
+        printf("%-12s %10.1f ns/alarm\n", "insert", elapsed * 1e9 / count);
+
+        //The first scan brings the store into whatever cache it fits
+        for (pass = 0; pass < 4; pass++)
+        {
+                start = bench_now_sec();
+                alarm_list_walk(scan_visit, &sum);
+                elapsed = bench_now_sec() - start;
+        }
+        printf("%-12s %10.1f ns/alarm %10.1f M alarms/s\n", "scan",
+          elapsed * 1e9 / count, count / elapsed / 1e6);
+
+        //Every alarm onto the wheel at a random tick, then the wheel run
+        //to the end with each alarm "fired" as a dispatcher would
+        start = bench_now_sec();
+        wheel_init(&wheel, 0);
+        timer_list_init(&expired);
+        for (i = 0; i < count; i++)
+        {
+                alarms[i]->timer.expires = 1 + rand() % BENCH_TICKS;
+                wheel_add(&wheel, &alarms[i]->timer);
+        }
+        wheel_advance(&wheel, BENCH_TICKS, &expired);
+        while ((timer = timer_list_pop(&expired)) != NULL)
+        {
+                alarm = timer_alarm(timer);
+                alarm_read(alarm, &snapshot);
+                if (alarm->alarmExistsFlag && snapshot.message[0] != '\0')
+                {
+                        alarm->displays++;
+                        alarm->shownVersion = snapshot.version;
+                        alarm->deadline += (uint64_t)(snapshot.seconds * 1e9);
+                        deadline ^= alarm->deadline + alarm->client;
+                        fired++;
+                }
+        }
+        elapsed = bench_now_sec() - start;
+        printf("%-12s %10.1f ns/alarm %10.1f M alarms/s\n", "schedule",
+          elapsed * 1e9 / count, count / elapsed / 1e6);
+
+        //Keeps the compiler from dropping the loops
+        if (sum == 42 && fired == 42 && deadline == 42)
+                printf("\n");
+        return 0;
+}
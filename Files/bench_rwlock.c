@@ -0,0 +1,113 @@
+/*
+ * bench_rwlock.c
+ *
+ * Writer wait time on the alarm list lock while display threads keep
+ * reading it. One writer thread stands in for main entering alarms;
+ * a growing number of reader threads stand in for the dispatchers,
+ * each holding the lock for about as long as one display line takes
+ * and coming straight back for it. Build once per policy (make
+ * bench_rwlock) and compare the p50/p99/max columns.
+ *
+ * Usage: bench_rwlock_<policy> [milliseconds per row]
+ */
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "alarm_rwlock.h"
+#include "bench.h"
+
+#define MAX_READERS     32
+#define MAX_SAMPLES     200000
+#define READ_HOLD_NS    5000                            /* one printf */
+#define READ_GAP_NS     500
+#define WRITE_HOLD_NS   1000                            /* one alarm_insert */
+#define WRITE_GAP_US    200                             /* next input line */
+
+static alarm_rwlock_t lock;
+static atomic_int stop;
+static double samples[MAX_SAMPLES];
+static int nsamples;
+
+static void spin_ns (double ns)
+{
+        double end = bench_now_ns() + ns;
+
+        while (bench_now_ns() < end)
+                ;
+}
+
+static void *reader_thread (void *arg)
+{
+        while (!atomic_load(&stop))
+        {
+                rwlock_read_lock(&lock);
+                spin_ns(READ_HOLD_NS);
+                rwlock_read_unlock(&lock);
+                spin_ns(READ_GAP_NS);
+        }
+        return NULL;
+}
+
+static void *writer_thread (void *arg)
+{
+        double start;
+
+        while (!atomic_load(&stop) && nsamples < MAX_SAMPLES)
+        {
+                start = bench_now_ns();
+                rwlock_write_lock(&lock);
+                samples[nsamples++] = bench_now_ns() - start;
+                spin_ns(WRITE_HOLD_NS);
+                rwlock_write_unlock(&lock);
+                usleep(WRITE_GAP_US);
+        }
+        return NULL;
+}
+
+static int compare_double (const void *a, const void *b)
+{
+        double x = *(const double*)a, y = *(const double*)b;
+
+        return (x > y) - (x < y);
+}
+
+int main (int argc, char *argv[])
+{
+        int millis = argc > 1 ? atoi(argv[1]) : 500;
+        pthread_t readers[MAX_READERS], writer;
+        int nreaders, i, status;
+
+        printf("%-12s %8s %8s %10s %10s %12s\n", "policy", "readers",
+          "writes", "p50 us", "p99 us", "max us");
+        for (nreaders = 1; nreaders <= MAX_READERS; nreaders *= 2)
+        {
+                rwlock_init(&lock);
+                atomic_store(&stop, 0);
+                nsamples = 0;
+                for (i = 0; i < nreaders; i++)
+                {
+                        status = pthread_create(&readers[i], NULL,
+                          reader_thread, NULL);
+                        if (status != 0)
+                                err_abort (status, "Create reader");
+                }
+                status = pthread_create(&writer, NULL, writer_thread, NULL);
+                if (status != 0)
+                        err_abort (status, "Create writer");
+
+                usleep(millis * 1000);
+                //Stopping the readers also frees a writer they starved
+                atomic_store(&stop, 1);
+                for (i = 0; i < nreaders; i++)
+                        pthread_join(readers[i], NULL);
+                pthread_join(writer, NULL);
+
+                qsort(samples, nsamples, sizeof(double), compare_double);
+                printf("%-12s %8d %8d %10.1f %10.1f %12.1f\n",
+                  rwlock_policy_name(), nreaders, nsamples,
+                  samples[nsamples / 2] / 1e3,
+                  samples[(int)(nsamples * 0.99)] / 1e3,
+                  samples[nsamples - 1] / 1e3);
+        }
+        return 0;
+}
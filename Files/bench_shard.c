@@ -0,0 +1,119 @@
+/*
+ * bench_shard.c
+ *
+ * Measures how alarm store throughput scales with the number of
+ * threads changing it. Each thread adds, changes and cancels alarms
+ * on message numbers of its own, taking the shard lock for each
+ * request just as the engine does, on top of a preloaded population.
+ * Built once per shard count (bench_shard_1, bench_shard_16, ...):
+ * with one shard every request serializes on one lock, with more the
+ * total should rise with the number of cores.
+ *
+ * Usage: bench_shard [max threads] [rounds per thread] [preloaded]
+ */
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "alarm.h"
+#include "alarm_intern.h"
+#include "alarm_pool.h"
+#include "bench.h"
+
+// Message numbers each thread may use, above the preloaded ones
+#define THREAD_RANGE    (1 << 24)
+
+static int rounds, preload;
+static pthread_barrier_t start_line;
+
+// One request under the shard lock, as engine_submit makes it
+static void locked_insert (alarm_t *alarm)
+{
+        alarm_rwlock_t *lock = alarm_shard_lock(alarm->messageNum);
+
+        rwlock_write_lock(lock);
+        alarm_insert(alarm);
+        rwlock_write_unlock(lock);
+}
+
+static void *worker (void *arg)
+{
+        int base = preload + (int)(long)arg * THREAD_RANGE;
+        alarm_t *alarm, *change, *cancel;
+        alarm_rwlock_t *lock;
+        int i;
+
+        change = bench_make_alarm(0, 1);
+        pthread_barrier_wait(&start_line);
+        for (i = 0; i < rounds; i++)
+        {
+                alarm = bench_make_alarm(base + i, 1);
+                locked_insert(alarm);
+                change->messageNum = base + i;
+                locked_insert(change);
+
+                //The cancel goes on the list, then comes off with the
+                //alarm, as alarm_thread does it. Nothing reads the store
+                //here, so both can be freed at once.
+                cancel = bench_make_alarm(base + i, 0);
+                locked_insert(cancel);
+                lock = alarm_shard_lock(cancel->messageNum);
+                rwlock_write_lock(lock);
+                alarm_remove(cancel);
+                rwlock_write_unlock(lock);
+                alarm_free(cancel);
+                alarm_free(alarm);
+        }
+        alarm_free(change);
+        return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+        int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+        pthread_t *threads;
+        double start, elapsed, base_rate = 0;
+        int nthreads, i, status;
+
+        rounds = argc > 2 ? atoi(argv[2]) : 200000;
+        preload = argc > 3 ? atoi(argv[3]) : 10000;
+        threads = (pthread_t*)malloc(max_threads * sizeof(pthread_t));
+        if (threads == NULL)
+                errno_abort ("Allocate threads");
+
+        printf("%d shards, %d alarms preloaded, %s lock\n", ALARM_SHARDS,
+          preload, rwlock_policy_name());
+        printf("%8s %14s %10s\n", "threads", "requests/s", "speedup");
+        for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+        {
+                alarm_list_init();
+                for (i = 0; i < preload; i++)
+                        alarm_insert(bench_make_alarm(i, 1));
+                pthread_barrier_init(&start_line, NULL, nthreads + 1);
+                for (i = 0; i < nthreads; i++)
+                {
+                        status = pthread_create(&threads[i], NULL, worker,
+                          (void*)(long)i);
+                        if (status != 0)
+                                err_abort (status, "Create worker");
+                }
+                //The clock starts before the barrier: with fewer cores
+                //than threads the workers may be done before this thread
+                //is back from it
+                start = bench_now_sec();
+                pthread_barrier_wait(&start_line);
+                for (i = 0; i < nthreads; i++)
+                        pthread_join(threads[i], NULL);
+                elapsed = bench_now_sec() - start;
+                pthread_barrier_destroy(&start_line);
+
+                //Add, change, cancel and remove make four requests a round
+                if (nthreads == 1)
+                        base_rate = 4.0 * rounds / elapsed;
+                printf("%8d %14.0f %9.2fx\n", nthreads,
+                  4.0 * nthreads * rounds / elapsed,
+                  4.0 * nthreads * rounds / elapsed / base_rate);
+                alarm_list_destroy();
+        }
+        free(threads);
+        return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * bench_shm.c
+ *
+ * Throughput of the shared-memory front end. Forks client processes,
+ * then starts the engine and the shared-memory server in this one.
+ * Each client attaches and keeps up to a window of requests in
+ * flight, adding an alarm and cancelling it again, until it has had
+ * SHM_EVENT_DONE for all of its requests. Reports requests per
+ * second over all clients and the time from submitting a request to
+ * reading its DONE.
+ *
+ * Usage: bench_shm [-c clients] [-n requests per client] [-w window]
+ *                  [-t dispatchers]
+ */
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "errors.h"
+#include "alarm_engine.h"
+#include "alarm_hist.h"
+#include "alarm_shm.h"
+#include "alarm_shm_server.h"
+#include "bench.h"
+
+#define BENCH_SHM_NAME          "/alarm_bench_shm"
+
+// What a client sends back when it is done
+typedef struct bench_result_tag {
+        double            seconds;
+        unsigned long     dropped;                      /* events lost */
+        alarm_hist_t      latency;                      /* ns, to DONE */
+} bench_result_t;
+
+static void write_all (int fd, const void *data, size_t length)
+{
+        ssize_t count;
+
+        while (length > 0)
+        {
+                count = write(fd, data, length);
+                if (count < 0 && errno == EINTR)
+                        continue;
+                if (count <= 0)
+                        errno_abort ("Write result");
+                data = (const char*)data + count;
+                length -= count;
+        }
+}
+
+static int read_all (int fd, void *data, size_t length)
+{
+        ssize_t count;
+
+        while (length > 0)
+        {
+                count = read(fd, data, length);
+                if (count < 0 && errno == EINTR)
+                        continue;
+                if (count <= 0)
+                        return -1;
+                data = (char*)data + count;
+                length -= count;
+        }
+        return 0;
+}
+
+/*
+ * One client process. Request i adds alarm "base + i/2" when i is
+ * even and cancels it when i is odd; the tag is when it was sent.
+ */
+static void bench_client (int go, int out, int base, int requests,
+  int window)
+{
+        static bench_result_t result;
+        shm_client_t client;
+        const shm_event_t *event;
+        uint64_t start, now;
+        int sent = 0, done = 0, seen, status;
+        char signal;
+
+        if (read_all(go, &signal, 1) != 0)
+                exit(1);
+        if (shm_attach(BENCH_SHM_NAME, &client) != 0)
+                errno_abort ("Attach to server");
+        hist_reset(&result.latency);
+        start = bench_now_ns();
+        while (done < requests)
+        {
+                while (sent < requests && sent - done < window)
+                {
+                        status = sent % 2 == 0
+                          ? shm_submit(&client, 1, base + sent / 2, 1000,
+                            "bench alarm", bench_now_ns())
+                          : shm_submit(&client, 0, base + sent / 2, 0, "",
+                            bench_now_ns());
+                        if (status != 0)
+                                break;
+                        sent++;
+                }
+                now = bench_now_ns();
+                seen = 0;
+                while ((event = shm_next_event(&client)) != NULL)
+                {
+                        seen++;
+                        if (event->kind == SHM_EVENT_DONE)
+                        {
+                                hist_record(&result.latency,
+                                  now - event->tag);
+                                done++;
+                        }
+                        shm_event_done(&client, event);
+                }
+                //Gives the server the processor rather than spinning;
+                //with nothing in flight no event would wake the client
+                if (seen == 0 && sent > done)
+                        shm_wait(&client);
+                else if (seen == 0)
+                        sched_yield();
+        }
+        result.seconds = (bench_now_ns() - start) / 1e9;
+        result.dropped = atomic_load(&client.slot->dropped);
+        shm_detach(&client);
+        write_all(out, &result, sizeof(result));
+        exit(0);
+}
+
+int main (int argc, char *argv[])
+{
+        int clients = 4, requests = 1000000, window = 128;
+        int option, go[2], out[2], null_fd, report, i;
+        bench_result_t result;
+        alarm_hist_t latency;
+        engine_config_t config;
+        unsigned long dropped = 0;
+        double start, seconds, slowest = 0;
+
+        engine_config_default(&config);
+        while ((option = getopt(argc, argv, "c:n:w:t:")) != -1)
+        {
+                switch (option)
+                {
+                case 'c': clients = atoi(optarg); break;
+                case 'n': requests = atoi(optarg); break;
+                case 'w': window = atoi(optarg); break;
+                case 't': config.dispatchers = atoi(optarg); break;
+                default:
+                        fprintf(stderr, "Usage: %s [-c clients]"
+                          " [-n requests per client] [-w window]"
+                          " [-t dispatchers]\n", argv[0]);
+                        exit(1);
+                }
+        }
+        //A window that fits in the quarter of the event ring kept for
+        //DONE means no answer is lost
+        if (clients < 1 || clients > SHM_MAX_CLIENTS || requests < 2
+          || window < 1 || window > SHM_EVENTS / 4)
+        {
+                fprintf(stderr, "Need 1 to %d clients, 2 or more requests"
+                  " and a window of 1 to %d\n", SHM_MAX_CLIENTS,
+                  SHM_EVENTS / 4);
+                exit(1);
+        }
+
+        //The clients are forked before the engine has any threads
+        if (pipe(go) != 0 || pipe(out) != 0)
+                errno_abort ("Create pipes");
+        for (i = 0; i < clients; i++)
+        {
+                if (fork() == 0)
+                {
+                        close(go[1]);
+                        close(out[0]);
+                        bench_client(go[0], out[1], i * requests, requests,
+                          window);
+                }
+        }
+        close(go[0]);
+        close(out[1]);
+
+        //The engine's output goes nowhere; the report goes to what was
+        //standard output
+        report = dup(STDOUT_FILENO);
+        null_fd = open("/dev/null", O_WRONLY);
+        if (report < 0 || null_fd < 0)
+                errno_abort ("Redirect output");
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        config.event_hook = shm_event;
+        config.log.overflow = LOG_DROP;
+        engine_start(&config);
+        shm_serve(BENCH_SHM_NAME);
+
+        start = bench_now_ns() / 1e9;
+        for (i = 0; i < clients; i++)
+                write_all(go[1], "g", 1);
+        hist_reset(&latency);
+        for (i = 0; i < clients; i++)
+        {
+                if (read_all(out[0], &result, sizeof(result)) != 0)
+                        errno_abort ("Read client result");
+                hist_merge(&latency, &result.latency);
+                dropped += result.dropped;
+                if (result.seconds > slowest)
+                        slowest = result.seconds;
+        }
+        seconds = bench_now_ns() / 1e9 - start;
+        while (wait(NULL) > 0)
+                ;
+        shm_unlink(BENCH_SHM_NAME);
+
+        dprintf(report, "%d clients x %d requests, window %d: %.3f s,"
+          " %.0f requests/s (slowest client %.3f s)\n", clients, requests,
+          window, seconds, (double)clients * requests / seconds, slowest);
+        dprintf(report, "request to DONE: mean %.1f us, p50 %.1f us,"
+          " p99 %.1f us, max %.1f us; %lu events dropped\n",
+          hist_mean(&latency) / 1e3, hist_percentile(&latency, 50) / 1e3,
+          hist_percentile(&latency, 99) / 1e3,
+          atomic_load(&latency.max) / 1e3, dropped);
+        return 0;
+}
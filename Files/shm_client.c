@@ -0,0 +1,109 @@
+/*
+ * shm_client.c
+ *
+ * Demo client of the shared-memory front end. Attaches to a server
+ * started with "-g name", adds a few alarms, prints every event it
+ * is sent for a while, then cancels the alarms and prints what comes
+ * back for them before detaching.
+ *
+ * Usage: shm_client [-g name] [-n alarms] [-p period] [-d seconds]
+ *                   [-b first message number]
+ */
+#include <time.h>
+#include "errors.h"
+#include "alarm_shm.h"
+#include "bench.h"
+
+static const char *kind_names[] = { "DONE", "CREATED", "DISPLAY",
+  "CHANGED", "CANCELLED", "GONE" };
+
+// Submits a request, waiting for room in the ring if it is full
+static void submit (shm_client_t *client, int type, int messageNum,
+  double seconds, const char *message, uint64_t tag)
+{
+        struct timespec pause = { 0, 100000 };
+
+        while (shm_submit(client, type, messageNum, seconds, message,
+          tag) != 0)
+        {
+                if (errno != EAGAIN)
+                        errno_abort ("Submit request");
+                nanosleep(&pause, NULL);
+        }
+}
+
+// Prints the events that have come in, until "until"
+static void print_events (shm_client_t *client, double until)
+{
+        struct timespec pause = { 0, 1000000 };
+        const shm_event_t *event;
+
+        do
+        {
+                while ((event = shm_next_event(client)) != NULL)
+                {
+                        //The event is read where the server wrote it
+                        printf("%.3f %s Message(%d)", event->time,
+                          kind_names[event->kind], event->messageNum);
+                        if (event->kind == SHM_EVENT_DONE)
+                                printf(" tag %llu result %d",
+                                  (unsigned long long)event->tag,
+                                  event->result);
+                        if (event->length > 0)
+                                printf(" %.*s", (int)event->length,
+                                  event->message);
+                        printf("\n");
+                        shm_event_done(client, event);
+                }
+                fflush(stdout);
+                nanosleep(&pause, NULL);
+        } while (bench_now_sec() < until);
+}
+
+int main (int argc, char *argv[])
+{
+        const char *name = "/alarms";
+        int alarms = 3, first = 1, option, i;
+        double period = 1, duration = 5;
+        shm_client_t client;
+        char message[SHM_MESSAGE_MAX];
+
+        while ((option = getopt(argc, argv, "g:n:p:d:b:")) != -1)
+        {
+                switch (option)
+                {
+                case 'g': name = optarg; break;
+                case 'n': alarms = atoi(optarg); break;
+                case 'p': period = atof(optarg); break;
+                case 'd': duration = atof(optarg); break;
+                case 'b': first = atoi(optarg); break;
+                default:
+                        fprintf(stderr, "Usage: %s [-g name] [-n alarms]"
+                          " [-p period] [-d seconds] [-b first message"
+                          " number]\n", argv[0]);
+                        exit(1);
+                }
+        }
+        if (shm_attach(name, &client) != 0)
+                errno_abort ("Attach to server");
+        printf("Attached to %s as client %d\n", name, client.index);
+
+        for (i = 0; i < alarms; i++)
+        {
+                snprintf(message, sizeof(message), "from %d, alarm %d",
+                  (int)getpid(), i);
+                submit(&client, 1, first + i, period, message, i);
+        }
+        print_events(&client, bench_now_sec() + duration);
+
+        for (i = 0; i < alarms; i++)
+                submit(&client, 0, first + i, 0, "", alarms + i);
+        //Long enough for the dispatchers to let the alarms go
+        print_events(&client, bench_now_sec() + period + 0.5);
+
+        if (client.slot->dropped > 0)
+                printf("%lu events dropped\n",
+                  (unsigned long)client.slot->dropped);
+        shm_detach(&client);
+        return 0;
+}